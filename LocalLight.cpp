@@ -64,7 +64,7 @@ LocalLight::LocalLight(bool randomize, bool castingShadow, bool allWhite)
 	}
 
 	isCasting = castingShadow;
-	lightModel = new Sphere(32);
+	lightModel = VolumeModel();
 
 	/*AttenuationMap::iterator iter = attenuationLookUpMap.begin();
 	++iter;
@@ -87,3 +87,51 @@ LocalLight::LocalLight(bool randomize, bool castingShadow, bool allWhite)
 LocalLight::~LocalLight()
 {
 }
+
+// Every light volume is one of the same few unit spheres, scaled by its
+// range in the vertex shader
+Model* LocalLight::VolumeModel(int lod)
+{
+	static Model* volumes[LightVolumeLODCount] = {
+		new Icosahedron(), new Sphere(8), new Sphere(16), new Sphere(32) };
+	return volumes[lod];
+}
+
+float LocalLight::VolumeScale(int lod)
+{
+	// An icosahedron's inradius is 0.795 of its circumradius; the flattest
+	// quads of Sphere(n) sit cos^2(pi/2n) from the center
+	static const int divisions[LightVolumeLODCount] = { 0, 8, 16, 32 };
+	if (divisions[lod] == 0)
+		return 1.2585f;
+	float c = cos(3.14159265f / (2 * divisions[lod]));
+	return 1.0f / (c * c);
+}
+
+int LocalLight::VolumeLOD(float projectedRadiusPixels)
+{
+	static const float maxPixels[LightVolumeLODCount - 1] = { 12.0f, 48.0f, 160.0f };
+	int lod = 0;
+	while (lod < LightVolumeLODCount - 1 && projectedRadiusPixels > maxPixels[lod])
+		++lod;
+	return lod;
+}
+
+LightAnimation LocalLight::RandomAnimation()
+{
+	LightAnimation animation;
+	animation.phase = RandomFloat(0.0f, 6.2831853f);
+	if (RandomFloat(0, 1) < 0.5f) {
+		animation.orbitRadius = RandomFloat(1.0f, 6.0f);
+		animation.orbitSpeed = RandomFloat(-1.5f, 1.5f);
+	}
+	if (RandomFloat(0, 1) < 0.3f) {
+		animation.flickerAmount = RandomFloat(0.1f, 0.5f);
+		animation.flickerSpeed = RandomFloat(5.0f, 20.0f);
+	}
+	if (RandomFloat(0, 1) < 0.25f) {
+		animation.cycleAmount = RandomFloat(0.3f, 1.0f);
+		animation.cycleSpeed = RandomFloat(0.2f, 1.0f);
+	}
+	return animation;
+}
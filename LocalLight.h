@@ -2,8 +2,13 @@
 
 #include "glsdk\glm\glm\glm.hpp"
 #include "models.h"
+#include "lightstore.h"
 #include <map>
 
+// Light volume proxies, coarsest first: an icosahedron, then Sphere(8),
+// Sphere(16) and Sphere(32)
+const int LightVolumeLODCount = 4;
+
 class LocalLight
 {
 public:
@@ -24,5 +29,15 @@ public:
 	float maxBrightness;
 
 	static AttenuationMap attenuationLookUpMap;
+
+	// Shared by all lights
+	static Model* VolumeModel(int lod = LightVolumeLODCount - 1);
+	// Radius the proxy is drawn at so that its faces enclose the unit sphere
+	static float VolumeScale(int lod);
+	// Proxy for a light covering the given radius on screen
+	static int VolumeLOD(float projectedRadiusPixels);
+
+	// Some orbit, some flicker, a few cycle through the colors
+	static LightAnimation RandomAnimation();
 };
 
@@ -0,0 +1,373 @@
+///////////////////////////////////////////////////////////////////////
+// A recorded list of rendering commands.  See commandlist.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <cstring>
+#include <fstream>
+#include <stdio.h>
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+
+#include "commandlist.h"
+#include "models.h"
+
+// "CMDL" followed by a format version
+static const unsigned int CaptureMagic = 0x4C444D43;
+static const unsigned int CaptureVersion = 1;
+
+// Bounds on what a capture may hold, so a corrupt count can't allocate
+// gigabytes before the read fails
+static const unsigned int MaxCapturedCommands = 1 << 20;
+static const unsigned int MaxCapturedFloats = 16 << 20;
+static const unsigned int MaxCapturedNames = 1 << 12;
+static const unsigned int MaxCapturedNameLength = 256;
+static const unsigned int MaxCapturedModels = 1 << 16;
+
+void CommandList::Clear()
+{
+	commands.clear();
+	floatData.clear();
+	names.clear();
+	models.clear();
+	capturedModels.clear();
+}
+
+int CommandList::NameIndex(const char* name)
+{
+	// Lists are short-lived and use a handful of names, a linear search is fine
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		if (names[i] == name)
+			return i;
+	}
+	names.push_back(name);
+	return static_cast<int>(names.size()) - 1;
+}
+
+int CommandList::ModelIndex(Model* model)
+{
+	for (unsigned int i = 0; i < models.size(); ++i) {
+		if (models[i] == model)
+			return i;
+	}
+	models.push_back(model);
+	return static_cast<int>(models.size()) - 1;
+}
+
+void CommandList::Push(int type, int arg0, int arg1, int arg2, const float* data, unsigned int floatCount)
+{
+	Command command;
+	command.type = type;
+	command.arg0 = arg0;
+	command.arg1 = arg1;
+	command.arg2 = arg2;
+	command.payload = static_cast<unsigned int>(floatData.size());
+	floatData.insert(floatData.end(), data, data + floatCount);
+	commands.push_back(command);
+}
+
+void CommandList::UseProgram(int program)
+{
+	Push(CMD_USE_PROGRAM, program, 0, 0, NULL, 0);
+}
+
+void CommandList::Uniform1i(const char* name, int value)
+{
+	Push(CMD_UNIFORM_1I, NameIndex(name), value, 0, NULL, 0);
+}
+
+void CommandList::Uniform1f(const char* name, float value)
+{
+	Push(CMD_UNIFORM_1F, NameIndex(name), 0, 0, &value, 1);
+}
+
+void CommandList::Uniform2f(const char* name, const vec2& value)
+{
+	Push(CMD_UNIFORM_2F, NameIndex(name), 0, 0, &value[0], 2);
+}
+
+void CommandList::Uniform3f(const char* name, const vec3& value)
+{
+	Push(CMD_UNIFORM_3F, NameIndex(name), 0, 0, &value[0], 3);
+}
+
+void CommandList::UniformMatrix4(const char* name, const MAT4& value, bool transpose)
+{
+	Push(CMD_UNIFORM_MAT4, NameIndex(name), transpose ? 1 : 0, 0, &value.M[0][0], 16);
+}
+
+void CommandList::BindTexture(int unit, unsigned int target, unsigned int textureId)
+{
+	Push(CMD_BIND_TEXTURE, unit, static_cast<int>(target), static_cast<int>(textureId), NULL, 0);
+}
+
+void CommandList::DrawModel(Model* model)
+{
+	Push(CMD_DRAW_MODEL, ModelIndex(model), 0, 0, NULL, 0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Capture format: header, commands, float payload, uniform names and,
+// for every referenced model, its type and primitive count (the model
+// pointers themselves are meaningless outside this process).
+template <typename T>
+static void Write(std::ostream& out, const T& value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static bool Read(std::istream& in, T& value)
+{
+	in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return !in.fail();
+}
+
+void CommandList::Serialize(std::ostream& out) const
+{
+	Write(out, CaptureMagic);
+	Write(out, CaptureVersion);
+
+	Write(out, static_cast<unsigned int>(commands.size()));
+	if (!commands.empty())
+		out.write(reinterpret_cast<const char*>(&commands[0]), commands.size() * sizeof(Command));
+
+	Write(out, static_cast<unsigned int>(floatData.size()));
+	if (!floatData.empty())
+		out.write(reinterpret_cast<const char*>(&floatData[0]), floatData.size() * sizeof(float));
+
+	Write(out, static_cast<unsigned int>(names.size()));
+	for (unsigned int i = 0; i < names.size(); ++i) {
+		Write(out, static_cast<unsigned int>(names[i].size()));
+		out.write(names[i].c_str(), names[i].size());
+	}
+
+	Write(out, static_cast<unsigned int>(models.size()));
+	for (unsigned int i = 0; i < models.size(); ++i) {
+		Write(out, static_cast<int>(models[i]->type));
+		Write(out, models[i]->count);
+	}
+}
+
+// Floats of payload a command reads
+static unsigned int PayloadSize(int type)
+{
+	switch (type) {
+	case CMD_UNIFORM_1F: return 1;
+	case CMD_UNIFORM_2F: return 2;
+	case CMD_UNIFORM_3F: return 3;
+	case CMD_UNIFORM_MAT4: return 16;
+	default: return 0;
+	}
+}
+
+// Whether a command's indices fall within the list it belongs to
+static bool IsValid(const CommandList& list, const CommandList::Command& command)
+{
+	if (command.type < 0 || command.type >= CMD_TYPE_COUNT)
+		return false;
+	if (command.type >= CMD_UNIFORM_1I && command.type <= CMD_UNIFORM_MAT4
+		&& (command.arg0 < 0 || command.arg0 >= static_cast<int>(list.names.size())))
+		return false;
+	if (command.type == CMD_DRAW_MODEL
+		&& (command.arg0 < 0 || command.arg0 >= static_cast<int>(list.models.size())))
+		return false;
+	unsigned int floats = PayloadSize(command.type);
+	return floats == 0 || (command.payload <= list.floatData.size()
+		&& floats <= list.floatData.size() - command.payload);
+}
+
+// Reads a capture into an empty list; false on any short read, a count
+// out of bounds or a command indexing past what was read with it
+static bool ReadCapture(std::istream& in, CommandList& list)
+{
+	unsigned int magic, version, count;
+	if (!Read(in, magic) || magic != CaptureMagic)
+		return false;
+	if (!Read(in, version) || version != CaptureVersion)
+		return false;
+
+	if (!Read(in, count) || count > MaxCapturedCommands)
+		return false;
+	list.commands.resize(count);
+	if (count && !in.read(reinterpret_cast<char*>(&list.commands[0]), count * sizeof(CommandList::Command)))
+		return false;
+
+	if (!Read(in, count) || count > MaxCapturedFloats)
+		return false;
+	list.floatData.resize(count);
+	if (count && !in.read(reinterpret_cast<char*>(&list.floatData[0]), count * sizeof(float)))
+		return false;
+
+	if (!Read(in, count) || count > MaxCapturedNames)
+		return false;
+	list.names.resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int length;
+		if (!Read(in, length) || length > MaxCapturedNameLength)
+			return false;
+		list.names[i].resize(length);
+		if (length && !in.read(&list.names[i][0], length))
+			return false;
+	}
+
+	// Captured models can't be drawn; only their type and size are kept
+	if (!Read(in, count) || count > MaxCapturedModels)
+		return false;
+	list.models.assign(count, NULL);
+	list.capturedModels.resize(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		CommandList::CapturedModel& model = list.capturedModels[i];
+		if (!Read(in, model.type) || !Read(in, model.primitiveCount))
+			return false;
+	}
+
+	for (unsigned int i = 0; i < list.commands.size(); ++i) {
+		if (!IsValid(list, list.commands[i])) {
+			fprintf(stderr, "Command %u of the capture is out of range\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A truncated or corrupt capture leaves the list empty
+bool CommandList::Deserialize(std::istream& in)
+{
+	Clear();
+	if (!ReadCapture(in, *this)) {
+		Clear();
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Prints a list read from a capture, a command per line
+void CommandList::Dump(std::ostream& out) const
+{
+	static const char* modelTypes[] = { "sphere", "teapot", "ground", "ply" };
+	for (unsigned int i = 0; i < commands.size(); ++i) {
+		const Command& command = commands[i];
+		const float* data = floatData.empty() ? NULL : &floatData[0] + command.payload;
+		out << "  ";
+		switch (command.type) {
+		case CMD_USE_PROGRAM:
+			out << "UseProgram " << command.arg0;
+			break;
+		case CMD_UNIFORM_1I:
+			out << "Uniform1i " << names[command.arg0] << " " << command.arg1;
+			break;
+		case CMD_UNIFORM_1F:
+		case CMD_UNIFORM_2F:
+		case CMD_UNIFORM_3F:
+		case CMD_UNIFORM_MAT4: {
+			unsigned int floats = PayloadSize(command.type);
+			out << (floats == 16 ? "UniformMatrix4 " : "Uniform" + std::to_string(floats) + "f ") << names[command.arg0];
+			for (unsigned int k = 0; k < floats; ++k)
+				out << " " << data[k];
+			break;
+		}
+		case CMD_BIND_TEXTURE:
+			out << "BindTexture unit " << command.arg0 << " target 0x" << std::hex << command.arg1 << std::dec
+				<< " texture " << command.arg2;
+			break;
+		case CMD_DRAW_MODEL: {
+			const CapturedModel& model = capturedModels[command.arg0];
+			bool known = model.type >= SPHERE && model.type <= PLY;
+			out << "DrawModel " << command.arg0 << " (" << (known ? modelTypes[model.type] : "unknown")
+				<< ", " << model.primitiveCount << " primitives)";
+			break;
+		}
+		}
+		out << "\n";
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Reads every list of a capture file in turn and prints it.  Program
+// and texture names are the capturing process's and are printed as is.
+int DumpCapture(const char* fileName)
+{
+	std::ifstream in(fileName, std::ios_base::binary);
+	if (!in) {
+		fprintf(stderr, "Can't open %s\n", fileName);
+		return 1;
+	}
+
+	CommandList list;
+	int listCount = 0;
+	size_t commandCount = 0;
+	while (in.peek() != std::char_traits<char>::eof()) {
+		if (!list.Deserialize(in)) {
+			fprintf(stderr, "%s: list %d is truncated or corrupt\n", fileName, listCount);
+			return 1;
+		}
+		std::cout << "List " << listCount << ": " << list.Size() << " commands\n";
+		list.Dump(std::cout);
+		++listCount;
+		commandCount += list.Size();
+	}
+	std::cout << fileName << ": " << listCount << " lists, " << commandCount << " commands" << std::endl;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Replay on the GL thread.  Uniform locations are looked up once per
+// name and program instead of once per command.
+void ReplayGL(const CommandList& list)
+{
+	int program;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+
+	std::vector<int> locations(list.names.size(), -2);
+
+	for (unsigned int i = 0; i < list.commands.size(); ++i) {
+		const CommandList::Command& command = list.commands[i];
+		const float* data = list.floatData.empty() ? NULL : &list.floatData[0] + command.payload;
+
+		int loc = -1;
+		if (command.type >= CMD_UNIFORM_1I && command.type <= CMD_UNIFORM_MAT4) {
+			int& cached = locations[command.arg0];
+			if (cached == -2)
+				cached = glGetUniformLocation(program, list.names[command.arg0].c_str());
+			loc = cached;
+		}
+
+		switch (command.type) {
+		case CMD_USE_PROGRAM:
+			if (command.arg0 != program) {
+				program = command.arg0;
+				glUseProgram(program);
+				locations.assign(locations.size(), -2);
+			}
+			break;
+		case CMD_UNIFORM_1I:
+			glUniform1i(loc, command.arg1);
+			break;
+		case CMD_UNIFORM_1F:
+			glUniform1f(loc, data[0]);
+			break;
+		case CMD_UNIFORM_2F:
+			glUniform2fv(loc, 1, data);
+			break;
+		case CMD_UNIFORM_3F:
+			glUniform3fv(loc, 1, data);
+			break;
+		case CMD_UNIFORM_MAT4:
+			glUniformMatrix4fv(loc, 1, command.arg1 ? GL_TRUE : GL_FALSE, data);
+			break;
+		case CMD_BIND_TEXTURE:
+			glActiveTexture(GL_TEXTURE0 + command.arg0);
+			glBindTexture(command.arg1, command.arg2);
+			break;
+		case CMD_DRAW_MODEL:
+			if (list.models[command.arg0])
+				list.models[command.arg0]->DrawVAO();
+			break;
+		default:
+			fprintf(stderr, "Unknown command %d in command list\n", command.type);
+			break;
+		}
+	}
+}
@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////
+// A recorded list of rendering commands.  Recording is plain CPU work
+// (no OpenGL calls), so any worker thread can fill its own list; the
+// thread that owns the GL context then replays the lists in order
+// with ReplayGL.  Uniforms are recorded by name and resolved to
+// locations at replay time.
+//
+// Only the per-object draws are recorded (see RecordEntityDraws); pass
+// setup (targets, clears, per-pass uniforms) and the ground and sun
+// draws are issued directly on the GL thread.
+//
+// A list can be written to / read from a binary stream so the recorded
+// draws of a frame can be captured and inspected offline with
+// -dumpcapture.  Program and texture names and models belong to the
+// process that recorded them, so a list read back is printed, never
+// replayed.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _COMMANDLIST_
+#define _COMMANDLIST_
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "transform.h"
+
+class Model;
+
+enum CommandType {
+	CMD_USE_PROGRAM,
+	CMD_UNIFORM_1I,
+	CMD_UNIFORM_1F,
+	CMD_UNIFORM_2F,
+	CMD_UNIFORM_3F,
+	CMD_UNIFORM_MAT4,
+	CMD_BIND_TEXTURE,
+	CMD_DRAW_MODEL,
+	CMD_TYPE_COUNT
+};
+
+class CommandList
+{
+public:
+	// What a capture keeps of a model
+	struct CapturedModel {
+		int type;                    // ObjectType
+		unsigned int primitiveCount;
+	};
+
+	struct Command {
+		int type;     // CommandType
+		int arg0;     // program, uniform name index, texture unit or model index
+		int arg1;     // int value, transpose flag or texture target
+		int arg2;     // texture id
+		unsigned int payload; // offset into floatData
+	};
+
+	CommandList() {}
+
+	void Clear();
+	bool Empty() const { return commands.empty(); }
+	size_t Size() const { return commands.size(); }
+
+	// Recording
+	void UseProgram(int program);
+	void Uniform1i(const char* name, int value);
+	void Uniform1f(const char* name, float value);
+	void Uniform2f(const char* name, const vec2& value);
+	void Uniform3f(const char* name, const vec3& value);
+	void UniformMatrix4(const char* name, const MAT4& value, bool transpose);
+	void BindTexture(int unit, unsigned int target, unsigned int textureId);
+	void DrawModel(Model* model);
+
+	// Capture.  Deserialize checks that every command indexes within the
+	// list, so the lists it returns are as safe to walk as recorded ones.
+	void Serialize(std::ostream& out) const;
+	bool Deserialize(std::istream& in);
+	void Dump(std::ostream& out) const;
+
+	std::vector<Command> commands;
+	std::vector<float> floatData;
+	std::vector<std::string> names;
+	std::vector<Model*> models;
+	std::vector<CapturedModel> capturedModels; // filled by Deserialize only
+
+private:
+	int NameIndex(const char* name);
+	int ModelIndex(Model* model);
+	void Push(int type, int arg0, int arg1, int arg2, const float* data, unsigned int floatCount);
+};
+
+// Executes the recorded commands on the calling (GL) thread.
+void ReplayGL(const CommandList& list);
+
+// Prints every list in a capture file; the exit code for -dumpcapture
+int DumpCapture(const char* fileName);
+
+#endif
@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////
+// GPU time driven render scale.  See dynamicresolution.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+#include "dynamicresolution.h"
+
+// Aim a little under the budget so small spikes don't go over
+static const float BudgetHeadroom = 0.9f;
+// Fraction of the way towards the ideal scale taken per step
+static const float StepFraction = 0.5f;
+// Changes smaller than this aren't worth the image shifting
+static const float ScaleDeadZone = 0.02f;
+// GPU timers report a few frames late
+static const int SettleMeasurements = 4;
+
+DynamicResolution::DynamicResolution()
+	: enabled(false), budgetMs(8.0f), minScale(0.5f), maxScale(1.0f),
+	  scale(1.0f), lastGpuMs(0.0f), changeCount(0), settleFrames(0)
+{
+	history[0] = '\0';
+}
+
+bool DynamicResolution::Update(float gpuMs)
+{
+	lastGpuMs = gpuMs;
+
+	minScale = std::max(0.1f, std::min(minScale, 1.0f));
+	maxScale = std::max(minScale, std::min(maxScale, 1.0f));
+
+	float target = 1.0f;
+	if (enabled) {
+		if (settleFrames > 0) {
+			--settleFrames;
+			return false;
+		}
+		if (gpuMs <= 0.0f)
+			return false;
+
+		float ideal = scale * sqrt(BudgetHeadroom * budgetMs / gpuMs);
+		target = scale + StepFraction * (ideal - scale);
+		target = std::max(minScale, std::min(target, maxScale));
+
+		// Small corrections are skipped, except to settle exactly on a bound
+		bool atBound = target == minScale || target == maxScale;
+		if (fabs(target - scale) < ScaleDeadZone && !atBound)
+			return false;
+	}
+
+	if (target == scale)
+		return false;
+
+	scale = target;
+	settleFrames = SettleMeasurements;
+	RecordHistory();
+	return true;
+}
+
+int DynamicResolution::ScaledWidth(int width) const
+{
+	return std::max(1, static_cast<int>(width * scale + 0.5f));
+}
+
+int DynamicResolution::ScaledHeight(int height) const
+{
+	return std::max(1, static_cast<int>(height * scale + 0.5f));
+}
+
+void DynamicResolution::RecordHistory()
+{
+	// Shift the older entries down, newest goes first
+	for (int i = HistorySize - 1; i > 0; --i)
+		changes[i] = changes[i - 1];
+	changes[0] = scale;
+	changeCount = std::min(changeCount + 1, HistorySize);
+
+	int length = 0;
+	history[0] = '\0';
+	for (int i = 0; i < changeCount && length < static_cast<int>(sizeof(history)) - 5; ++i)
+		length += snprintf(history + length, sizeof(history) - length, "%d ",
+			static_cast<int>(changes[i] * 100.0f + 0.5f));
+}
@@ -0,0 +1,49 @@
+///////////////////////////////////////////////////////////////////////
+// Dynamic resolution.  The screen-sized passes render into the lower
+// left part of their (window sized) targets and the result is
+// upscaled to the window at the end of the frame.  This controller
+// picks that part: it reads the GPU time of the scene passes and
+// moves the scale between minScale and maxScale so the frame stays
+// inside the budget.
+//
+// Pixel cost goes with the area, i.e. scale squared, so the scale
+// that would hit the budget is scale*sqrt(budget/time).  The
+// controller moves part of the way there and then waits for a few
+// measurements taken at the new size before deciding again.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _DYNAMICRESOLUTION_
+#define _DYNAMICRESOLUTION_
+
+class DynamicResolution
+{
+public:
+	DynamicResolution();
+
+	// Feeds one GPU time measurement (ms), returns true when the scale changed
+	bool Update(float gpuMs);
+
+	// Render size for a given output size
+	int ScaledWidth(int width) const;
+	int ScaledHeight(int height) const;
+
+	// Settings
+	bool enabled;
+	float budgetMs;
+	float minScale, maxScale;
+
+	// State shown in the tweak bar
+	float scale;
+	float lastGpuMs;
+	char history[128];    // most recent scale changes (percent), newest first
+
+private:
+	void RecordHistory();
+
+	static const int HistorySize = 16;
+	float changes[HistorySize];
+	int changeCount;
+	int settleFrames;     // measurements to skip after a change
+};
+
+#endif
@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////
+// Structure-of-arrays storage for the scene's drawable objects.  See
+// entities.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+
+#include "entities.h"
+#include "models.h"
+#include "threadpool.h"
+
+Frustum Frustum::FromMatrix(const MAT4& M)
+{
+	// Rows of the (row-major) view-projection matrix combine into the
+	// clip planes: w+x, w-x, w+y, w-y, w+z, w-z
+	Frustum frustum;
+	for (int i = 0; i < 3; ++i) {
+		for (int side = 0; side < 2; ++side) {
+			float sign = side == 0 ? 1.0f : -1.0f;
+			vec4 plane(M[3][0] + sign*M[i][0], M[3][1] + sign*M[i][1],
+				M[3][2] + sign*M[i][2], M[3][3] + sign*M[i][3]);
+			float length = glm::length(vec3(plane));
+			frustum.planes[2*i + side] = plane / length;
+		}
+	}
+	return frustum;
+}
+
+bool Frustum::Intersects(const vec4& sphere) const
+{
+	for (int i = 0; i < 6; ++i) {
+		if (glm::dot(vec3(planes[i]), vec3(sphere)) + planes[i].w < -sphere.w)
+			return false;
+	}
+	return true;
+}
+
+MeshHandle EntityStore::AddMesh(Model* mesh)
+{
+	meshTable.push_back(mesh);
+	return static_cast<MeshHandle>(meshTable.size()) - 1;
+}
+
+unsigned int EntityStore::Add(const MAT4& local, MeshHandle mesh, const vec3& diffuse,
+	const vec3& specular, float shine, unsigned int entityFlags)
+{
+	localTransforms.push_back(local);
+	worldTransforms.push_back(local);
+	normalTransforms.push_back(MAT4());
+	bounds.push_back(vec4(0.0f));
+	meshes.push_back(mesh);
+	diffuseColors.push_back(diffuse);
+	specularColors.push_back(specular);
+	shininess.push_back(shine);
+	flags.push_back(entityFlags);
+	return Count() - 1;
+}
+
+void EntityStore::Clear()
+{
+	localTransforms.clear();
+	worldTransforms.clear();
+	normalTransforms.clear();
+	bounds.clear();
+	meshes.clear();
+	diffuseColors.clear();
+	specularColors.clear();
+	shininess.clear();
+	flags.clear();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Transform system: world and normal matrices plus a bounding sphere
+// from the mesh's box, scaled by the largest axis of the world matrix.
+void UpdateEntityTransforms(EntityStore& store, const MAT4& animation, ThreadPool& pool)
+{
+	int count = static_cast<int>(store.Count());
+	int batchCount = (count + EntityBatchSize - 1) / EntityBatchSize;
+
+	pool.ParallelFor(batchCount, [&](int batch) {
+		int end = std::min(count, static_cast<int>((batch + 1) * EntityBatchSize));
+		for (int i = batch * EntityBatchSize; i < end; ++i) {
+			MAT4& world = store.worldTransforms[i];
+			if (store.flags[i] & ENTITY_ANIMATED)
+				world = animation * store.localTransforms[i];
+			else
+				world = store.localTransforms[i];
+			store.normalTransforms[i] = world.inverse();
+
+			const Model* mesh = store.meshTable[store.meshes[i]];
+			vec3 center = mesh->center;
+			float radius = glm::length(mesh->maxP - mesh->minP) * 0.5f;
+
+			float scale = 0.0f;
+			for (int c = 0; c < 3; ++c)
+				scale = std::max(scale, glm::length(vec3(world[0][c], world[1][c], world[2][c])));
+
+			vec4 worldCenter;
+			for (int r = 0; r < 4; ++r)
+				worldCenter[r] = world[r][0]*center.x + world[r][1]*center.y + world[r][2]*center.z + world[r][3];
+			store.bounds[i] = vec4(vec3(worldCenter), radius * scale);
+		}
+	});
+}
+
+////////////////////////////////////////////////////////////////////////
+// Draw system: one command list per batch, each recorded on a worker.
+int RecordEntityDraws(const EntityStore& store, unsigned int flagMask, const Frustum* frustum,
+	ThreadPool& pool, std::vector<CommandList>& lists)
+{
+	int count = static_cast<int>(store.Count());
+	int batchCount = (count + EntityBatchSize - 1) / EntityBatchSize;
+	if (lists.size() < static_cast<unsigned int>(batchCount))
+		lists.resize(batchCount);
+
+	unsigned int required = flagMask | ENTITY_VISIBLE;
+
+	pool.ParallelFor(batchCount, [&](int batch) {
+		CommandList& list = lists[batch];
+		list.Clear();
+
+		int end = std::min(count, static_cast<int>((batch + 1) * EntityBatchSize));
+		for (int i = batch * EntityBatchSize; i < end; ++i) {
+			if ((store.flags[i] & required) != required)
+				continue;
+			if (frustum && !frustum->Intersects(store.bounds[i]))
+				continue;
+
+			list.UniformMatrix4("ModelMatrix", store.worldTransforms[i], true);
+			list.UniformMatrix4("NormalMatrix", store.normalTransforms[i], false);
+			list.Uniform3f("diffuse", store.diffuseColors[i]);
+			list.Uniform3f("specular", store.specularColors[i]);
+			list.Uniform1f("shininess", store.shininess[i]);
+			list.Uniform1i("isTextured", (store.flags[i] & ENTITY_TEXTURED) != 0);
+			list.DrawModel(store.meshTable[store.meshes[i]]);
+		}
+	});
+
+	return batchCount;
+}
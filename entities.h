@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////
+// Structure-of-arrays storage for the scene's drawable objects.  Each
+// property lives in its own densely packed array indexed by entity,
+// so the systems below touch only the columns they need and walk
+// them linearly.
+//
+// Systems:
+//   UpdateEntityTransforms  local -> world/normal matrices and bounds
+//   RecordEntityDraws       culls against a frustum and records the
+//                           draws into command lists (in parallel)
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _ENTITIES_
+#define _ENTITIES_
+
+#include <vector>
+
+#include "transform.h"
+#include "commandlist.h"
+
+class Model;
+class ThreadPool;
+
+typedef unsigned int MeshHandle;
+
+enum EntityFlags {
+	ENTITY_VISIBLE     = 1 << 0,
+	ENTITY_TEXTURED    = 1 << 1,
+	ENTITY_ANIMATED    = 1 << 2, // world = animation transform * local
+	ENTITY_ENVIRONMENT = 1 << 3, // the ring of colored spheres
+	ENTITY_CENTRAL     = 1 << 4  // the model in the middle of the scene
+};
+
+// Six normalized planes (xyz = normal, w = distance), inside is positive
+struct Frustum {
+	vec4 planes[6];
+
+	static Frustum FromMatrix(const MAT4& viewProjection);
+	bool Intersects(const vec4& sphere) const;
+};
+
+class EntityStore
+{
+public:
+	MeshHandle AddMesh(Model* mesh);
+	void SetMesh(MeshHandle handle, Model* mesh) { meshTable[handle] = mesh; }
+
+	unsigned int Add(const MAT4& local, MeshHandle mesh, const vec3& diffuse,
+		const vec3& specular, float shininess, unsigned int flags);
+	void Clear();
+	unsigned int Count() const { return static_cast<unsigned int>(meshes.size()); }
+
+	// Columns
+	std::vector<MAT4> localTransforms;
+	std::vector<MAT4> worldTransforms;
+	std::vector<MAT4> normalTransforms; // inverse of world, sent untransposed as NormalMatrix
+	std::vector<vec4> bounds;           // world-space center and radius
+	std::vector<MeshHandle> meshes;
+	std::vector<vec3> diffuseColors;
+	std::vector<vec3> specularColors;
+	std::vector<float> shininess;
+	std::vector<unsigned int> flags;
+
+	std::vector<Model*> meshTable;
+};
+
+// Entities per worker batch / command list
+const unsigned int EntityBatchSize = 256;
+
+void UpdateEntityTransforms(EntityStore& store, const MAT4& animation, ThreadPool& pool);
+
+// Records every visible entity having all the bits of flagMask, one
+// command list per batch.  frustum may be NULL to skip culling.
+// Returns the number of lists filled.
+int RecordEntityDraws(const EntityStore& store, unsigned int flagMask, const Frustum* frustum,
+	ThreadPool& pool, std::vector<CommandList>& lists);
+
+#endif
@@ -17,315 +17,106 @@
 
 #include "fbo.h"
 
-//#define EXTERNALMODE
+#define CHECKERROR {int err = glGetError(); if (err) { fprintf(stderr, "OpenGL error in %s at line %d: %s\n", __FILE__, __LINE__, gluErrorString(err)); exit(-1);} }
 
-#define CHECKERROR {int err = glGetError(); if (err) { fprintf(stderr, "OpenGL error in scene.cpp at line %d: %s\n", __LINE__, gluErrorString(err)); exit(-1);} }
-
-void FBO::PushColorAttachment(GLuint attachmentNo)
+FBO::FBO()
+	: fbo(0), texture(0), width(0), height(0), gNormal(0), gDifSpec(0),
+	  gSpecular(0), depth(0), target(NULL), layout(LAYOUT_COLOR)
 {
-	attachments.push_back(GL_COLOR_ATTACHMENT0 + attachmentNo);
 }
 
-void FBO::CreateColorAttachment(GLuint texture, const int width, const int height, GLuint textureImageInternalFormat, GLuint textureImageFormat, GLuint attachmentPlace) {
-	// 1-) Position
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, textureImageInternalFormat, width, height, 0, textureImageFormat, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0+attachmentPlace, GL_TEXTURE_2D, texture, 0);
-
-	PushColorAttachment(attachmentPlace);
+void FBO::Request(const RenderTargetDesc& request, int requestLayout)
+{
+	desc = request;
+	layout = static_cast<Layout>(requestLayout);
+	Validate();
 }
 
-void FBO::CreateFBOForDeferredShading(const int w, const int h)
+void FBO::Resize(const int w, const int h)
 {
-	//We need 3 color buffers to store data needed
-
-#ifdef EXTERNALMODE
-	//First => generate FBO itself
-	glGenFramebuffersEXT(1, &fbo);
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-	CHECKERROR
-		// Depth buffer => taken from CreateFBO()
-		// Create a render buffer, and attach it to FBO's depth attachment
-	/*	unsigned int depthBuffer;
-	glGenRenderbuffersEXT(1, &depthBuffer);
-	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
-	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT,
-		w, h);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
-		GL_RENDERBUFFER_EXT, depthBuffer);*/
-
-	glGenTexturesEXT(1, &gPosition);
-	glBindTextureEXT(GL_TEXTURE_2D, gPosition);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, gPosition, 0);
-
-	glGenTexturesEXT(1, &gNormal);
-	glBindTextureEXT(GL_TEXTURE_2D, gNormal);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT1_EXT, GL_TEXTURE_2D, gNormal, 0);
-
-	glGenTexturesEXT(1, &gDifSpec);
-	glBindTextureEXT(GL_TEXTURE_2D, gDifSpec);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT2_EXT, GL_TEXTURE_2D, gDifSpec, 0);
-
-	glGenTexturesEXT(1, &gSpecular);
-	glBindTextureEXT(GL_TEXTURE_2D, gSpecular);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT3_EXT, GL_TEXTURE_2D, gSpecular, 0);
-
-	GLuint attachment2[4] = {
-		GL_COLOR_ATTACHMENT0_EXT,
-		GL_COLOR_ATTACHMENT1_EXT,
-		GL_COLOR_ATTACHMENT2_EXT,
-		GL_COLOR_ATTACHMENT3_EXT
-	};
-
-	glDrawBuffers(4, attachment2);
-
-	if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
-		printf("HATA");
-	}
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-#else
-	//First => generate FBO itself
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	CHECKERROR
-
-	// POSITION
-	glGenTextures(1, &gPosition);
-	glBindTexture(GL_TEXTURE_2D, gPosition);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPosition, 0);
-
-	// NORMAL
-	glGenTextures(1, &gNormal);
-	glBindTexture(GL_TEXTURE_2D, gNormal);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
-
-	// DIFFUSE
-	glGenTextures(1, &gDifSpec);
-	glBindTexture(GL_TEXTURE_2D, gDifSpec);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gDifSpec, 0);
-
-	// SPECULAR
-	glGenTextures(1, &gSpecular);
-	glBindTexture(GL_TEXTURE_2D, gSpecular);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, gSpecular, 0);
-
-	GLuint attachment2[4] = {
-		GL_COLOR_ATTACHMENT0,
-		GL_COLOR_ATTACHMENT1,
-		GL_COLOR_ATTACHMENT2,
-		GL_COLOR_ATTACHMENT3
-	};
-
-	glDrawBuffers(4, attachment2);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		printf("HATA");
-	}
+	desc.width = w;
+	desc.height = h;
+}
 
-	// Depth buffer => taken from CreateFBO()
-	// Create a render buffer, and attach it to FBO's depth attachment
-	unsigned int depthBuffer;
-	glGenRenderbuffers(1, &depthBuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT,
-		w, h);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-		GL_RENDERBUFFER, depthBuffer);
+void FBO::Validate()
+{
+	if (target && target->desc == desc)
+		return;
+
+	// The old target goes back to the pool (a later resize back to its
+	// size picks it up again)
+	TargetPool().Release(target);
+	target = TargetPool().Acquire(desc);
+
+	fbo = target->fbo;
+	width = desc.width;
+	height = desc.height;
+
+	// Every layout names its attachments differently
+	texture = layout == LAYOUT_COLOR ? target->colors[0] : 0;
+	gNormal = layout == LAYOUT_DEFERRED || layout == LAYOUT_SSAO ? target->colors[0] : 0;
+	gDifSpec = layout == LAYOUT_DEFERRED ? target->colors[1] : 0;
+	gSpecular = layout == LAYOUT_DEFERRED ? target->colors[2] : 0;
+	depth = target->depth;
 	CHECKERROR;
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-#endif
+void FBO::CreateFBOForDeferredShading(const int w, const int h)
+{
+	// 16 bytes a pixel (see shaders/gBufferPacking.glsl): octahedral
+	// normal, diffuse + shininess, specular, and the depth texture the
+	// lighting passes rebuild positions from
+	RenderTargetDesc request;
+	request.width = w;
+	request.height = h;
+	request.colorCount = 3;
+	request.colorFormats[0] = GL_RG16;
+	request.colorFormats[1] = GL_RGBA8;
+	request.colorFormats[2] = GL_RGB10_A2;
+	request.filter = GL_NEAREST;
+	request.depthFormat = GL_DEPTH_COMPONENT32F;
+	request.depthTexture = true;
+	Request(request, LAYOUT_DEFERRED);
 }
 
 void FBO::CreateFBOForSSAO(const int w, const int h)
 {
-	// This function is pretty much the same as deferred except that we are using 4 float values in position
-	// 4th value is the linearized depth
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	CHECKERROR
-
-	// POSITION DEPTH
-	glGenTextures(1, &gPositionDepth);
-	glBindTexture(GL_TEXTURE_2D, gPositionDepth);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPositionDepth, 0);
-
-	GLenum DrawBuffers[] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(sizeof(DrawBuffers) / sizeof(DrawBuffers[0]), DrawBuffers);
-
-	glGenTextures(1, &depth);
-
-	glBindTexture(GL_TEXTURE_2D, depth);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		printf("HATA");
-	}
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	// NORMAL
-	/*glGenTextures(1, &gNormal);
-	glBindTexture(GL_TEXTURE_2D, gNormal);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
-
-	// DIFFUSE
-	glGenTextures(1, &gDifSpec);
-	glBindTexture(GL_TEXTURE_2D, gDifSpec);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gDifSpec, 0);
-
-	// SPECULAR
-	glGenTextures(1, &gSpecular);
-	glBindTexture(GL_TEXTURE_2D, gSpecular);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, gSpecular, 0);
-
-	GLuint attachment2[4] = {
-		GL_COLOR_ATTACHMENT0,
-		GL_COLOR_ATTACHMENT1,
-		GL_COLOR_ATTACHMENT2,
-		GL_COLOR_ATTACHMENT3
-	};
-
-	glDrawBuffers(4, attachment2);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		printf("HATA");
-	}
-
-	// Depth buffer => taken from CreateFBO()
-	// Create a render buffer, and attach it to FBO's depth attachment
-	unsigned int depthBuffer;
-	glGenRenderbuffers(1, &depthBuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT,
-		w, h);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-		GL_RENDERBUFFER, depthBuffer);
-	CHECKERROR;
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);*/
-
+	// View space normal and the depth texture the SSAO passes rebuild
+	// positions from (shaders/ssaoDepth.glsl)
+	RenderTargetDesc request;
+	request.width = w;
+	request.height = h;
+	request.colorCount = 1;
+	request.colorFormats[0] = GL_RGB16F;
+	request.filter = GL_LINEAR;
+	request.depthFormat = GL_DEPTH_COMPONENT32F;
+	request.depthTexture = true;
+	Request(request, LAYOUT_SSAO);
 }
 
 void FBO::CreateFBOForSSAOColorBuffer(const int w, const int h)
 {
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
-
-	GLenum DrawBuffers[] = { GL_COLOR_ATTACHMENT0 };
-	glDrawBuffers(sizeof(DrawBuffers) / sizeof(DrawBuffers[0]), DrawBuffers);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	RenderTargetDesc request;
+	request.width = w;
+	request.height = h;
+	request.colorCount = 1;
+	request.colorFormats[0] = GL_R32F;
+	request.filter = GL_LINEAR;
+	Request(request, LAYOUT_COLOR);
 }
 
-void FBO::CreateFBO(const int w, const int h, unsigned int internalFormat, unsigned int format)
+void FBO::CreateFBO(const int w, const int h, unsigned int internalFormat)
 {
-    width = w;
-    height = h;
-	//Frame buffer = what we're rendering to (render target) - E
-    glGenFramebuffersEXT(1, &fbo);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
-
-    // Create a render buffer, and attach it to FBO's depth attachment
-    unsigned int depthBuffer;
-    glGenRenderbuffersEXT(1, &depthBuffer);
-    glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, depthBuffer);
-    glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT,
-                             width, height);
-    glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT,
-                                 GL_RENDERBUFFER_EXT, depthBuffer);
-
-    // Create texture and attach FBO's color 0 attachment
-    glGenTextures(1, &texture);
-
-	// we're binding the newly created texture, all texture related functions will modify this -E
-    glBindTexture(GL_TEXTURE_2D, texture);
-	// This is an empty image, the last parameter is NULL (0) -E
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height,
-                 0, format, GL_FLOAT, NULL);
-
-	// Those three are probably texture related properties - don't think I need to change these -E
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	// Poor filtering (according to the internet guide) -E
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-	// Sets this->texture as the color attachement (for RGB output) -E
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
-                              GL_COLOR_ATTACHMENT0_EXT,
-                              GL_TEXTURE_2D, texture, 0);
-
-    // Check for completeness/correctness
-    int status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
-    if (status != GL_FRAMEBUFFER_COMPLETE_EXT)
-        printf("FBO Error: %d\n", status);
-
-    // Unbind the fbo.
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	RenderTargetDesc request;
+	request.width = w;
+	request.height = h;
+	request.colorCount = 1;
+	request.colorFormats[0] = internalFormat;
+	request.filter = GL_LINEAR;
+	request.depthFormat = GL_DEPTH_COMPONENT;
+	Request(request, LAYOUT_COLOR);
 }
 
 
-void FBO::Bind() { glBindFramebuffer(GL_FRAMEBUFFER, fbo); }
+void FBO::Bind() { Validate(); glBindFramebuffer(GL_FRAMEBUFFER, fbo); }
 void FBO::Unbind() { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
@@ -8,34 +8,46 @@
 // Copyright 2013 DigiPen Institute of Technology
 ////////////////////////////////////////////////////////////////////////
 
-#include <list>
+#include "rendertargetpool.h"
 
 class FBO {
 public:
+    FBO();
+
     unsigned int fbo; // The framebuffer to hold texture and depth -E
 
     unsigned int texture; // Texture that holds RGB output of the shader -E
     int width, height;  // Size of the texture.
 
-    void CreateFBO(const int w, const int h, unsigned int internalFormat = GL_RGBA32F_ARB, unsigned int format = GL_RGBA);
+    // Each of these describes the attachments it needs and gets them
+    // from the render target pool.
+    void CreateFBO(const int w, const int h, unsigned int internalFormat = GL_RGBA32F_ARB);
 
 	void CreateFBOForDeferredShading(const int w, const int h);
 
 	void CreateFBOForSSAO(const int w, const int h);
 
 	void CreateFBOForSSAOColorBuffer(const int w, const int h);
-    
-	unsigned int gPosition, gNormal, gDifSpec, gSpecular; //used for deferred
 
-	unsigned int gPositionDepth; //used for ssao
+	// Only records the new size, the attachments are swapped for ones
+	// of that size on the next Bind (or Validate)
+	void Resize(const int w, const int h);
+	void Validate();
+    
+	unsigned int gNormal, gDifSpec, gSpecular; //used for deferred, position comes from depth (ssao: gNormal only)
 
 	unsigned int depth;
 
     // Using this will redirect output of shader into texture
     void Bind();
     void Unbind();
-	void CreateColorAttachment(GLuint texture, const int width, const int height, GLuint textureImageInternalFormat, GLuint textureImageFormat, GLuint attachmentPlace);
-	void PushColorAttachment(GLuint attachmentNo);
 private:
-	std::list<GLuint> attachments;
+	void Request(const RenderTargetDesc& request, int requestLayout);
+
+	// Which attachment each named handle refers to
+	enum Layout { LAYOUT_COLOR, LAYOUT_DEFERRED, LAYOUT_SSAO };
+
+	RenderTargetDesc desc;
+	RenderTarget* target;
+	Layout layout;
 };
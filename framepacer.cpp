@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////
+// Render-on-demand and frame pacing.  See framepacer.h.
+////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+    #include <windows.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+#include <GL/freeglut.h>
+
+#include "framepacer.h"
+
+#ifndef _WIN32
+extern "C" void (*glXGetProcAddressARB(const unsigned char* name))(void);
+#endif
+
+// GLUT timers carry only an int, so the (single) pacer is found through this
+static FramePacer* timerOwner = NULL;
+
+static double Now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+FramePacer::FramePacer()
+	: targetFps(60.0f), cpuFrameMs(0.0f), gpuFrameMs(0.0f), cpuIdlePercent(0.0f),
+	  gpuIdlePercent(0.0f), framesDrawn(0), dirty(0), frameReasons(0), vsync(false), timerPending(false),
+	  frameStart(0.0), windowStart(0.0), windowCpuMs(0.0f), windowGpuMs(0.0f)
+{
+	lastReason[0] = '\0';
+	timerOwner = this;
+}
+
+void FramePacer::Initialize()
+{
+	frameTimer.Initialize();
+	windowStart = Now();
+	SetVSync(vsync);
+}
+
+void FramePacer::MarkDirty(unsigned int flags)
+{
+	// GLUT folds multiple requests into one redisplay
+	dirty |= flags;
+	glutPostRedisplay();
+}
+
+void FramePacer::BeginFrame()
+{
+	frameStart = Now();
+	frameTimer.Begin();
+
+	// A redisplay GLUT issued on its own (expose, first frame) has no flags
+	snprintf(lastReason, sizeof(lastReason), "%s%s%s%s%s%s",
+		dirty & DIRTY_CAMERA ? "camera " : "",
+		dirty & DIRTY_LIGHTS ? "lights " : "",
+		dirty & DIRTY_UI ? "ui " : "",
+		dirty & DIRTY_ANIMATION ? "animation " : "",
+		dirty & DIRTY_WINDOW ? "window " : "",
+		dirty == 0 ? "system" : "");
+	frameReasons = dirty;
+	dirty = 0;
+}
+
+void FramePacer::EndFrame()
+{
+	frameTimer.End();
+	frameTimer.Poll();
+
+	double now = Now();
+	cpuFrameMs = static_cast<float>((now - frameStart) * 1000.0);
+	gpuFrameMs = frameTimer.Milliseconds();
+	++framesDrawn;
+
+	windowCpuMs += cpuFrameMs;
+	windowGpuMs += frameTimer.TakeCollectedMilliseconds();
+
+	float windowMs = static_cast<float>((now - windowStart) * 1000.0);
+	if (windowMs >= 1000.0f) {
+		cpuIdlePercent = std::max(0.0f, 100.0f * (1.0f - windowCpuMs / windowMs));
+		gpuIdlePercent = std::max(0.0f, 100.0f * (1.0f - windowGpuMs / windowMs));
+		windowStart = now;
+		windowCpuMs = 0.0f;
+		windowGpuMs = 0.0f;
+	}
+}
+
+void FramePacer::ScheduleNextFrame(bool animating)
+{
+	if (!animating || timerPending)
+		return;
+
+	// The swap already waited for the display
+	if (vsync) {
+		MarkDirty(DIRTY_ANIMATION);
+		return;
+	}
+
+	double interval = 1.0 / std::max(1.0f, targetFps);
+	double remaining = interval - (Now() - frameStart);
+	int delay = std::max(0, static_cast<int>(remaining * 1000.0 + 0.5));
+
+	timerPending = true;
+	glutTimerFunc(delay, TimerTick, 0);
+}
+
+void FramePacer::TimerTick(int /*value*/)
+{
+	timerOwner->timerPending = false;
+	timerOwner->MarkDirty(DIRTY_ANIMATION);
+}
+
+void FramePacer::SetVSync(bool enabled)
+{
+	vsync = enabled;
+
+#ifdef _WIN32
+	typedef BOOL (WINAPI *SwapIntervalProc)(int);
+	SwapIntervalProc swapInterval = (SwapIntervalProc)wglGetProcAddress("wglSwapIntervalEXT");
+#else
+	typedef int (*SwapIntervalProc)(int);
+	SwapIntervalProc swapInterval =
+		(SwapIntervalProc)glXGetProcAddressARB((const unsigned char*)"glXSwapIntervalSGI");
+#endif
+
+	if (swapInterval)
+		swapInterval(enabled ? 1 : 0);
+	else if (enabled)
+		printf("Swap control not supported, pacing with timers instead\n");
+
+	if (!swapInterval)
+		vsync = false;
+
+	MarkDirty(DIRTY_UI);
+}
@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////
+// Render-on-demand.  Nothing redraws the window on a fixed clock;
+// instead everything that changes what's on screen (camera, lights,
+// tweak bar, window size, the animation clock) marks the frame dirty
+// and that schedules exactly one redisplay.
+//
+// While the scene is animating, the next frame is scheduled after
+// each swap: immediately when VSync paces the swaps, otherwise with a
+// GLUT timer aimed at the target frame rate.
+//
+// Busy CPU/GPU time is accumulated and turned into idle percentages
+// once a second (or at the first frame after a longer idle stretch).
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _FRAMEPACER_
+#define _FRAMEPACER_
+
+#include "gputimer.h"
+
+enum DirtyFlags {
+	DIRTY_CAMERA    = 1 << 0,
+	DIRTY_LIGHTS    = 1 << 1,
+	DIRTY_UI        = 1 << 2,
+	DIRTY_ANIMATION = 1 << 3,
+	DIRTY_WINDOW    = 1 << 4
+};
+
+class FramePacer
+{
+public:
+	FramePacer();
+
+	// Needs a current GL context
+	void Initialize();
+
+	// Requests a redisplay for the given reasons
+	void MarkDirty(unsigned int flags);
+
+	// Bracket everything the frame renders, EndFrame goes right before the swap
+	void BeginFrame();
+	void EndFrame();
+
+	// The DirtyFlags that triggered the frame in progress
+	unsigned int FrameReasons() const { return frameReasons; }
+
+	// After the swap: keeps an animating scene going at the chosen pace
+	void ScheduleNextFrame(bool animating);
+
+	void SetVSync(bool enabled);
+	bool VSync() const { return vsync; }
+
+	float targetFps;
+
+	// Statistics shown in the tweak bar
+	float cpuFrameMs;     // BeginFrame to EndFrame
+	float gpuFrameMs;
+	float cpuIdlePercent;
+	float gpuIdlePercent;
+	unsigned int framesDrawn;
+	char lastReason[48];  // what triggered the last frame
+
+private:
+	static void TimerTick(int value);
+
+	unsigned int dirty;
+	unsigned int frameReasons;
+	bool vsync;
+	bool timerPending;
+
+	GPUTimer frameTimer;
+
+	double frameStart;    // seconds, at BeginFrame
+	double windowStart;   // start of the current statistics window
+	float windowCpuMs;
+	float windowGpuMs;
+};
+
+#endif
@@ -18,6 +18,9 @@
     // Includes for Linux
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <glload/gl_3_3.h>
 #include <glload/gl_load.hpp>
 #include <GL/freeglut.h>
@@ -25,6 +28,9 @@
 using namespace glm;
 
 #include "scene.h"
+#include "ssaoreference.h"
+#include "gbufferpacking.h"
+#include "framepacer.h"
 #include "AntTweakBar.h"
 
 #ifndef PI
@@ -32,6 +38,7 @@ using namespace glm;
 #endif
 
 Scene scene;
+FramePacer pacer;
 
 // Some globals used for mouse handling.
 int mouseX, mouseY;
@@ -47,10 +54,23 @@ float mouseSpeedDampeningValue = 2.0f;
 // Called by GLUT when the scene needs to be redrawn.
 void ReDraw()
 {
+	pacer.BeginFrame();
+	if (pacer.FrameReasons() & ~DIRTY_ANIMATION)
+		scene.RestartSSAOConvergence();
     scene.DrawScene();
     TwDraw();
+	pacer.EndFrame();
     glutSwapBuffers();
 
+	pacer.ScheduleNextFrame(scene.NeedsAnimationFrame());
+}
+
+////////////////////////////////////////////////////////////////////////
+// Draws once more after a resize storm so the render targets catch
+// up with the final window size.
+void ResizeSettled(int value)
+{
+	pacer.MarkDirty(DIRTY_WINDOW);
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -63,8 +83,11 @@ void ReshapeWindow(int w, int h)
     TwWindowSize(w,h);
     scene.width = w;
     scene.height = h;
+	if (w && h) {
+		TargetPool().RequestScreenSize(w, h);
+		glutTimerFunc(ResizeDebounceMs + 10, ResizeSettled, 0); }
 	// Force a redraw
-    glutPostRedisplay();
+	pacer.MarkDirty(DIRTY_WINDOW);
 
 }
 
@@ -72,7 +95,7 @@ void ReshapeWindow(int w, int h)
 // Called by GLut for keyboard actions.
 void KeyboardDown(unsigned char key, int x, int y)
 {
-    if (TwEventKeyboardGLUT(key, x, y)) return;
+    if (TwEventKeyboardGLUT(key, x, y)) { pacer.MarkDirty(DIRTY_UI); return; }
 	printf("%c", key);
 
     switch(key) {
@@ -87,7 +110,7 @@ void KeyboardDown(unsigned char key, int x, int y)
     case '8':
     case '9':
         scene.mode = key-'0';
-        glutPostRedisplay();
+		pacer.MarkDirty(DIRTY_UI);
         break;
 	case 'l':
 		LKeyPressed = true;
@@ -116,11 +139,17 @@ void KeyboardUp(unsigned char key, int x, int y)
 
 }
 
+// Dragging with 'l' held moves the light selected in the tweak bar
+void MoveSelectedLight(const vec3& offset)
+{
+	scene.localLights.SetPosition(scene.selectedLight, scene.localLights.Position(scene.selectedLight) + offset);
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Called by GLut when a mouse button changes state.
 void MouseButton(int button, int state, int x, int y)
 {
-	if (TwEventMouseButtonGLUT(button, state, x, y)) return;
+	if (TwEventMouseButtonGLUT(button, state, x, y)) { pacer.MarkDirty(DIRTY_UI); return; }
 	mouseX = x;
 	mouseY = y;
 
@@ -139,7 +168,7 @@ void MouseButton(int button, int state, int x, int y)
 				if (scene.isForward)
 					scene.lightDist -= 5.0f;
 				else
-					scene.localLights[scene.lightIndex].lightPos.z += 2.0f;
+					MoveSelectedLight(vec3(0.0f, 0.0f, 2.0f));
 			}
 			else
 				scene.zoom -= 10.0f;
@@ -149,7 +178,7 @@ void MouseButton(int button, int state, int x, int y)
 				if (scene.isForward)
 					scene.lightDist += 5.0f;
 				else
-					scene.localLights[scene.lightIndex].lightPos.z -= 2.0f;
+					MoveSelectedLight(vec3(0.0f, 0.0f, -2.0f));
 			}
 				
 			else
@@ -186,7 +215,7 @@ void MouseButton(int button, int state, int x, int y)
     // if (state == GLUT_DOWN)
 
 
-    glutPostRedisplay();
+	pacer.MarkDirty(LKeyPressed ? DIRTY_LIGHTS : DIRTY_CAMERA);
 
 }
 
@@ -194,7 +223,9 @@ void MouseButton(int button, int state, int x, int y)
 // Called by GLut when a mouse moves (while a button is down)
 void MouseMotion(int x, int y)
 {
-    if (TwEventMouseMotionGLUT(x,y)) return;
+    if (TwEventMouseMotionGLUT(x,y)) { pacer.MarkDirty(DIRTY_UI); return; }
+
+	int oldX = mouseX, oldY = mouseY;
 
 	if (leftDown) {
 		if (x != mouseX) {
@@ -202,7 +233,7 @@ void MouseMotion(int x, int y)
 				if(scene.isForward)
 					scene.lightSpin += (x - mouseX) / mouseSpeedDampeningValue;
 				else
-					scene.localLights[scene.lightIndex].lightPos.x += (x - mouseX) / 4.0f;
+					MoveSelectedLight(vec3((x - mouseX) / 4.0f, 0.0f, 0.0f));
 			else 
 				scene.spin += (x - mouseX) / mouseSpeedDampeningValue;
 			
@@ -213,7 +244,7 @@ void MouseMotion(int x, int y)
 				if(scene.isForward)
 					scene.lightTilt += (y - mouseY) / mouseSpeedDampeningValue;
 				else
-					scene.localLights[scene.lightIndex].lightPos.y += (y - mouseY) / 4.0f;	
+					MoveSelectedLight(vec3(0.0f, (y - mouseY) / 4.0f, 0.0f));	
 			else 
 				scene.tilt += (y - mouseY) / mouseSpeedDampeningValue;
 
@@ -243,8 +274,24 @@ void MouseMotion(int x, int y)
 		}
 	}
 
-	std::cout << scene.localLights[scene.lightIndex].lightPos.x << " , " << scene.localLights[scene.lightIndex].lightPos.y << std::endl;
-	
+	// Only dragging changes anything
+	if (mouseX != oldX || mouseY != oldY)
+		pacer.MarkDirty(leftDown && LKeyPressed ? DIRTY_LIGHTS : DIRTY_CAMERA);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Mouse moves without a button and special keys only matter to the
+// tweak bar (hover highlights, arrow keys in edit fields).
+void PassiveMouseMotion(int x, int y)
+{
+	if (TwEventMouseMotionGLUT(x, y))
+		pacer.MarkDirty(DIRTY_UI);
+}
+
+void SpecialKey(int key, int x, int y)
+{
+	if (TwEventSpecialGLUT(key, x, y))
+		pacer.MarkDirty(DIRTY_UI);
 
 }
 
@@ -261,6 +308,21 @@ void TW_CALL ChangeRenderMode(void *clientData)
 	scene.isForward = !scene.isForward;
 }
 
+void TW_CALL BenchmarkSSAO(void *clientData)
+{
+	scene.ssaoBenchmarkRequested = true;
+}
+
+void TW_CALL SaveSSAOBuffers(void *clientData)
+{
+	scene.ssaoSaveRequested = true;
+}
+
+void TW_CALL BenchmarkShadowBlur(void *clientData)
+{
+	scene.shadowBlurBenchmarkRequested = true;
+}
+
 void TW_CALL GBufferPosition(void *clientData)
 {
 	scene.gBufDebug = GBufferDebugMode::G_POS;
@@ -330,6 +392,41 @@ void TW_CALL ClearShadowDebug(void *clientData)
 	scene.shadowDebug = ShadowDebugMode::NONE_SHADOW;
 }
 
+void TW_CALL CaptureFrame(void *clientData)
+{
+	scene.captureFrame = true;
+}
+
+void TW_CALL SetAnimating(const void *value, void *clientData)
+{
+	scene.SetAnimating(*(bool*)value);
+}
+
+void TW_CALL GetAnimating(void *value, void *clientData)
+{
+	*(bool*)value = scene.isAnimating;
+}
+
+void TW_CALL SetVSync(const void *value, void *clientData)
+{
+	pacer.SetVSync(*(bool*)value);
+}
+
+void TW_CALL GetVSync(void *value, void *clientData)
+{
+	*(bool*)value = pacer.VSync();
+}
+
+void TW_CALL GetTargetCount(void *value, void *clientData)
+{
+	*(unsigned int*)value = TargetPool().TargetCount();
+}
+
+void TW_CALL GetFreeTargetCount(void *value, void *clientData)
+{
+	*(unsigned int*)value = TargetPool().FreeCount();
+}
+
 void TW_CALL ToggleGround(void *clientData)
 {
     scene.drawGround = !scene.drawGround;
@@ -376,27 +473,37 @@ void TW_CALL GetShadowDebugMode(void *value, void *clientData)
 void TW_CALL SetLightColor(const void *value, void *clientData)
 {
 	//float i = *(glm::vec3*)value; // AntTweakBar forces this cast.
-	scene.localLights[scene.lightIndex].lightColor = *(glm::vec3*)value;
+	scene.localLights.SetColor(scene.selectedLight, *(glm::vec3*)value);
 }
 
 void TW_CALL GetLightColor(void *value, void *clientData)
 {
-	*(glm::vec3*)value = scene.localLights[scene.lightIndex].lightColor;
+	*(glm::vec3*)value = scene.localLights.Color(scene.selectedLight);
 }
 
 void TW_CALL GetLightRange(void *value, void *clientData)
 {
-	*(float*)value = scene.localLights[scene.lightIndex].radius;
+	*(float*)value = scene.localLights.Radius(scene.selectedLight);
+}
+
+void TW_CALL SetLightCount(const void *value, void *clientData)
+{
+	scene.SetLightCount(*(int*)value);
+}
+
+void TW_CALL GetLightCount(void *value, void *clientData)
+{
+	*(int*)value = scene.localLights.Count();
 }
 
 void TW_CALL GetAttenuationX(void *value, void *clientData)
 {
-	*(float*)value = scene.localLights[scene.lightIndex].attenuationVector[0];
+	*(float*)value = scene.localLights.Attenuation(scene.selectedLight)[0];
 }
 
 void TW_CALL GetAttenuationY(void *value, void *clientData)
 {
-	*(float*)value = scene.localLights[scene.lightIndex].attenuationVector[1];
+	*(float*)value = scene.localLights.Attenuation(scene.selectedLight)[1];
 }
 
 std::string ShadowDebugEnumToString(ShadowDebugMode debugMode) {
@@ -432,6 +539,42 @@ std::string ShadowDebugEnumToString(ShadowDebugMode debugMode) {
 // Do the OpenGL/GLut setup and then enter the interactive loop.
 int main(int argc, char** argv)
 {
+	// -benchclusters [lights]: times the light binning without opening a window
+	if (argc > 1 && strcmp(argv[1], "-benchclusters") == 0) {
+		BenchmarkLightClusters(argc > 2 ? atoi(argv[2]) : 10000, 100);
+		return 0;
+	}
+
+	// -benchssao [width [height]]: times the CPU reference SSAO (scalar
+	// and AVX2, one thread and all) on a ray cast test scene; the height
+	// defaults to 3/4 of the width
+	if (argc > 1 && strcmp(argv[1], "-benchssao") == 0) {
+		int benchWidth = argc > 2 ? atoi(argv[2]) : 1024;
+		BenchmarkSSAOReference(benchWidth, argc > 3 ? atoi(argv[3]) : benchWidth * 3 / 4, 5);
+		return 0;
+	}
+
+	// -dumpcapture file: prints the command lists of a 'Capture Frame'
+	if (argc > 2 && strcmp(argv[1], "-dumpcapture") == 0)
+		return DumpCapture(argv[2]);
+
+	// -checkgbuffer [directions]: round trips the G-buffer's normal and
+	// shininess encodings on the CPU and reports the largest errors
+	if (argc > 1 && strcmp(argv[1], "-checkgbuffer") == 0)
+		return CheckGBufferPacking(argc > 2 ? atoi(argv[2]) : 1000000);
+
+	// -ssaoref positions.pfm ao.pfm [radius samples blurRadius [gpu.pfm]]:
+	// bakes AO on the CPU, optionally diffing it against a GPU result
+	if (argc > 3 && strcmp(argv[1], "-ssaoref") == 0) {
+		SSAOReferenceSettings settings;
+		if (argc > 6) {
+			settings.radius = float(atof(argv[4]));
+			settings.kernelSize = atoi(argv[5]);
+			settings.blurRadius = atoi(argv[6]);
+		}
+		return RunSSAOReference(argv[2], argv[3], settings, 0.2f, argc > 7 ? argv[7] : NULL);
+	}
+
 	/* Original main */
 	
     // Initialize GLUT and open a window
@@ -455,6 +598,8 @@ int main(int argc, char** argv)
     printf("Rendered by: %s\n", glGetString(GL_RENDERER));
     fflush(stdout);
 
+	pacer.Initialize();
+
     // Hookup GLUT callback for all events we're interested in
     glutIgnoreKeyRepeat(true);
     glutDisplayFunc(&ReDraw);
@@ -463,8 +608,8 @@ int main(int argc, char** argv)
     glutKeyboardUpFunc(&KeyboardUp);
     glutMouseFunc(&MouseButton);
     glutMotionFunc(&MouseMotion);
-    glutPassiveMotionFunc((GLUTmousemotionfun)TwEventMouseMotionGLUT);
-    glutSpecialFunc((GLUTspecialfun)TwEventSpecialGLUT);
+    glutPassiveMotionFunc(&PassiveMouseMotion);
+    glutSpecialFunc(&SpecialKey);
 
     // Initialize the tweakbar with a few tweaks.  
     TwInit(TW_OPENGL, NULL);
@@ -504,16 +649,30 @@ int main(int argc, char** argv)
 	TwAddVarCB(bar, "LightRange", TW_TYPE_FLOAT, NULL, GetLightRange, NULL, " label='Light Range' group='LocalLights' ");
 	TwAddVarCB(bar, "LightAttenuationX", TW_TYPE_FLOAT, NULL, GetAttenuationX, NULL, " label='Light AttenuationX' group='LocalLights' ");
 	TwAddVarCB(bar, "LightAttenuationY", TW_TYPE_FLOAT, NULL, GetAttenuationY, NULL, " label='Light AttenuationY' group='LocalLights' ");
+	// The light list below is built for the first 16, keep at least those
+	TwAddVarCB(bar, "LightCount", TW_TYPE_INT32, SetLightCount, GetLightCount, NULL, " label='Light Count' group='LocalLights' min=16 max=10000 step=16 ");
+	TwAddVarRW(bar, "LocalLightMode", TwDefineEnum("LocalLightMode", NULL, 0), &scene.localLightMode, " label='Light Pass' enum='0 {Light Volumes}, 1 {Tiled Compute}' group='LocalLights' ");
+	TwAddVarRO(bar, "VolumeLod0", TW_TYPE_INT32, &scene.lightLodCounts[0], " label='Icosahedron Volumes' group='LocalLights' ");
+	TwAddVarRO(bar, "VolumeLod1", TW_TYPE_INT32, &scene.lightLodCounts[1], " label='Sphere(8) Volumes' group='LocalLights' ");
+	TwAddVarRO(bar, "VolumeLod2", TW_TYPE_INT32, &scene.lightLodCounts[2], " label='Sphere(16) Volumes' group='LocalLights' ");
+	TwAddVarRO(bar, "VolumeLod3", TW_TYPE_INT32, &scene.lightLodCounts[3], " label='Sphere(32) Volumes' group='LocalLights' ");
+	TwAddVarRW(bar, "AnimateLights", TW_TYPE_BOOLCPP, &scene.animateLights, " label='Animate Lights' group='LocalLights' ");
+	TwAddVarRO(bar, "LightsUploaded", TW_TYPE_UINT32, &scene.lightsUploaded, " label='Lights Uploaded' group='LocalLights' ");
+	TwAddVarRW(bar, "TileLightCount", TW_TYPE_BOOLCPP, &scene.showTileLightCount, " label='Tile Light Heatmap' group='LocalLights' ");
+	TwAddVarRO(bar, "LightPassMs", TW_TYPE_FLOAT, &scene.localLightMs, " label='Light Pass GPU ms' group='LocalLights' precision=2 ");
+	TwAddVarRW(bar, "ClusteredLights", TW_TYPE_BOOLCPP, &scene.clusteredLighting, " label='Clustered (Forward)' group='LocalLights' ");
+	TwAddVarRO(bar, "ClusterBuildMs", TW_TYPE_FLOAT, &scene.clusterBuildMs, " label='Cluster Build CPU ms' group='LocalLights' precision=2 ");
+	TwAddVarRO(bar, "ClusterMaxLights", TW_TYPE_UINT32, &scene.lightClusters.maxLightsPerCluster, " label='Max Lights per Cluster' group='LocalLights' ");
 
 
 	std::string lights = " enum=";
 	std::string lightString = "'";
-	for (unsigned int i = 0; i < scene.localLights.size(); ++i) {
+	for (int i = 0; i < scene.localLights.Count(); ++i) {
 		lightString += std::to_string(i);
 		lightString += " {Light";
 		lightString += std::to_string(i);
 		lightString += "}";
-		if (i + 1 != scene.localLights.size())
+		if (i + 1 != scene.localLights.Count())
 			lightString += ", ";
 	}
 	lightString += "' group='LocalLights' ";
@@ -543,6 +702,23 @@ int main(int argc, char** argv)
 	// shadow
 	TwAddVarCB(bar, "ShadowDebugModeList", TwDefineEnum("ShadowDebugModes", NULL, 0), SetShadowDebugMode, GetShadowDebugMode, NULL, shadowDebugModes.c_str());
 	TwAddVarRW(bar, "ShadowMapToggle", TW_TYPE_BOOLCPP, &scene.isShadowEnabled, " label='Toggle Shadow Map' group='ESM' ");
+	TwAddVarRW(bar, "ShadowBlurFilter", TwDefineEnum("ShadowBlurFilter", NULL, 0), &scene.shadowBlurFilter, " label='Blur Filter' enum='0 {Weighted kernel}, 1 {Three boxes}, 2 {Summed-area table}' group='ESM' ");
+	TwAddVarRW(bar, "SATCVal", TW_TYPE_FLOAT, &scene.satCValue, " label='Table Constant C' group='ESM' min=1 max=40 ");
+	TwAddVarRW(bar, "ShadowLightSize", TW_TYPE_FLOAT, &scene.shadowLightSize, " label='Light Size' group='ESM' min=0 step=4 ");
+	TwAddVarRW(bar, "ShadowMaxFilterRadius", TW_TYPE_INT32, &scene.shadowMaxFilterRadius, " label='Max Filter Radius' group='ESM' min=1 max=128 ");
+	TwAddVarRW(bar, "ShadowCascadesToggle", TW_TYPE_BOOLCPP, &scene.useShadowCascades, " label='Cascaded Shadows' group='ESM' ");
+	TwAddVarRW(bar, "ShadowCascadeCount", TW_TYPE_INT32, &scene.cascades.count, " label='Cascades' group='ESM' min=2 max=4 ");
+	TwAddVarRW(bar, "ShadowCascadeDistance", TW_TYPE_FLOAT, &scene.cascades.distance, " label='Cascade Distance' group='ESM' min=10 step=10 ");
+	TwAddVarRW(bar, "ShadowCascadeLambda", TW_TYPE_FLOAT, &scene.cascades.lambda, " label='Cascade Split Lambda' group='ESM' min=0 max=1 step=0.05 ");
+	for (int i = 0; i < MaxShadowCascades; ++i) {
+		std::string name = "ShadowCascadeResolution" + std::to_string(i);
+		std::string def = " label='Cascade " + std::to_string(i) + " Resolution' enum='512 {512}, 1024 {1024}, 2048 {2048}' group='ESM' ";
+		TwAddVarRW(bar, name.c_str(), TwDefineEnum(name.c_str(), NULL, 0), &scene.cascades.resolution[i], def.c_str());
+		name = "ShadowCascadeInterval" + std::to_string(i);
+		def = " label='Cascade " + std::to_string(i) + " Every N Frames' min=1 max=8 group='ESM' ";
+		TwAddVarRW(bar, name.c_str(), TW_TYPE_INT32, &scene.cascades.interval[i], def.c_str());
+	}
+	TwAddButton(bar, "ShadowBlurBenchmark", (TwButtonCallback)BenchmarkShadowBlur, NULL, " label='Benchmark Blur Widths' group='ESM' ");
 	TwDefine(" Tweaks/ESM opened=false ");
 
 	// Parallax
@@ -561,8 +737,49 @@ int main(int argc, char** argv)
 	TwAddVarRW(bar, "SSAOToggle", TW_TYPE_BOOLCPP, &scene.isSSAOEnabled, " label='Toggle SSAO' group='SSAO' true='Enabled' false='Disabled' ");
 	TwAddVarRW(bar, "SSAOBlurToggle", TW_TYPE_BOOLCPP, &scene.isSSAOBlurred, " label='Blur SSAO' group='SSAO' true='Blurred' false='Non-Blurred' ");
 	TwAddVarRW(bar, "SSAORADIUS", TW_TYPE_FLOAT, &scene.ssaoRadius, " label='SSAO Radius' group='SSAO' step=0.05  ");
+	TwAddVarRW(bar, "SSAOKernelSize", TwDefineEnum("SSAOKernelSize", NULL, 0), &scene.ssaoKernelSize, " label='Kernel Samples' enum='8 {8}, 16 {16}, 32 {32}, 64 {64}, 128 {128}' group='SSAO' ");
+	TwAddVarRW(bar, "SSAOResolution", TwDefineEnum("SSAOResolution", NULL, 0), &scene.ssaoResolution, " label='AO Resolution' enum='0 {Full}, 1 {Half}, 2 {Quarter}' group='SSAO' ");
+	TwAddVarRW(bar, "SSAOSharpness", TW_TYPE_FLOAT, &scene.ssaoDepthSharpness, " label='Depth Sharpness' group='SSAO' min=0 step=5 ");
+	TwAddVarRW(bar, "SSAOBlurRadius", TW_TYPE_INT32, &scene.ssaoBlurRadius, " label='Blur Radius' group='SSAO' min=1 max=8 ");
+	TwAddVarRO(bar, "SSAOMs", TW_TYPE_FLOAT, &scene.ssaoMs, " label='AO GPU ms' group='SSAO' precision=2 ");
+	TwAddVarRW(bar, "SSAOMethod", TwDefineEnum("SSAOMethod", NULL, 0), &scene.ssaoMethod, " label='AO Sampling' enum='0 {Kernel}, 1 {Deinterleaved}, 2 {Horizon (GTAO)}, 3 {Kernel (compute tiles)}' group='SSAO' ");
+	TwAddVarRW(bar, "SSAODepthPyramid", TW_TYPE_BOOLCPP, &scene.ssaoUseDepthPyramid, " label='Kernel Depth Pyramid' group='SSAO' ");
+	TwAddVarRW(bar, "SSAOHorizonDirections", TW_TYPE_INT32, &scene.ssaoHorizonDirections, " label='Horizon Directions' group='SSAO' min=1 max=4 ");
+	TwAddVarRW(bar, "SSAOHorizonSteps", TW_TYPE_INT32, &scene.ssaoHorizonSteps, " label='Horizon Steps' group='SSAO' min=1 max=8 ");
+	TwAddVarRW(bar, "SSAOTemporal", TW_TYPE_BOOLCPP, &scene.ssaoTemporal, " label='Temporal AO' group='SSAO' ");
+	TwAddVarRW(bar, "SSAOTemporalSamples", TwDefineEnum("SSAOTemporalSamples", NULL, 0), &scene.ssaoTemporalSamples, " label='Temporal Kernel Samples' enum='8 {8}, 16 {16}, 32 {32}' group='SSAO' ");
+	TwAddVarRW(bar, "SSAOTemporalBlend", TW_TYPE_FLOAT, &scene.ssaoTemporalBlend, " label='Temporal Blend' group='SSAO' min=0.02 max=1 step=0.01 ");
+	TwAddButton(bar, "SSAOBenchmark", (TwButtonCallback)BenchmarkSSAO, NULL, " label='Benchmark AO Radii' group='SSAO' ");
+	TwAddButton(bar, "SSAOSave", (TwButtonCallback)SaveSSAOBuffers, NULL, " label='Save AO Buffers' group='SSAO' ");
 	TwAddSeparator(bar, NULL, NULL);
 	TwAddVarRW(bar, "DebugQuadToggle", TW_TYPE_BOOLCPP, &scene.drawDebugQuads, " label='Draw Debug Quads?' ");
+	TwAddButton(bar, "CaptureFrame", (TwButtonCallback)CaptureFrame, NULL, " label='Capture Frame' ");
+
+	// Frame pacing
+	TwAddVarCB(bar, "Animate", TW_TYPE_BOOLCPP, SetAnimating, GetAnimating, NULL, " label='Animate' group='Frame' ");
+	TwAddVarCB(bar, "VSync", TW_TYPE_BOOLCPP, SetVSync, GetVSync, NULL, " label='VSync' group='Frame' ");
+	TwAddVarRW(bar, "TargetFPS", TW_TYPE_FLOAT, &pacer.targetFps, " label='Target FPS' group='Frame' min=1 max=240 step=5 ");
+	TwAddVarRO(bar, "CPUFrameMs", TW_TYPE_FLOAT, &pacer.cpuFrameMs, " label='CPU ms' group='Frame' precision=2 ");
+	TwAddVarRO(bar, "GPUFrameMs", TW_TYPE_FLOAT, &pacer.gpuFrameMs, " label='GPU ms' group='Frame' precision=2 ");
+	TwAddVarRO(bar, "CPUIdle", TW_TYPE_FLOAT, &pacer.cpuIdlePercent, " label='CPU idle %' group='Frame' precision=1 ");
+	TwAddVarRO(bar, "GPUIdle", TW_TYPE_FLOAT, &pacer.gpuIdlePercent, " label='GPU idle %' group='Frame' precision=1 ");
+	TwAddVarRO(bar, "FramesDrawn", TW_TYPE_UINT32, &pacer.framesDrawn, " label='Frames drawn' group='Frame' ");
+	TwAddVarRO(bar, "RedrawReason", TW_TYPE_CSSTRING(sizeof(pacer.lastReason)), pacer.lastReason, " label='Redraw reason' group='Frame' ");
+	TwAddVarCB(bar, "RenderTargets", TW_TYPE_UINT32, NULL, GetTargetCount, NULL, " label='Render targets' group='Frame' ");
+	TwAddVarCB(bar, "FreeRenderTargets", TW_TYPE_UINT32, NULL, GetFreeTargetCount, NULL, " label='Free targets' group='Frame' ");
+	TwDefine(" Tweaks/Frame opened=false ");
+
+	// Dynamic resolution
+	TwAddVarRW(bar, "DynResToggle", TW_TYPE_BOOLCPP, &scene.resolution.enabled, " label='Dynamic Resolution' group='DynamicResolution' ");
+	TwAddVarRW(bar, "DynResBudget", TW_TYPE_FLOAT, &scene.resolution.budgetMs, " label='GPU Budget (ms)' group='DynamicResolution' min=1 max=100 step=0.5 ");
+	TwAddVarRW(bar, "DynResMin", TW_TYPE_FLOAT, &scene.resolution.minScale, " label='Min Scale' group='DynamicResolution' min=0.1 max=1 step=0.05 ");
+	TwAddVarRW(bar, "DynResMax", TW_TYPE_FLOAT, &scene.resolution.maxScale, " label='Max Scale' group='DynamicResolution' min=0.1 max=1 step=0.05 ");
+	TwAddVarRW(bar, "UpscaleFilter", TwDefineEnum("UpscaleFilter", NULL, 0), &scene.upscaleFilter, " label='Upscale Filter' enum='0 {Bilinear}, 1 {Catmull-Rom}' group='DynamicResolution' ");
+	TwAddVarRO(bar, "DynResScale", TW_TYPE_FLOAT, &scene.resolution.scale, " label='Scale' group='DynamicResolution' precision=2 ");
+	TwAddVarRO(bar, "DynResGPU", TW_TYPE_FLOAT, &scene.resolution.lastGpuMs, " label='Scene GPU ms' group='DynamicResolution' precision=2 ");
+	TwAddVarRO(bar, "DynResSize", TW_TYPE_CSSTRING(sizeof(scene.renderSizeText)), scene.renderSizeText, " label='Render Size' group='DynamicResolution' ");
+	TwAddVarRO(bar, "DynResHistory", TW_TYPE_CSSTRING(sizeof(scene.resolution.history)), scene.resolution.history, " label='Scale History %' group='DynamicResolution' ");
+	TwDefine(" Tweaks/DynamicResolution opened=false ");
 
     // Initialize our scene
     scene.InitializeScene();
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////
+// G-buffer encoding on the CPU.  See gbufferpacking.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <vector>
+
+#include "gbufferpacking.h"
+
+static vec2 SignNotZero(const vec2& v)
+{
+	return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 EncodeNormal(const vec3& normal)
+{
+	vec3 n = normal / (std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z));
+	vec2 e(n.x, n.y);
+	if (n.z < 0.0f)
+		e = (vec2(1.0f) - vec2(std::abs(n.y), std::abs(n.x))) * SignNotZero(e);
+	return e * 0.5f + vec2(0.5f);
+}
+
+vec3 DecodeNormal(const vec2& encoded)
+{
+	vec2 e = encoded * 2.0f - vec2(1.0f);
+	vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+	if (n.z < 0.0f) {
+		vec2 folded = (vec2(1.0f) - vec2(std::abs(n.y), std::abs(n.x))) * SignNotZero(vec2(n.x, n.y));
+		n.x = folded.x;
+		n.y = folded.y;
+	}
+	return glm::normalize(n);
+}
+
+float EncodeShininess(float shininess)
+{
+	return std::sqrt(std::max(0.0f, std::min(shininess / MaxShininess, 1.0f)));
+}
+
+float DecodeShininess(float encoded)
+{
+	return encoded * encoded * MaxShininess;
+}
+
+float QuantizeUnorm(float value, int bits)
+{
+	float levels = static_cast<float>((1 << bits) - 1);
+	float clamped = std::max(0.0f, std::min(value, 1.0f));
+	return std::floor(clamped * levels + 0.5f) / levels;
+}
+
+vec3 RoundTripNormal(const vec3& n)
+{
+	vec2 e = EncodeNormal(n);
+	return DecodeNormal(vec2(QuantizeUnorm(e.x, 16), QuantizeUnorm(e.y, 16)));
+}
+
+vec3 ReconstructViewPosition(const vec2& uv, float depth, const MAT4& projectionInverse)
+{
+	float ndc[4] = { uv.x * 2.0f - 1.0f, uv.y * 2.0f - 1.0f, depth * 2.0f - 1.0f, 1.0f };
+	float view[4];
+	for (int r = 0; r < 4; ++r)
+		view[r] = projectionInverse[r][0]*ndc[0] + projectionInverse[r][1]*ndc[1]
+				+ projectionInverse[r][2]*ndc[2] + projectionInverse[r][3]*ndc[3];
+	return vec3(view[0], view[1], view[2]) / view[3];
+}
+
+// acos of the dot product can't resolve angles this small in floats
+static float AngleDegrees(const vec3& a, const vec3& b)
+{
+	return std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b)) * 180.0f / 3.14159265358979f;
+}
+
+////////////////////////////////////////////////////////////////////////
+// The normals are a Fibonacci spiral over the sphere plus the axes,
+// where the octahedral fold has its seams.  RG16 spaces codes about
+// 0.005 degrees apart; the bound leaves room for that.  Shininess goes
+// through 8 bits of its square root: a stored level must come back as
+// itself, and any other value within half a level of what it encodes.
+int CheckGBufferPacking(int directionCount)
+{
+	const float pi = 3.14159265358979f;
+	const float maxNormalDegrees = 0.02f;
+	const float maxLevelError = 1e-5f; // relative, on the stored levels
+
+	std::vector<vec3> normals;
+	for (int axis = 0; axis < 3; ++axis) {
+		vec3 n(0.0f);
+		n[axis] = 1.0f;
+		normals.push_back(n);
+		normals.push_back(-n);
+	}
+	for (int i = 0; i < directionCount; ++i) {
+		float z = 1.0f - (2.0f * i + 1.0f) / directionCount;
+		float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+		float phi = i * pi * (3.0f - std::sqrt(5.0f));
+		normals.push_back(vec3(r * std::cos(phi), r * std::sin(phi), z));
+	}
+
+	float worstExact = 0.0f, worstStored = 0.0f;
+	vec3 worstNormal(0.0f);
+	bool inRange = true;
+	for (unsigned int i = 0; i < normals.size(); ++i) {
+		const vec3& n = normals[i];
+		vec2 e = EncodeNormal(n);
+		inRange = inRange && e.x >= 0.0f && e.x <= 1.0f && e.y >= 0.0f && e.y <= 1.0f;
+
+		float exact = AngleDegrees(n, DecodeNormal(e));
+		float stored = AngleDegrees(n, RoundTripNormal(n));
+		worstExact = std::max(worstExact, exact);
+		if (stored > worstStored) {
+			worstStored = stored;
+			worstNormal = n;
+		}
+	}
+
+	float worstLevel = 0.0f;
+	for (int level = 1; level < 256; ++level) {
+		float shininess = DecodeShininess(level / 255.0f);
+		float stored = DecodeShininess(QuantizeUnorm(EncodeShininess(shininess), 8));
+		worstLevel = std::max(worstLevel, std::abs(stored - shininess) / shininess);
+	}
+
+	// In levels of the encoding
+	float worstBetween = 0.0f, worstShininess = 0.0f;
+	for (float shininess = 0.0f; shininess <= MaxShininess; shininess += 0.125f) {
+		float encoded = EncodeShininess(shininess);
+		float error = std::abs(QuantizeUnorm(encoded, 8) - encoded) * 255.0f;
+		if (error > worstBetween) {
+			worstBetween = error;
+			worstShininess = shininess;
+		}
+	}
+
+	printf("G-buffer packing: %u normals\n", static_cast<unsigned int>(normals.size()));
+	printf("  normal, unquantized: %.6f degrees at most\n", worstExact);
+	printf("  normal through RG16: %.6f degrees at most (at %.4f %.4f %.4f), bound %.3f\n",
+		worstStored, worstNormal.x, worstNormal.y, worstNormal.z, maxNormalDegrees);
+	printf("  shininess levels through RGBA8: %.2e relative at most, bound %.0e\n", worstLevel, maxLevelError);
+	printf("  shininess through RGBA8: %.4f levels at most (at %.3f), bound 0.5\n", worstBetween, worstShininess);
+
+	bool passed = inRange && worstStored <= maxNormalDegrees && worstLevel <= maxLevelError && worstBetween <= 0.5f + 1e-4f;
+	printf("  %s\n", !inRange ? "FAILED: a normal encoded outside [0,1]" : passed ? "passed" : "FAILED");
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+///////////////////////////////////////////////////////////////////////
+// C++ versions of the G-buffer encoding in shaders/gBufferPacking.glsl,
+// including the quantization the render targets apply (RG16, RGBA8,
+// RGB10A2), so packed values can be produced and checked on the CPU.
+// Keep the two files in step.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _GBUFFERPACKING_
+#define _GBUFFERPACKING_
+
+#include "transform.h"
+
+const float MaxShininess = 256.0f;
+
+// Octahedral normal encoding, result in [0,1]^2
+vec2 EncodeNormal(const vec3& n);
+vec3 DecodeNormal(const vec2& e);
+
+float EncodeShininess(float shininess);
+float DecodeShininess(float encoded);
+
+// Rounds a [0,1] value the way an UNORM target of the given bit depth stores it
+float QuantizeUnorm(float value, int bits);
+
+// What reading back a gNormal (RG16) texel gives for n
+vec3 RoundTripNormal(const vec3& n);
+
+// uv and depth in [0,1], projectionInverse as uploaded (row-major)
+vec3 ReconstructViewPosition(const vec2& uv, float depth, const MAT4& projectionInverse);
+
+// Round trips directionCount normals spread over the sphere and every
+// 8 bit shininess level, prints the largest errors and returns nonzero
+// if one is over its bound.  Run by -checkgbuffer.
+int CheckGBufferPacking(int directionCount);
+
+#endif
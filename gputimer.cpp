@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////
+// GPU timestamp timer.  See gputimer.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+
+#include "gputimer.h"
+
+GPUTimer::GPUTimer()
+	: writeIndex(0), readIndex(0), initialized(false), recording(false),
+	  lastMs(0.0f), collectedMs(0.0f), averageMs(0.0f)
+{
+	for (int i = 0; i < RingSize; ++i)
+		pending[i] = false;
+}
+
+GPUTimer::~GPUTimer()
+{
+	// The context is usually gone by the time globals are destroyed,
+	// the queries die with it.
+}
+
+void GPUTimer::Initialize()
+{
+	if (initialized)
+		return;
+	glGenQueries(2 * RingSize, queries);
+	initialized = true;
+}
+
+void GPUTimer::Begin()
+{
+	if (!initialized)
+		return;
+
+	// Every slot still in flight: drop this measurement rather than wait
+	Poll();
+	if (pending[writeIndex])
+		return;
+	glQueryCounter(queries[2 * writeIndex], GL_TIMESTAMP);
+	recording = true;
+}
+
+void GPUTimer::End()
+{
+	if (!recording)
+		return;
+	glQueryCounter(queries[2 * writeIndex + 1], GL_TIMESTAMP);
+	pending[writeIndex] = true;
+	recording = false;
+	writeIndex = (writeIndex + 1) % RingSize;
+}
+
+void GPUTimer::Poll()
+{
+	while (initialized && pending[readIndex]) {
+		// The end query finishes last
+		int available = 0;
+		glGetQueryObjectiv(queries[2 * readIndex + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(queries[2 * readIndex], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(queries[2 * readIndex + 1], GL_QUERY_RESULT, &end);
+
+		lastMs = static_cast<float>(end - begin) * 1.0e-6f;
+		averageMs = averageMs == 0.0f ? lastMs : 0.9f * averageMs + 0.1f * lastMs;
+		collectedMs += lastMs;
+
+		pending[readIndex] = false;
+		readIndex = (readIndex + 1) % RingSize;
+	}
+}
+
+float GPUTimer::TakeCollectedMilliseconds()
+{
+	float collected = collectedMs;
+	collectedMs = 0.0f;
+	return collected;
+}
@@ -0,0 +1,50 @@
+///////////////////////////////////////////////////////////////////////
+// Measures GPU time between two points in the command stream with a
+// pair of timestamp queries.  Timestamps (unlike GL_TIME_ELAPSED)
+// may nest, so a whole-frame timer can wrap per-pass timers.
+//
+// Results are read back a few frames late from a small ring of query
+// pairs, so reading a timer never stalls the pipeline.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _GPUTIMER_
+#define _GPUTIMER_
+
+class GPUTimer
+{
+public:
+	GPUTimer();
+	~GPUTimer();
+
+	// Creates the queries, needs a current GL context
+	void Initialize();
+
+	void Begin();
+	void End();
+
+	// Most recent finished measurement and an exponential average
+	float Milliseconds() const { return lastMs; }
+	float AverageMilliseconds() const { return averageMs; }
+
+	// Collects every finished measurement without blocking
+	void Poll();
+
+	// Sum of the measurements collected since the last call
+	float TakeCollectedMilliseconds();
+
+private:
+	static const int RingSize = 4;
+
+	unsigned int queries[2 * RingSize];
+	bool pending[RingSize];
+	int writeIndex;
+	int readIndex;
+	bool initialized;
+	bool recording;
+
+	float lastMs;
+	float collectedMs;
+	float averageMs;
+};
+
+#endif
@@ -0,0 +1,283 @@
+///////////////////////////////////////////////////////////////////////
+// Clustered light assignment.  See lightclusters.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <xmmintrin.h>
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+
+#include "lightclusters.h"
+#include "threadpool.h"
+
+LightClusters::LightClusters()
+	: maxLightsPerCluster(0), nearPlane(0.0f), farPlane(0.0f), scaleX(0.0f), scaleY(0.0f),
+	  rangesBuffer(0), indicesBuffer(0), rangesTexture(0), indicesTexture(0)
+{
+	ranges.assign(2 * ClusterCount, 0);
+	for (int i = 0; i <= ClusterSlices; ++i)
+		sliceDepths[i] = 0.0f;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Builds the view space box of every froxel.  Expects a symmetric
+// projection (see Perspective) and slices depth exponentially between
+// the near and far planes.
+void LightClusters::SetProjection(const MAT4& projection, float front, float back)
+{
+	float sx = 1.0f / projection[0][0];
+	float sy = 1.0f / projection[1][1];
+	if (sx == scaleX && sy == scaleY && front == nearPlane && back == farPlane)
+		return;
+
+	scaleX = sx;
+	scaleY = sy;
+	nearPlane = front;
+	farPlane = back;
+
+	for (int i = 0; i <= ClusterSlices; ++i)
+		sliceDepths[i] = nearPlane * pow(farPlane / nearPlane, float(i) / ClusterSlices);
+
+	minX.resize(ClusterCount); minY.resize(ClusterCount); minZ.resize(ClusterCount);
+	maxX.resize(ClusterCount); maxY.resize(ClusterCount); maxZ.resize(ClusterCount);
+
+	for (int slice = 0; slice < ClusterSlices; ++slice) {
+		float d0 = sliceDepths[slice];
+		float d1 = sliceDepths[slice + 1];
+		for (int y = 0; y < ClusterTilesY; ++y) {
+			float ny0 = 2.0f * y / ClusterTilesY - 1.0f;
+			float ny1 = 2.0f * (y + 1) / ClusterTilesY - 1.0f;
+			for (int x = 0; x < ClusterTilesX; ++x) {
+				float nx0 = 2.0f * x / ClusterTilesX - 1.0f;
+				float nx1 = 2.0f * (x + 1) / ClusterTilesX - 1.0f;
+
+				// The tile's side planes pass through the eye, so the
+				// box corners are on the slice's near or far face
+				int c = (slice * ClusterTilesY + y) * ClusterTilesX + x;
+				minX[c] = std::min(nx0 * sx * d0, nx0 * sx * d1);
+				maxX[c] = std::max(nx1 * sx * d0, nx1 * sx * d1);
+				minY[c] = std::min(ny0 * sy * d0, ny0 * sy * d1);
+				maxY[c] = std::max(ny1 * sy * d0, ny1 * sy * d1);
+				minZ[c] = -d1;
+				maxZ[c] = -d0;
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Moves the lights to view space, bins every slice on its own worker
+// and then concatenates the slices' lists.
+void LightClusters::Build(const vec4* spheres, int lightCount, const MAT4& view, ThreadPool& pool)
+{
+	const int lightsPerBatch = 256;
+	int batchCount = (lightCount + lightsPerBatch - 1) / lightsPerBatch;
+	viewSpheres.resize(lightCount);
+
+	pool.ParallelFor(batchCount, [&](int batch) {
+		int end = std::min(lightCount, (batch + 1) * lightsPerBatch);
+		for (int i = batch * lightsPerBatch; i < end; ++i) {
+			const vec4& s = spheres[i];
+			viewSpheres[i] = vec4(
+				view[0][0] * s.x + view[0][1] * s.y + view[0][2] * s.z + view[0][3],
+				view[1][0] * s.x + view[1][1] * s.y + view[1][2] * s.z + view[1][3],
+				view[2][0] * s.x + view[2][1] * s.y + view[2][2] * s.z + view[2][3],
+				s.w);
+		}
+	});
+
+	pool.ParallelFor(ClusterSlices, [&](int slice) { BinSlice(slice); });
+
+	unsigned int total = 0;
+	for (int slice = 0; slice < ClusterSlices; ++slice) {
+		bins[slice].first = total;
+		total += static_cast<unsigned int>(bins[slice].pairLights.size());
+	}
+	indices.resize(total);
+
+	// Counting sort of each slice's hits by tile, straight into place
+	pool.ParallelFor(ClusterSlices, [&](int slice) {
+		SliceBins& bin = bins[slice];
+		unsigned int* sliceRanges = &ranges[2 * slice * ClusterTileCount];
+		unsigned int next[ClusterTileCount];
+
+		unsigned int offset = bin.first;
+		for (int tile = 0; tile < ClusterTileCount; ++tile) {
+			sliceRanges[2 * tile] = offset;
+			sliceRanges[2 * tile + 1] = bin.counts[tile];
+			next[tile] = offset;
+			offset += bin.counts[tile];
+		}
+		for (unsigned int i = 0; i < bin.pairLights.size(); ++i)
+			indices[next[bin.pairTiles[i]]++] = bin.pairLights[i];
+	});
+
+	maxLightsPerCluster = 0;
+	for (int c = 0; c < ClusterCount; ++c)
+		maxLightsPerCluster = std::max(maxLightsPerCluster, ranges[2 * c + 1]);
+}
+
+void LightClusters::BinSlice(int slice)
+{
+	SliceBins& bin = bins[slice];
+	bin.pairTiles.clear();
+	bin.pairLights.clear();
+	for (int tile = 0; tile < ClusterTileCount; ++tile)
+		bin.counts[tile] = 0;
+
+	float d0 = sliceDepths[slice];
+	float d1 = sliceDepths[slice + 1];
+	int sliceBase = slice * ClusterTileCount;
+
+	for (int i = 0; i < static_cast<int>(viewSpheres.size()); ++i) {
+		const vec4& s = viewSpheres[i];
+		float depth = -s.z;
+		float r = s.w;
+		if (depth + r < d0 || depth - r > d1)
+			continue;
+
+		// Screen tiles the sphere's box covers inside this slice
+		float a = std::max(d0, depth - r);
+		float b = std::min(d1, depth + r);
+		float left = std::min((s.x - r) / (scaleX * a), (s.x - r) / (scaleX * b));
+		float right = std::max((s.x + r) / (scaleX * a), (s.x + r) / (scaleX * b));
+		float bottom = std::min((s.y - r) / (scaleY * a), (s.y - r) / (scaleY * b));
+		float top = std::max((s.y + r) / (scaleY * a), (s.y + r) / (scaleY * b));
+		if (right < -1.0f || left > 1.0f || top < -1.0f || bottom > 1.0f)
+			continue;
+
+		int x0 = std::max(0, static_cast<int>(floor((left + 1.0f) * 0.5f * ClusterTilesX)));
+		int x1 = std::min(ClusterTilesX - 1, static_cast<int>(floor((right + 1.0f) * 0.5f * ClusterTilesX)));
+		int y0 = std::max(0, static_cast<int>(floor((bottom + 1.0f) * 0.5f * ClusterTilesY)));
+		int y1 = std::min(ClusterTilesY - 1, static_cast<int>(floor((top + 1.0f) * 0.5f * ClusterTilesY)));
+
+		// Sphere against four froxel boxes at a time: squared distance
+		// from the center to its clamp into each box
+		__m128 cx = _mm_set1_ps(s.x);
+		__m128 cy = _mm_set1_ps(s.y);
+		__m128 cz = _mm_set1_ps(s.z);
+		__m128 r2 = _mm_set1_ps(r * r);
+
+		for (int y = y0; y <= y1; ++y) {
+			int row = sliceBase + y * ClusterTilesX;
+			for (int x = x0 & ~3; x <= x1; x += 4) {
+				int c = row + x;
+				__m128 dx = _mm_sub_ps(cx, _mm_min_ps(_mm_max_ps(cx, _mm_loadu_ps(&minX[c])), _mm_loadu_ps(&maxX[c])));
+				__m128 dy = _mm_sub_ps(cy, _mm_min_ps(_mm_max_ps(cy, _mm_loadu_ps(&minY[c])), _mm_loadu_ps(&maxY[c])));
+				__m128 dz = _mm_sub_ps(cz, _mm_min_ps(_mm_max_ps(cz, _mm_loadu_ps(&minZ[c])), _mm_loadu_ps(&maxZ[c])));
+				__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				int hits = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+
+				for (int lane = 0; lane < 4; ++lane) {
+					int tx = x + lane;
+					if (!(hits & (1 << lane)) || tx < x0 || tx > x1)
+						continue;
+					unsigned short tile = static_cast<unsigned short>(y * ClusterTilesX + tx);
+					bin.pairTiles.push_back(tile);
+					bin.pairLights.push_back(i);
+					++bin.counts[tile];
+				}
+			}
+		}
+	}
+}
+
+static void CreateBufferTexture(unsigned int& buffer, unsigned int& texture, unsigned int format)
+{
+	glGenBuffers(1, &buffer);
+	glGenTextures(1, &texture);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+// Orphans the old storage, the previous frame may still be reading it
+static void UploadBuffer(unsigned int buffer, const void* data, size_t size)
+{
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, std::max(size, size_t(16)), NULL, GL_STREAM_DRAW);
+	if (size > 0)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+}
+
+void LightClusters::Upload()
+{
+	if (!rangesBuffer) {
+		CreateBufferTexture(rangesBuffer, rangesTexture, GL_RG32UI);
+		CreateBufferTexture(indicesBuffer, indicesTexture, GL_R32UI);
+	}
+
+	UploadBuffer(rangesBuffer, &ranges[0], ranges.size() * sizeof(unsigned int));
+	UploadBuffer(indicesBuffer, indices.empty() ? NULL : &indices[0], indices.size() * sizeof(unsigned int));
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::Bind(unsigned int program, int firstUnit, unsigned int lightsTexture, int screenWidth, int screenHeight, bool enabled)
+{
+	int loc = glGetUniformLocation(program, "ClusteredLightsEnabled");
+	glUniform1i(loc, enabled && rangesBuffer);
+	if (!enabled || !rangesBuffer)
+		return;
+
+	const char* samplers[3] = { "ClusterRanges", "ClusterLightIndices", "ClusterLights" };
+	unsigned int textures[3] = { rangesTexture, indicesTexture, lightsTexture };
+	for (int i = 0; i < 3; ++i) {
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		loc = glGetUniformLocation(program, samplers[i]);
+		glUniform1i(loc, firstUnit + i);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	loc = glGetUniformLocation(program, "ClusterGrid");
+	glUniform3i(loc, ClusterTilesX, ClusterTilesY, ClusterSlices);
+
+	// slice = log(depth/near) * slices/log(far/near)
+	loc = glGetUniformLocation(program, "ClusterDepth");
+	glUniform2f(loc, nearPlane, ClusterSlices / log(farPlane / nearPlane));
+
+	loc = glGetUniformLocation(program, "ClusterScreenSize");
+	glUniform2f(loc, float(screenWidth), float(screenHeight));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Lights are scattered like the scene's random local lights and seen
+// through the default camera.
+void BenchmarkLightClusters(int lightCount, int iterations)
+{
+	lightCount = std::max(lightCount, 0);
+	ThreadPool pool;
+	LightClusters clusters;
+
+	float ry = 0.2f;
+	clusters.SetProjection(Perspective(ry * 4.0f / 3.0f, ry, 0.1f, 1000.0f), 0.1f, 1000.0f);
+	MAT4 view = Translate(0.0f, 0.0f, -150.0f) * Rotate(0, -90.0f) * Rotate(2, -90.0f);
+
+	std::vector<vec4> spheres(lightCount);
+	for (int i = 0; i < lightCount; ++i) {
+		float x = 100.0f * rand() / RAND_MAX - 50.0f;
+		float y = 100.0f * rand() / RAND_MAX - 50.0f;
+		float z = 1.0f + 9.0f * rand() / RAND_MAX;
+		spheres[i] = vec4(x, y, z, 13.0f);
+	}
+
+	// One untimed run to size the buffers
+	const vec4* lights = lightCount > 0 ? &spheres[0] : NULL;
+	clusters.Build(lights, lightCount, view, pool);
+
+	using namespace std::chrono;
+	steady_clock::time_point start = steady_clock::now();
+	for (int i = 0; i < iterations; ++i)
+		clusters.Build(lights, lightCount, view, pool);
+	double ms = duration<double, std::milli>(steady_clock::now() - start).count() / iterations;
+
+	printf("Light clusters: %d lights, %d froxels, %u threads\n", lightCount, ClusterCount, pool.ThreadCount());
+	printf("  %.3f ms per build, %u light references, at most %u lights in a froxel\n",
+		ms, static_cast<unsigned int>(clusters.indices.size()), clusters.maxLightsPerCluster);
+}
@@ -0,0 +1,83 @@
+///////////////////////////////////////////////////////////////////////
+// Clustered light assignment for the forward passes.  The view
+// frustum is cut into froxels: ClusterTilesX x ClusterTilesY screen
+// tiles, each split into ClusterSlices depth slices that get thicker
+// exponentially with distance.  Every frame the worker threads bin
+// the local lights into the froxels their spheres touch (four froxels
+// per SSE test), and the forward shaders find the froxel of a pixel
+// and loop over its lights only (shaders/clusteredLights.glsl).
+//
+// Build is plain CPU work on arrays, so it runs without a GL context;
+// BenchmarkLightClusters times it from the command line.
+//
+// GPU layout, as buffer textures:
+//   ranges   RG32UI   per froxel: first index, light count
+//   indices  R32UI    the froxels' light lists back to back
+// The lights themselves are read from the light store's texture
+// (lightstore.h).
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _LIGHTCLUSTERS_
+#define _LIGHTCLUSTERS_
+
+#include <vector>
+
+#include "transform.h"
+
+class ThreadPool;
+
+const int ClusterTilesX = 16; // a multiple of 4, rows are tested four froxels at a time
+const int ClusterTilesY = 8;
+const int ClusterSlices = 24;
+const int ClusterTileCount = ClusterTilesX * ClusterTilesY;
+const int ClusterCount = ClusterTileCount * ClusterSlices;
+
+class LightClusters
+{
+public:
+	LightClusters();
+
+	// Froxel bounds only change with the projection
+	void SetProjection(const MAT4& projection, float nearPlane, float farPlane);
+
+	// Bins lights (world xyz, range in w) seen through view
+	void Build(const vec4* spheres, int lightCount, const MAT4& view, ThreadPool& pool);
+
+	// GL side: uploads the last Build, then binds the buffer textures
+	// and the light store's lights from firstUnit on for program
+	void Upload();
+	void Bind(unsigned int program, int firstUnit, unsigned int lightsTexture, int screenWidth, int screenHeight, bool enabled);
+
+	// Results of the last Build
+	std::vector<unsigned int> ranges;   // 2 per froxel
+	std::vector<unsigned int> indices;
+	unsigned int maxLightsPerCluster;
+
+private:
+	struct SliceBins {
+		std::vector<unsigned short> pairTiles; // (tile, light) hits in light order
+		std::vector<unsigned int> pairLights;
+		unsigned int counts[ClusterTileCount];
+		unsigned int first;                    // where the slice's lists start in indices
+	};
+
+	void BinSlice(int slice);
+
+	// View space froxel boxes, index = (slice*ClusterTilesY + y)*ClusterTilesX + x
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+	float sliceDepths[ClusterSlices + 1]; // distances in front of the eye
+	float nearPlane, farPlane;
+	float scaleX, scaleY;                 // view x / (depth * ndc x), from the projection
+
+	// Per Build
+	std::vector<vec4> viewSpheres;
+	SliceBins bins[ClusterSlices];
+
+	unsigned int rangesBuffer, indicesBuffer;
+	unsigned int rangesTexture, indicesTexture;
+};
+
+// Times Build over lightCount random lights and prints the result
+void BenchmarkLightClusters(int lightCount, int iterations);
+
+#endif
@@ -0,0 +1,418 @@
+///////////////////////////////////////////////////////////////////////
+// Structure-of-arrays storage for the local lights.  See lightstore.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <emmintrin.h>
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+
+#include "lightstore.h"
+#include "threadpool.h"
+
+static const int HandleSlotBits = 20;
+static const LightHandle HandleSlotMask = (1u << HandleSlotBits) - 1;
+
+// Floats per light in the GPU copies: three RGBA32F texels
+static const int GPULightFloats = 12;
+
+// Every float column, for resizing and moving lights around
+static std::vector<float> LightStore::* const Columns[] = {
+	&LightStore::posX, &LightStore::posY, &LightStore::posZ, &LightStore::radius,
+	&LightStore::colorR, &LightStore::colorG, &LightStore::colorB,
+	&LightStore::attLinear, &LightStore::attQuadratic,
+	&LightStore::baseX, &LightStore::baseY, &LightStore::baseZ,
+	&LightStore::baseR, &LightStore::baseG, &LightStore::baseB,
+	&LightStore::orbitRadius, &LightStore::orbitSpeed,
+	&LightStore::flickerAmount, &LightStore::flickerSpeed,
+	&LightStore::cycleAmount, &LightStore::cycleSpeed,
+	&LightStore::phase
+};
+static const int ColumnCount = sizeof(Columns) / sizeof(Columns[0]);
+
+LightAnimation::LightAnimation()
+	: orbitRadius(0.0f), orbitSpeed(0.0f), flickerAmount(0.0f), flickerSpeed(0.0f),
+	  cycleAmount(0.0f), cycleSpeed(0.0f), phase(0.0f)
+{
+}
+
+LightStore::LightStore()
+	: count(0), region(0), capacity(0), uploadedLights(0)
+{
+	for (int r = 0; r < RegionCount; ++r) {
+		buffers[r] = 0;
+		textures[r] = 0;
+		mapped[r] = NULL;
+		fences[r] = NULL;
+	}
+}
+
+// Columns stay padded to whole groups of four, the padding is zero
+void LightStore::Resize(int size)
+{
+	unsigned int padded = (size + 3) & ~3;
+	if (posX.size() < padded) {
+		for (int c = 0; c < ColumnCount; ++c)
+			(this->*Columns[c]).resize(padded, 0.0f);
+	}
+	handles.resize(size);
+}
+
+// Moves a light to another index and zeroes its old one
+void LightStore::MoveIndex(int from, int to)
+{
+	for (int c = 0; c < ColumnCount; ++c) {
+		std::vector<float>& column = this->*Columns[c];
+		float value = column[from];
+		column[from] = 0.0f;
+		column[to] = value;
+	}
+}
+
+LightHandle LightStore::Add(const vec3& position, float range, const vec3& color, const vec2& attenuation)
+{
+	int slot;
+	if (!freeSlots.empty()) {
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else {
+		slot = static_cast<int>(slotIndex.size());
+		slotIndex.push_back(-1);
+		slotGeneration.push_back(0);
+	}
+
+	int index = count++;
+	Resize(count);
+	slotIndex[slot] = index;
+	handles[index] = (slotGeneration[slot] << HandleSlotBits) | slot;
+
+	posX[index] = baseX[index] = position.x;
+	posY[index] = baseY[index] = position.y;
+	posZ[index] = baseZ[index] = position.z;
+	radius[index] = range;
+	colorR[index] = baseR[index] = color.r;
+	colorG[index] = baseG[index] = color.g;
+	colorB[index] = baseB[index] = color.b;
+	attLinear[index] = attenuation.x;
+	attQuadratic[index] = attenuation.y;
+	SetAnimation(handles[index], LightAnimation());
+
+	MarkDirty(index, index + 1);
+	return handles[index];
+}
+
+////////////////////////////////////////////////////////////////////////
+// The last light moves into the hole, so only its index changes.
+void LightStore::Remove(LightHandle light)
+{
+	int index = Index(light);
+	if (index < 0)
+		return;
+
+	int last = count - 1;
+	MoveIndex(last, index);
+	if (index != last) {
+		handles[index] = handles[last];
+		slotIndex[handles[index] & HandleSlotMask] = index;
+		MarkDirty(index, index + 1);
+	}
+
+	unsigned int slot = light & HandleSlotMask;
+	slotIndex[slot] = -1;
+	++slotGeneration[slot];
+	freeSlots.push_back(slot);
+
+	--count;
+	handles.resize(count);
+}
+
+void LightStore::Clear()
+{
+	while (count > 0)
+		Remove(handles[count - 1]);
+}
+
+int LightStore::Index(LightHandle light) const
+{
+	unsigned int slot = light & HandleSlotMask;
+	if (light == InvalidLight || slot >= slotIndex.size() || slotGeneration[slot] != light >> HandleSlotBits)
+		return -1;
+	return slotIndex[slot];
+}
+
+vec3 LightStore::Position(LightHandle light) const
+{
+	int i = Index(light);
+	return vec3(baseX[i], baseY[i], baseZ[i]);
+}
+
+void LightStore::SetPosition(LightHandle light, const vec3& position)
+{
+	int i = Index(light);
+	posX[i] += position.x - baseX[i];
+	posY[i] += position.y - baseY[i];
+	posZ[i] += position.z - baseZ[i];
+	baseX[i] = position.x;
+	baseY[i] = position.y;
+	baseZ[i] = position.z;
+	MarkDirty(i, i + 1);
+}
+
+vec3 LightStore::Color(LightHandle light) const
+{
+	int i = Index(light);
+	return vec3(baseR[i], baseG[i], baseB[i]);
+}
+
+void LightStore::SetColor(LightHandle light, const vec3& color)
+{
+	int i = Index(light);
+	colorR[i] = baseR[i] = color.r;
+	colorG[i] = baseG[i] = color.g;
+	colorB[i] = baseB[i] = color.b;
+	MarkDirty(i, i + 1);
+}
+
+float LightStore::Radius(LightHandle light) const
+{
+	return radius[Index(light)];
+}
+
+void LightStore::SetRadius(LightHandle light, float range)
+{
+	int i = Index(light);
+	radius[i] = range;
+	MarkDirty(i, i + 1);
+}
+
+vec2 LightStore::Attenuation(LightHandle light) const
+{
+	int i = Index(light);
+	return vec2(attLinear[i], attQuadratic[i]);
+}
+
+void LightStore::SetAnimation(LightHandle light, const LightAnimation& animation)
+{
+	int i = Index(light);
+	orbitRadius[i] = animation.orbitRadius;
+	orbitSpeed[i] = animation.orbitSpeed;
+	flickerAmount[i] = animation.flickerAmount;
+	flickerSpeed[i] = animation.flickerSpeed;
+	cycleAmount[i] = animation.cycleAmount;
+	cycleSpeed[i] = animation.cycleSpeed;
+	phase[i] = animation.phase;
+}
+
+void LightStore::MarkDirty(int begin, int end)
+{
+	Range range = { begin, end };
+	for (int r = 0; r < RegionCount; ++r)
+		dirty[r].push_back(range);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Buffer storage is immutable, so growing means new buffers that have
+// to be written in full.
+void LightStore::Reallocate(int lights)
+{
+	capacity = std::max(capacity, 1024);
+	while (capacity < lights)
+		capacity *= 2;
+	GLsizeiptr size = capacity * GPULightFloats * sizeof(float);
+
+	for (int r = 0; r < RegionCount; ++r) {
+		if (buffers[r]) {
+			glDeleteTextures(1, &textures[r]);
+			glDeleteBuffers(1, &buffers[r]);
+		}
+		if (fences[r]) {
+			glDeleteSync(static_cast<GLsync>(fences[r]));
+			fences[r] = NULL;
+		}
+
+		glGenBuffers(1, &buffers[r]);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[r]);
+		glBufferStorage(GL_TEXTURE_BUFFER, size, NULL, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT);
+		mapped[r] = static_cast<float*>(glMapBufferRange(GL_TEXTURE_BUFFER, 0, size,
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+
+		glGenTextures(1, &textures[r]);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[r]);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[r]);
+
+		dirty[r].clear();
+		Range all = { 0, lights };
+		dirty[r].push_back(all);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightStore::Upload(ThreadPool& pool)
+{
+	uploadedLights = 0;
+	if (count > capacity)
+		Reallocate(count);
+	if (capacity == 0)
+		return;
+
+	region = (region + 1) % RegionCount;
+	std::vector<Range>& ranges = dirty[region];
+	if (ranges.empty())
+		return;
+
+	// Merge the ranges, dropping what lies past the end after removals
+	std::sort(ranges.begin(), ranges.end());
+	std::vector<Range> merged;
+	for (unsigned int i = 0; i < ranges.size(); ++i) {
+		Range range = { ranges[i].begin, std::min(ranges[i].end, count) };
+		if (range.begin >= range.end)
+			continue;
+		if (!merged.empty() && range.begin <= merged.back().end)
+			merged.back().end = std::max(merged.back().end, range.end);
+		else
+			merged.push_back(range);
+	}
+	ranges.clear();
+
+	// This copy was last read three frames ago, so this rarely waits
+	if (fences[region]) {
+		glClientWaitSync(static_cast<GLsync>(fences[region]), GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(static_cast<GLsync>(fences[region]));
+		fences[region] = NULL;
+	}
+
+	std::vector<Range> batches;
+	for (unsigned int i = 0; i < merged.size(); ++i) {
+		for (int begin = merged[i].begin; begin < merged[i].end; begin += LightBatchSize) {
+			Range batch = { begin, std::min(merged[i].end, begin + LightBatchSize) };
+			batches.push_back(batch);
+		}
+		uploadedLights += merged[i].end - merged[i].begin;
+	}
+
+	float* gpu = mapped[region];
+	pool.ParallelFor(static_cast<int>(batches.size()), [&](int b) {
+		for (int i = batches[b].begin; i < batches[b].end; ++i) {
+			float* light = gpu + i * GPULightFloats;
+			light[0] = posX[i];
+			light[1] = posY[i];
+			light[2] = posZ[i];
+			light[3] = radius[i];
+			light[4] = colorR[i];
+			light[5] = colorG[i];
+			light[6] = colorB[i];
+			light[7] = 0.0f;
+			light[8] = attLinear[i];
+			light[9] = attQuadratic[i];
+			light[10] = 0.0f;
+			light[11] = 0.0f;
+		}
+	});
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[region]);
+	for (unsigned int i = 0; i < merged.size(); ++i) {
+		glFlushMappedBufferRange(GL_TEXTURE_BUFFER, merged[i].begin * GPULightFloats * sizeof(float),
+			(merged[i].end - merged[i].begin) * GPULightFloats * sizeof(float));
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightStore::EndFrame()
+{
+	if (capacity == 0)
+		return;
+	if (fences[region])
+		glDeleteSync(static_cast<GLsync>(fences[region]));
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Sine of four angles: wrapped to [-pi, pi], then a parabola refined
+// once, good to about 0.001, plenty for animation.
+static inline __m128 Sin4(__m128 x)
+{
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	__m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.159154943f))));
+	x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(6.28318531f)));
+
+	__m128 y = _mm_mul_ps(x, _mm_sub_ps(_mm_set1_ps(1.27323954f),
+		_mm_mul_ps(_mm_set1_ps(0.405284735f), _mm_andnot_ps(signBit, x))));
+	__m128 absY = _mm_andnot_ps(signBit, y);
+	return _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(0.225f), _mm_sub_ps(_mm_mul_ps(y, absY), y)));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Animation system: four lights per step, whole batches of still
+// lights are skipped and only the batches that moved become dirty.
+void AnimateLights(LightStore& lights, float seconds, ThreadPool& pool)
+{
+	int count = lights.Count();
+	int batchCount = (count + LightBatchSize - 1) / LightBatchSize;
+	std::vector<char> moved(batchCount, 0);
+
+	pool.ParallelFor(batchCount, [&](int batch) {
+		int begin = batch * LightBatchSize;
+		int end = std::min(count, begin + LightBatchSize);
+
+		bool animated = false;
+		for (int i = begin; i < end && !animated; ++i)
+			animated = lights.orbitRadius[i] != 0.0f || lights.flickerAmount[i] != 0.0f || lights.cycleAmount[i] != 0.0f;
+		if (!animated)
+			return;
+		moved[batch] = 1;
+
+		const __m128 t = _mm_set1_ps(seconds);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 quarterTurn = _mm_set1_ps(1.57079633f);
+		const __m128 thirdTurn = _mm_set1_ps(2.09439510f);
+
+		// The columns are padded, so the last group of four may run past count
+		for (int i = begin; i < end; i += 4) {
+			__m128 phase = _mm_loadu_ps(&lights.phase[i]);
+
+			__m128 angle = _mm_add_ps(phase, _mm_mul_ps(t, _mm_loadu_ps(&lights.orbitSpeed[i])));
+			__m128 orbit = _mm_loadu_ps(&lights.orbitRadius[i]);
+			__m128 x = _mm_add_ps(_mm_loadu_ps(&lights.baseX[i]), _mm_mul_ps(orbit, Sin4(_mm_add_ps(angle, quarterTurn))));
+			__m128 y = _mm_add_ps(_mm_loadu_ps(&lights.baseY[i]), _mm_mul_ps(orbit, Sin4(angle)));
+			_mm_storeu_ps(&lights.posX[i], x);
+			_mm_storeu_ps(&lights.posY[i], y);
+			_mm_storeu_ps(&lights.posZ[i], _mm_loadu_ps(&lights.baseZ[i]));
+
+			// 1 - amount * (0.5 + 0.5 sin)
+			__m128 wave = Sin4(_mm_add_ps(phase, _mm_mul_ps(t, _mm_loadu_ps(&lights.flickerSpeed[i]))));
+			__m128 flicker = _mm_sub_ps(one, _mm_mul_ps(_mm_loadu_ps(&lights.flickerAmount[i]),
+				_mm_add_ps(half, _mm_mul_ps(half, wave))));
+
+			// Blend towards a hue that goes around the color wheel
+			__m128 cycle = _mm_loadu_ps(&lights.cycleAmount[i]);
+			__m128 keep = _mm_sub_ps(one, cycle);
+			__m128 hue = _mm_add_ps(phase, _mm_mul_ps(t, _mm_loadu_ps(&lights.cycleSpeed[i])));
+			__m128 r = _mm_add_ps(half, _mm_mul_ps(half, Sin4(hue)));
+			__m128 g = _mm_add_ps(half, _mm_mul_ps(half, Sin4(_mm_add_ps(hue, thirdTurn))));
+			__m128 b = _mm_add_ps(half, _mm_mul_ps(half, Sin4(_mm_sub_ps(hue, thirdTurn))));
+
+			r = _mm_add_ps(_mm_mul_ps(keep, _mm_loadu_ps(&lights.baseR[i])), _mm_mul_ps(cycle, r));
+			g = _mm_add_ps(_mm_mul_ps(keep, _mm_loadu_ps(&lights.baseG[i])), _mm_mul_ps(cycle, g));
+			b = _mm_add_ps(_mm_mul_ps(keep, _mm_loadu_ps(&lights.baseB[i])), _mm_mul_ps(cycle, b));
+			_mm_storeu_ps(&lights.colorR[i], _mm_mul_ps(r, flicker));
+			_mm_storeu_ps(&lights.colorG[i], _mm_mul_ps(g, flicker));
+			_mm_storeu_ps(&lights.colorB[i], _mm_mul_ps(b, flicker));
+		}
+	});
+
+	// Runs of moved batches become one range each
+	for (int batch = 0; batch < batchCount; ) {
+		if (!moved[batch]) {
+			++batch;
+			continue;
+		}
+		int first = batch;
+		while (batch < batchCount && moved[batch])
+			++batch;
+		lights.MarkDirty(first * LightBatchSize, std::min(count, batch * LightBatchSize));
+	}
+}
@@ -0,0 +1,128 @@
+///////////////////////////////////////////////////////////////////////
+// Structure-of-arrays storage for the local lights, sized for about a
+// hundred thousand of them.  Every property is its own float column
+// (padded to a multiple of four lights) so the animation system can
+// run four lights per SSE instruction on the worker threads.
+//
+// Lights are referred to by handles that survive the removal of other
+// lights; an index is only valid until the next Remove.
+//
+// GPU side: the lights are mirrored in a persistently mapped buffer
+// seen as an RGBA32F buffer texture, three texels per light:
+//   position, range
+//   color, 0
+//   attenuation (linear, quadratic), 0, 0
+// Only the index ranges that changed since the copy was last written
+// are rewritten.  The copy is triple buffered, each with its own
+// fence, so a frame never writes what the GPU may still be reading.
+//
+// Systems:
+//   AnimateLights   orbits, flicker and color cycling (in parallel)
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _LIGHTSTORE_
+#define _LIGHTSTORE_
+
+#include <vector>
+
+#include "transform.h"
+
+class ThreadPool;
+
+typedef unsigned int LightHandle;
+const LightHandle InvalidLight = 0xffffffff;
+
+// Lights per worker batch, a multiple of four
+const int LightBatchSize = 256;
+
+// Zero amounts leave a light still
+struct LightAnimation {
+	float orbitRadius, orbitSpeed; // circle around the light's position in the xy plane
+	float flickerAmount, flickerSpeed;
+	float cycleAmount, cycleSpeed; // blend towards a rotating hue
+	float phase;
+
+	LightAnimation();
+};
+
+class LightStore
+{
+public:
+	LightStore();
+
+	LightHandle Add(const vec3& position, float radius, const vec3& color, const vec2& attenuation);
+	void Remove(LightHandle light);
+	void Clear();
+	int Count() const { return count; }
+
+	LightHandle Handle(int index) const { return handles[index]; }
+	int Index(LightHandle light) const;
+	bool Valid(LightHandle light) const { return Index(light) >= 0; }
+
+	// Editing goes to the light's resting values, which animation starts from
+	vec3 Position(LightHandle light) const;
+	void SetPosition(LightHandle light, const vec3& position);
+	vec3 Color(LightHandle light) const;
+	void SetColor(LightHandle light, const vec3& color);
+	float Radius(LightHandle light) const;
+	void SetRadius(LightHandle light, float radius);
+	vec2 Attenuation(LightHandle light) const;
+	void SetAnimation(LightHandle light, const LightAnimation& animation);
+
+	// Lights [begin, end) need to be written to the GPU copies again
+	void MarkDirty(int begin, int end);
+
+	// GL side: brings this frame's copy up to date, then fences it once
+	// the frame's draws are queued
+	void Upload(ThreadPool& pool);
+	void EndFrame();
+	unsigned int Texture() const { return textures[region]; }
+	unsigned int UploadedLights() const { return uploadedLights; }
+
+	// Columns, current (animated) values
+	std::vector<float> posX, posY, posZ, radius;
+	std::vector<float> colorR, colorG, colorB;
+	std::vector<float> attLinear, attQuadratic;
+
+	// Columns, resting values and animation
+	std::vector<float> baseX, baseY, baseZ;
+	std::vector<float> baseR, baseG, baseB;
+	std::vector<float> orbitRadius, orbitSpeed;
+	std::vector<float> flickerAmount, flickerSpeed;
+	std::vector<float> cycleAmount, cycleSpeed;
+	std::vector<float> phase;
+
+private:
+	static const int RegionCount = 3;
+
+	struct Range {
+		int begin, end;
+		bool operator<(const Range& other) const { return begin < other.begin; }
+	};
+
+	void Resize(int size);
+	void MoveIndex(int from, int to);
+	void Reallocate(int lights);
+
+	int count;
+
+	// Handle = generation << HandleSlotBits | slot
+	std::vector<LightHandle> handles; // per index
+	std::vector<int> slotIndex;       // per slot, -1 when free
+	std::vector<unsigned int> slotGeneration;
+	std::vector<int> freeSlots;
+
+	// Per GPU copy
+	std::vector<Range> dirty[RegionCount];
+	unsigned int buffers[RegionCount];
+	unsigned int textures[RegionCount];
+	float* mapped[RegionCount];
+	void* fences[RegionCount];
+	int region;
+	int capacity;
+	unsigned int uploadedLights;
+};
+
+void AnimateLights(LightStore& lights, float seconds, ThreadPool& pool);
+
+#endif
@@ -495,6 +495,37 @@ Sphere::Sphere(const int n)
     MakeVAO();
 }
 
+////////////////////////////////////////////////////////////////////////
+// Generates an icosahedron with its vertices on the unit sphere.
+Icosahedron::Icosahedron()
+{
+    diffuseColor = vec3(0.5, 0.5, 1.0);
+    specularColor = vec3(0.63f, 0.72f, 0.63f);
+    shininess = 0.5f;
+
+	type = SPHERE;
+
+    const float t = (1.0f + sqrt(5.0f))/2.0f;
+    const vec3 corners[12] = {
+        vec3(-1, t, 0), vec3(1, t, 0), vec3(-1, -t, 0), vec3(1, -t, 0),
+        vec3(0, -1, t), vec3(0, 1, t), vec3(0, -1, -t), vec3(0, 1, -t),
+        vec3(t, 0, -1), vec3(t, 0, 1), vec3(-t, 0, -1), vec3(-t, 0, 1) };
+    const int faces[20][3] = {
+        {0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+        {1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+        {3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+        {4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1} };
+
+    for (int i=0;  i<12;  i++) {
+        vec3 n = normalize(corners[i]);
+        Pnt.push_back(vec4(n, 1.0f));
+        Nrm.push_back(n); }
+    for (int i=0;  i<20;  i++)
+        Tri.push_back(ivec3(faces[i][0], faces[i][1], faces[i][2]));
+    ComputeSize();
+    MakeVAO();
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Generates a plane with normals, texture coords, and tangent vectors
 // from an n by n grid of small quads.  A single quad might have been
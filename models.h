@@ -89,6 +89,13 @@ public:
     Sphere(const int n);
 };
 
+// 20 triangles around the unit sphere, the coarsest light volume
+class Icosahedron: public Model
+{
+public:
+    Icosahedron();
+};
+
 class Teapot: public Model
 {
 public:
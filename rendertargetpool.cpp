@@ -0,0 +1,208 @@
+///////////////////////////////////////////////////////////////////////
+// Pooled render targets.  See rendertargetpool.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+#include <GL/freeglut.h>
+
+#include "rendertargetpool.h"
+
+// Free targets older than this (in frames) are deleted
+static const unsigned int RecycleFrames = 120;
+
+RenderTargetDesc::RenderTargetDesc()
+	: width(0), height(0), colorCount(0), filter(GL_NEAREST), depthFormat(0), depthTexture(false)
+{
+	for (int i = 0; i < MaxColorAttachments; ++i)
+		colorFormats[i] = 0;
+}
+
+bool RenderTargetDesc::operator==(const RenderTargetDesc& other) const
+{
+	if (width != other.width || height != other.height || colorCount != other.colorCount
+		|| filter != other.filter || depthFormat != other.depthFormat || depthTexture != other.depthTexture)
+		return false;
+	for (int i = 0; i < colorCount; ++i) {
+		if (colorFormats[i] != other.colorFormats[i])
+			return false;
+	}
+	return true;
+}
+
+// Pixel format glTexImage2D wants next to an internal format (no data is uploaded)
+static unsigned int BaseFormat(unsigned int internalFormat)
+{
+	switch (internalFormat) {
+	case GL_R8: case GL_R16: case GL_R16F: case GL_R32F:
+		return GL_RED;
+	case GL_RG8: case GL_RG16: case GL_RG16F: case GL_RG32F:
+		return GL_RG;
+	case GL_RGB: case GL_RGB8: case GL_RGB16F: case GL_RGB32F: case GL_R11F_G11F_B10F:
+		return GL_RGB;
+	case GL_DEPTH_COMPONENT: case GL_DEPTH_COMPONENT16: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F:
+		return GL_DEPTH_COMPONENT;
+	default:
+		return GL_RGBA;
+	}
+}
+
+static void SetTextureParameters(unsigned int filter)
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+RenderTargetPool::RenderTargetPool()
+	: frame(0), pendingWidth(0), pendingHeight(0), pendingSince(0), resizePending(false)
+{
+}
+
+RenderTarget* RenderTargetPool::Acquire(const RenderTargetDesc& desc)
+{
+	for (unsigned int i = 0; i < targets.size(); ++i) {
+		RenderTarget* target = targets[i];
+		if (!target->inUse && target->desc == desc) {
+			target->inUse = true;
+			target->lastUsedFrame = frame;
+			return target;
+		}
+	}
+
+	RenderTarget* target = Create(desc);
+	targets.push_back(target);
+	return target;
+}
+
+void RenderTargetPool::Release(RenderTarget* target)
+{
+	if (!target)
+		return;
+	target->inUse = false;
+	target->lastUsedFrame = frame;
+}
+
+void RenderTargetPool::Collect()
+{
+	++frame;
+
+	for (unsigned int i = 0; i < targets.size(); ) {
+		RenderTarget* target = targets[i];
+		if (!target->inUse && frame - target->lastUsedFrame > RecycleFrames) {
+			Destroy(target);
+			targets[i] = targets.back();
+			targets.pop_back();
+		}
+		else
+			++i;
+	}
+}
+
+void RenderTargetPool::RequestScreenSize(int width, int height)
+{
+	if (resizePending && width == pendingWidth && height == pendingHeight)
+		return;
+
+	pendingWidth = width;
+	pendingHeight = height;
+	pendingSince = glutGet(GLUT_ELAPSED_TIME);
+	resizePending = true;
+}
+
+bool RenderTargetPool::SettleScreenSize(int& width, int& height)
+{
+	if (!resizePending || glutGet(GLUT_ELAPSED_TIME) - pendingSince < ResizeDebounceMs)
+		return false;
+
+	resizePending = false;
+	width = pendingWidth;
+	height = pendingHeight;
+	return true;
+}
+
+unsigned int RenderTargetPool::FreeCount() const
+{
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < targets.size(); ++i) {
+		if (!targets[i]->inUse)
+			++count;
+	}
+	return count;
+}
+
+RenderTarget* RenderTargetPool::Create(const RenderTargetDesc& desc)
+{
+	RenderTarget* target = new RenderTarget;
+	target->desc = desc;
+	target->inUse = true;
+	target->lastUsedFrame = frame;
+	target->depth = 0;
+
+	glGenFramebuffers(1, &target->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+
+	GLenum drawBuffers[MaxColorAttachments];
+	for (int i = 0; i < MaxColorAttachments; ++i) {
+		target->colors[i] = 0;
+		if (i >= desc.colorCount)
+			continue;
+
+		glGenTextures(1, &target->colors[i]);
+		glBindTexture(GL_TEXTURE_2D, target->colors[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, desc.colorFormats[i], desc.width, desc.height, 0,
+			BaseFormat(desc.colorFormats[i]), GL_FLOAT, NULL);
+		SetTextureParameters(desc.filter);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, target->colors[i], 0);
+		drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+	if (desc.colorCount > 0)
+		glDrawBuffers(desc.colorCount, drawBuffers);
+
+	if (desc.depthFormat && desc.depthTexture) {
+		glGenTextures(1, &target->depth);
+		glBindTexture(GL_TEXTURE_2D, target->depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, desc.depthFormat, desc.width, desc.height, 0,
+			GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		SetTextureParameters(desc.filter);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target->depth, 0);
+	}
+	else if (desc.depthFormat) {
+		glGenRenderbuffers(1, &target->depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, target->depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, desc.depthFormat, desc.width, desc.height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target->depth);
+	}
+
+	int status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		printf("FBO Error: %d\n", status);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return target;
+}
+
+void RenderTargetPool::Destroy(RenderTarget* target)
+{
+	glDeleteFramebuffers(1, &target->fbo);
+	for (int i = 0; i < target->desc.colorCount; ++i)
+		glDeleteTextures(1, &target->colors[i]);
+
+	if (target->desc.depthFormat && target->desc.depthTexture)
+		glDeleteTextures(1, &target->depth);
+	else if (target->desc.depthFormat)
+		glDeleteRenderbuffers(1, &target->depth);
+
+	delete target;
+}
+
+RenderTargetPool& TargetPool()
+{
+	static RenderTargetPool pool;
+	return pool;
+}
@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////
+// A pool of render targets (an FBO with its color textures and
+// optional depth) shared by every FBO in the program.  Targets are
+// looked up by their description -- size, formats, attachments -- so
+// a released target is handed out again to the next matching request
+// instead of being deleted and re-created, e.g. when the window goes
+// back to an earlier size.  Free targets nobody asked for in a while
+// are deleted by Collect.
+//
+// The pool also debounces window resizes: RequestScreenSize records
+// every size the window goes through, SettleScreenSize reports a new
+// size only once it has stopped changing for ResizeDebounceMs.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _RENDERTARGETPOOL_
+#define _RENDERTARGETPOOL_
+
+#include <vector>
+
+const int MaxColorAttachments = 4;
+const int ResizeDebounceMs = 150;
+
+struct RenderTargetDesc
+{
+	RenderTargetDesc();
+
+	int width, height;
+	int colorCount;
+	unsigned int colorFormats[MaxColorAttachments]; // internal formats
+	unsigned int filter;       // GL_NEAREST or GL_LINEAR, all attachments
+	unsigned int depthFormat;  // 0 for no depth
+	bool depthTexture;         // sampleable texture instead of a renderbuffer
+
+	bool operator==(const RenderTargetDesc& other) const;
+	bool operator!=(const RenderTargetDesc& other) const { return !(*this == other); }
+};
+
+struct RenderTarget
+{
+	RenderTargetDesc desc;
+	unsigned int fbo;
+	unsigned int colors[MaxColorAttachments];
+	unsigned int depth;   // texture or renderbuffer, see desc.depthTexture
+	bool inUse;
+	unsigned int lastUsedFrame;
+};
+
+class RenderTargetPool
+{
+public:
+	RenderTargetPool();
+
+	// A free target matching desc, created if there is none
+	RenderTarget* Acquire(const RenderTargetDesc& desc);
+	// Gives a target back for recycling, its objects stay alive
+	void Release(RenderTarget* target);
+
+	// Once per frame: deletes targets that stayed free for a while
+	void Collect();
+
+	void RequestScreenSize(int width, int height);
+	// True (once) when a requested size has settled, with that size
+	bool SettleScreenSize(int& width, int& height);
+
+	// Statistics
+	unsigned int TargetCount() const { return static_cast<unsigned int>(targets.size()); }
+	unsigned int FreeCount() const;
+
+private:
+	RenderTarget* Create(const RenderTargetDesc& desc);
+	void Destroy(RenderTarget* target);
+
+	std::vector<RenderTarget*> targets;
+	unsigned int frame;
+
+	int pendingWidth, pendingHeight;
+	int pendingSince;     // GLUT_ELAPSED_TIME of the last size change
+	bool resizePending;
+};
+
+// The pool every FBO allocates from
+RenderTargetPool& TargetPool();
+
+#endif
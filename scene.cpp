@@ -13,6 +13,8 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include <fstream>
+#include <algorithm>
+#include <chrono>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -22,6 +24,7 @@
 #include <glimg/glimg.h>
  
 #include "scene.h"
+#include "ssaoreference.h"
 
 static MAT4 Identity = MAT4();
 const float PI = 3.14159f;
@@ -35,6 +38,7 @@ const std::string shaderFolderPath = "shaders//";
 const std::string gBufferPassDeferred = "deferredGBuffer";
 const std::string ambientPassDeferred = "deferredAmbient";
 const std::string lightingPassDeferred = "deferredLocalLights";
+const std::string tiledLightingPassDeferred = "deferredTiledLighting";
 
 // PARALLAX
 const std::string lightingPassParallax = "lightingParallaxMapping";
@@ -44,15 +48,27 @@ const std::string lightingPassESM = "lightingSoftShadow";
 const std::string shadowShaderName = "shadow";
 const std::string blurShaderName = "blur";
 const std::string verticalBlurShaderName = "blurVertical";
+const std::string boxBlurShaderName = "blurBox";
+const std::string shadowSATShaderName = "shadowSAT";
 
 // SSAO
 const std::string gBufferPassSSAOName = "gBufferSSAO";
 const std::string ssaoOcclusionValuePassName = "ssaoOcclusionCalculationPass";
 const std::string ssaoOcclusionBlurPassName = "ssaoOcclusionBlurPass";
 const std::string lightingPassSSAO = "lightingSSAO";
+const std::string ssaoDownsamplePassName = "ssaoDownsample";
+const std::string ssaoUpsamplePassName = "ssaoUpsample";
+const std::string ssaoDeinterleavePassName = "ssaoDeinterleave";
+const std::string ssaoDeinterleavedOcclusionPassName = "ssaoDeinterleavedOcclusion";
+const std::string ssaoReinterleavePassName = "ssaoReinterleave";
+const std::string ssaoHorizonPassName = "ssaoHorizon";
+const std::string ssaoTemporalPassName = "ssaoTemporal";
+const std::string ssaoDepthPyramidPassName = "ssaoDepthPyramid";
+const std::string ssaoOcclusionTiledPassName = "ssaoOcclusionTiled";
 
 // UTILITY
 const std::string debuggingShaderName = "debugWindow";
+const std::string upscaleShaderName = "upscale";
 
 ////////////////////////////////////////////////////////////////////////
 // This macro makes it easy to sprinkle checks for OpenGL errors
@@ -65,6 +81,11 @@ const std::string debuggingShaderName = "debugWindow";
 
 #define Sqrt2Pi 2.5066282746310005024157652848110452530069867406099383
 
+////////////////////////////////////////////////////////////////////////
+// Entries in a fixed size array, as an int for loop counters
+template <typename T, int N>
+constexpr int ArrayCount(const T (&)[N]) { return N; }
+
 ////////////////////////////////////////////////////////////////////////
 // A small function to provide a more friendly method of defining
 // colors.  The parameters are hue (0..1: fraction of distance around
@@ -89,13 +110,14 @@ vec3 HSV2RGB(const float h, const float s, const float v)
 }
 
 ////////////////////////////////////////////////////////////////////////
-// Called regularly to update the rotation of the surrounding sphere
-// environment.  Set to rotate once every two minutes.
-float atime = 0.0;
-void animate(int value)
+// Starts or pauses the rotation of the surrounding sphere environment.
+// The clock restarts on resume so the spheres don't jump ahead by the
+// time spent paused.
+void Scene::SetAnimating(bool animating)
 {
-	atime = 360.0f*glutGet(GLUT_ELAPSED_TIME) / 120000.0f;
-	glutPostRedisplay();
+	if (animating && !isAnimating)
+		lastAnimationTick = glutGet(GLUT_ELAPSED_TIME);
+	isAnimating = animating;
 }
 
 void Scene::InitializeLights(int nLights, bool randomized /*= false*/, bool allWhite /*= false*/)
@@ -110,19 +132,47 @@ void Scene::InitializeLights(int nLights, bool randomized /*= false*/, bool allW
 	ambientColor = vec3(0.2f);
 	lightColor = vec3(1.0f, 1.0f, 1.0f);
 
-	for (int i = 0; i < nLights; ++i) {
-		localLights.push_back(LocalLight(randomized, false, allWhite));
-	}
+	for (int i = 0; i < nLights; ++i)
+		AddLight(randomized, allWhite);
+	SetLightIndex(lightIndex);
+}
+
+// Random lights also get a random animation
+void Scene::AddLight(bool randomized, bool allWhite)
+{
+	LocalLight light(randomized, false, allWhite);
+	LightHandle handle = localLights.Add(light.lightPos, light.radius, light.lightColor, light.attenuationVector);
+	if (randomized)
+		localLights.SetAnimation(handle, LocalLight::RandomAnimation());
+}
+
+void Scene::SetLightIndex(const int i)
+{
+	lightIndex = std::max(0, std::min(i, localLights.Count() - 1));
+	selectedLight = localLights.Count() > 0 ? localLights.Handle(lightIndex) : InvalidLight;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Adds random lights or drops the last ones, for trying the light
+// passes with anything from a few to thousands of lights.
+void Scene::SetLightCount(int count)
+{
+	count = std::max(1, count);
+	while (localLights.Count() > count)
+		localLights.Remove(localLights.Handle(localLights.Count() - 1));
+	while (localLights.Count() < count)
+		AddLight(true);
+	SetLightIndex(lightIndex);
 }
 
-// Helper function for creating program
-void CreateProgram(ShaderProgram& program, std::string shaderName) {
+// Helper function for creating program, defines go to the fragment shader
+void CreateProgram(ShaderProgram& program, std::string shaderName, const char* defines = NULL) {
 	program.CreateProgram();
 
 	std::string vertexShader = shaderFolderPath + shaderName + vertexShaderExtension;
 	std::string fragmentShader = shaderFolderPath + shaderName + fragmentShaderExtension;
 	program.CreateShader(vertexShader.c_str(), GL_VERTEX_SHADER);
-	program.CreateShader(fragmentShader.c_str(), GL_FRAGMENT_SHADER);
+	program.CreateShader(fragmentShader.c_str(), GL_FRAGMENT_SHADER, defines);
 
 	glBindAttribLocation(program.program, 0, "vertPosition");
 	glBindAttribLocation(program.program, 1, "vertColor");
@@ -154,10 +204,14 @@ void Scene::InitializeScene()
     drawGround = true;
 	drawShadows = false;
 	drawObject = false;
+	isAnimating = true;
+	animationAngle = 0.0f;
+	lastAnimationTick = glutGet(GLUT_ELAPSED_TIME);
 	isForward = true;
 	isShadowEnabled = false;
 	isSSAOEnabled = true;
 	isSSAOBlurred = false;
+	ssaoSource = &gBufferForSSAO;
 	isNormalMapEnabled = false;
 	drawDebugQuads = false;
 	isParallaxMapEnabled = false;
@@ -181,16 +235,68 @@ void Scene::InitializeScene()
 	blurWidth = 2 * blurHalfWidth;
 	BuildKernelWeightsWithNormalDistribution();
 	//BuildKernelWeights();
-	tempImage.GenerateTexture(1024, 1024, GL_R32F, GL_RED);
+	BuildBoxBlurRadii();
+	shadowBlurFilter = BLUR_WEIGHTED;
+	shadowBlurBenchmarkRequested = false;
+	satCValue = 20.0f;
+	shadowLightSize = 48.0f;
+	shadowMaxFilterRadius = 24;
+	useShadowCascades = false;
+	cascadesRendered = 0;
 	blurImage.GenerateTexture(1024, 1024, GL_R32F, GL_RED);
+	boxBlurTemp.GenerateTexture(1024, 1024, GL_R32F, GL_RED);
+	shadowSAT.GenerateTexture(1024, 1024, GL_RG32F, GL_RG);
 
 	glGenBuffers(1, &uniformBlockIDForBlurring);
+	UploadBlurKernel();
+
+	// Local lights
+	localLightMode = LIGHT_VOLUMES;
+	showTileLightCount = false;
+	localLightMs = 0.0f;
+	localLightTimer.Initialize();
+	animateLights = false;
+	lightTime = 0.0f;
+	lightsUploaded = 0;
+	glGenBuffers(1, &lightBuffer);
+	glGenBuffers(1, &lightInstanceBuffer);
+	for (int lod = 0; lod < LightVolumeLODCount; ++lod)
+		lightLodFirst[lod] = lightLodCounts[lod] = 0;
+	clusteredLighting = false;
+	clusterBuildMs = 0.0f;
+
+	// Command recording
+	threadPool = new ThreadPool();
+	captureFrame = false;
+	frameCapture = NULL;
 
 	// SSAO
 	randomNumbers = std::uniform_real_distribution<GLfloat>(0.0f, 1.0f);
 	BuildSSAOSampleKernel();
 	BuildNoiseForSSAOKernel();
 	ssaoRadius = 1.0f;
+	ssaoKernelSize = 64;
+	ssaoResolution = SSAO_FULL;
+	ssaoDepthSharpness = 50.0f;
+	ssaoBlurRadius = 4;
+	ssaoMs = 0.0f;
+	ssaoTimer.Initialize();
+	ssaoMethod = SSAO_KERNEL;
+	ssaoLayerWidth = ssaoLayerHeight = 0;
+	ssaoUseDepthPyramid = true;
+	ssaoPyramidWidth = ssaoPyramidHeight = 0;
+	ssaoHorizonDirections = 2;
+	ssaoHorizonSteps = 4;
+	ssaoTemporal = false;
+	ssaoTemporalSamples = 16;
+	ssaoTemporalBlend = 0.1f;
+	ssaoFrame = 0;
+	ssaoHistoryIndex = 0;
+	ssaoHistoryValid = false;
+	ssaoStillFrames = 0;
+	ssaoPreviousWidth = ssaoPreviousHeight = 0;
+	ssaoBenchmarkRequested = false;
+	ssaoSaveRequested = false;
 
     // Scene transformation parameters
 	spin = -90.0f;
@@ -212,11 +318,28 @@ void Scene::InitializeScene()
 
 	//gBuffer.CreateFBOForDeferredShading(width, height);
 	gBuffer.CreateFBOForDeferredShading(width, height);
-	shadowBufferObject.CreateFBO(1024, 1024, GL_R32F, GL_RED);
+	shadowBufferObject.CreateFBO(1024, 1024, GL_R32F);
 	gBufferForSSAO.CreateFBOForSSAO(width, height);
 	ssaoFBO.CreateFBOForSSAOColorBuffer(width, height);
 	//ssaoFBO.CreateFBO(width, height, GL_RED, GL_RGB);
 	ssaoBlurFBO.CreateFBOForSSAOColorBuffer(width, height);
+	ssaoBlurTemp.CreateFBOForSSAOColorBuffer(width, height);
+	ssaoHalfDepth.CreateFBO((width + 1) / 2, (height + 1) / 2, GL_R32F);
+	ssaoQuarterDepth.CreateFBO((width + 3) / 4, (height + 3) / 4, GL_R32F);
+	ssaoLowFBO.CreateFBOForSSAOColorBuffer((width + 1) / 2, (height + 1) / 2);
+	ssaoHistory[0].CreateFBO(width, height, GL_RGBA32F);
+	ssaoHistory[1].CreateFBO(width, height, GL_RGBA32F);
+	sceneColor.CreateFBO(width, height, GL_RGBA8);
+	tiledLighting.CreateFBO(width, height, GL_RGBA16F);
+	TargetPool().RequestScreenSize(width, height);
+
+	// Dynamic resolution
+	sceneTimer.Initialize();
+	renderWidth = width;
+	renderHeight = height;
+	upscaling = false;
+	upscaleFilter = 1;
+	renderSizeText[0] = '\0';
 
     // Enable OpenGL depth-testing
     glEnable(GL_DEPTH_TEST);
@@ -228,6 +351,7 @@ void Scene::InitializeScene()
     spherePolygons = new Sphere(32);
     groundPolygons = new Ground(groundRadius, 100);
     SetCentralModel(0);         // Teapot, sphere, or some PLY model, or ...
+	BuildEntities();
 
 	// SHADERS
 	std::string vertexShader, fragmentShader;
@@ -257,6 +381,13 @@ void Scene::InitializeScene()
 	CreateProgram(deferredShaderLocalLightPass, lightingPassDeferred);
 	CHECKERROR;
 
+	// DEFERRED SHADING TILED LIGHTING
+	deferredShaderTiledLightPass.CreateProgram();
+	std::string tiledShader = shaderFolderPath + tiledLightingPassDeferred + computeShaderExtension;
+	deferredShaderTiledLightPass.CreateShader(tiledShader.c_str(), GL_COMPUTE_SHADER);
+	deferredShaderTiledLightPass.LinkProgram();
+	CHECKERROR;
+
 	// DEFERRED AMBIENT FULL SCREEN QUAD
 	fullScreenQuad.Init();
 	fullScreenQuad.LoadToGFX();
@@ -280,11 +411,50 @@ void Scene::InitializeScene()
 
 	gBufferPassForSSAO.LinkProgram();
 
-	//ssao calculate
-	CreateProgram(ssaoOcclusionCalculatePass, ssaoOcclusionValuePassName);
+	//ssao calculate, unrolled for each kernel size
+	for (int i = 0; i < SSAOKernelVariants; ++i) {
+		char defines[32];
+		snprintf(defines, sizeof(defines), "#define KERNEL_SIZE %d", SSAOKernelSizes[i]);
+		CreateProgram(ssaoOcclusionCalculatePasses[i], ssaoOcclusionValuePassName, defines);
+	}
 
 	// ssao blur
-	CreateProgram(ssaoOcclusionBlurPass, ssaoOcclusionBlurPassName);
+	std::string ssaoBlurShader = shaderFolderPath + ssaoOcclusionBlurPassName + computeShaderExtension;
+	ssaoOcclusionBlurPass.CreateProgram();
+	ssaoOcclusionBlurPass.CreateShader(ssaoBlurShader.c_str(), GL_COMPUTE_SHADER);
+	ssaoOcclusionBlurPass.LinkProgram();
+
+	// linear depth pyramid for the kernel taps
+	std::string ssaoPyramidShader = shaderFolderPath + ssaoDepthPyramidPassName + computeShaderExtension;
+	ssaoDepthPyramidPass.CreateProgram();
+	ssaoDepthPyramidPass.CreateShader(ssaoPyramidShader.c_str(), GL_COMPUTE_SHADER);
+	ssaoDepthPyramidPass.LinkProgram();
+
+	// compute ssao on shared memory tiles
+	std::string ssaoTiledShader = shaderFolderPath + ssaoOcclusionTiledPassName + computeShaderExtension;
+	ssaoOcclusionTiledPass.CreateProgram();
+	ssaoOcclusionTiledPass.CreateShader(ssaoTiledShader.c_str(), GL_COMPUTE_SHADER);
+	ssaoOcclusionTiledPass.LinkProgram();
+
+	// low resolution ssao
+	CreateProgram(ssaoDownsamplePass, ssaoDownsamplePassName);
+	CreateProgram(ssaoUpsamplePass, ssaoUpsamplePassName);
+
+	// horizon based ssao
+	CreateProgram(ssaoHorizonPass, ssaoHorizonPassName);
+
+	// temporal ssao
+	CreateProgram(ssaoTemporalPass, ssaoTemporalPassName);
+
+	// deinterleaved ssao
+	ShaderProgram* deinterleavePasses[] = { &ssaoDeinterleavePass, &ssaoDeinterleavedOcclusionPass, &ssaoReinterleavePass };
+	const std::string* deinterleaveNames[] = { &ssaoDeinterleavePassName, &ssaoDeinterleavedOcclusionPassName, &ssaoReinterleavePassName };
+	for (int i = 0; i < 3; ++i) {
+		std::string computeShader = shaderFolderPath + *deinterleaveNames[i] + computeShaderExtension;
+		deinterleavePasses[i]->CreateProgram();
+		deinterleavePasses[i]->CreateShader(computeShader.c_str(), GL_COMPUTE_SHADER);
+		deinterleavePasses[i]->LinkProgram();
+	}
 
 	// Lighting
 	//CreateProgram(lightingShaderSSAO, lightingPassSSAO);
@@ -362,6 +532,24 @@ void Scene::InitializeScene()
 
 	blurShader.LinkProgram();
 
+	// BOX BLUR
+	boxBlurShader.CreateProgram();
+	computeShader = shaderFolderPath + boxBlurShaderName + computeShaderExtension;
+	boxBlurShader.CreateShader(computeShader.c_str(), GL_COMPUTE_SHADER);
+	boxBlurShader.LinkProgram();
+
+	// SUMMED-AREA TABLE
+	shadowSATShader.CreateProgram();
+	computeShader = shaderFolderPath + shadowSATShaderName + computeShaderExtension;
+	shadowSATShader.CreateShader(computeShader.c_str(), GL_COMPUTE_SHADER);
+	shadowSATShader.LinkProgram();
+
+	// CASCADE BLUR, the same kernel over the layers of the cascades
+	cascadeBlurShader.CreateProgram();
+	computeShader = shaderFolderPath + blurShaderName + computeShaderExtension;
+	cascadeBlurShader.CreateShader(computeShader.c_str(), GL_COMPUTE_SHADER, "#define LAYERED");
+	cascadeBlurShader.LinkProgram();
+
 	// BLUR VERTICAL
 	verticalBlurShader.CreateProgram();
 
@@ -374,6 +562,10 @@ void Scene::InitializeScene()
 	CreateProgram(debugging, debuggingShaderName);
 	CHECKERROR;
 
+	// UPSCALE
+	CreateProgram(upscalePass, upscaleShaderName);
+	CHECKERROR;
+
 	//////////////////////////////////////////////////////////////////////
 	// Read a texture and store its id in groundTexture.  Abort
 	// program on error.
@@ -429,12 +621,64 @@ void Scene::SetCentralModel(const int i)
         centralPolygons = new Sphere(32);
         float s = static_cast<float>(3.0/centralPolygons->size);
         centralTr = Rotate(0, 180.0f)*Scale(-s,s,s); }
+
+	// Keep the central entity in sync once the store has been built
+	if (!entities.meshTable.empty()) {
+		entities.SetMesh(centralMesh, centralPolygons);
+		entities.localTransforms[centralEntity] = centralTr;
+		entities.diffuseColors[centralEntity] = centralPolygons->diffuseColor;
+		entities.specularColors[centralEntity] = centralPolygons->specularColor;
+		entities.shininess[centralEntity] = centralPolygons->shininess;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Fills the entity store.  The environment spheres' placement and
+// colors never change, only the animation transform applied on top
+// of them, so they are computed once here.
+void Scene::BuildEntities()
+{
+	entities.Clear();
+	entities.meshTable.clear();
+
+	sphereMesh = entities.AddMesh(spherePolygons);
+	centralMesh = entities.AddMesh(centralPolygons);
+
+	for (int i=0;  i<2*nSpheres;  i+=2) {
+		float u = float(i)/(2*nSpheres);
+
+		for (int j=2;  j<=nSpheres/2;  j+=2) {
+			float v = float(j)/(nSpheres);
+			vec3 color = HSV2RGB(u, 1.0f-2.0f*fabs(v-0.5f), 1.0f);
+
+			float s = 3.0f* sin(v*3.14f);
+			MAT4 M = Rotate(2, 360.0f*u)*Rotate(1, 180.0f*v)
+					 *Translate(0.0f, 0.0f, 30.0f)*Scale(s,s,s) ;
+			entities.Add(M, sphereMesh, color, spherePolygons->specularColor, spherePolygons->shininess,
+				ENTITY_VISIBLE | ENTITY_ANIMATED | ENTITY_ENVIRONMENT);
+		}
+	}
+
+	centralEntity = entities.Add(centralTr, centralMesh, centralPolygons->diffuseColor,
+		centralPolygons->specularColor, centralPolygons->shininess, ENTITY_VISIBLE | ENTITY_CENTRAL);
 }
 
 ////////////////////////////////////////////////////////////////////////
 // Procedure DrawScene is called whenever the scene needs to be drawn.
 void Scene::DrawScene()
 {
+	// Screen-sized targets follow the window once it stopped resizing;
+	// until then the frame renders at the old size and is upscaled
+	int targetWidth, targetHeight;
+	if (TargetPool().SettleScreenSize(targetWidth, targetHeight))
+		ResizeTargets(targetWidth, targetHeight);
+	TargetPool().Collect();
+
+	if (captureFrame) {
+		frameCapture = new std::ofstream("frame.capture", std::ios_base::binary);
+		printf("Capturing frame to frame.capture\n");
+	}
+
 	// Calculate the light's position.
 	lightPosition = vec3(lightDist*cos(lightSpin*rad)*sin(lightTilt*rad),
 		lightDist*sin(lightSpin*rad)*sin(lightTilt*rad),
@@ -465,23 +709,68 @@ void Scene::DrawScene()
 		}
 	}
 
-	SphereModelTr = Rotate(2, atime);
+	// Rotate once every two minutes
+	int tick = glutGet(GLUT_ELAPSED_TIME);
+	if (isAnimating && drawSpheres)
+		animationAngle = fmod(animationAngle + 360.0f*(tick - lastAnimationTick) / 120000.0f, 360.0f);
+	if (animateLights)
+		lightTime += (tick - lastAnimationTick) / 1000.0f;
+	lastAnimationTick = tick;
+
+	SphereModelTr = Rotate(2, animationAngle);
 	SunModelTr = Translate(lightPosition);
+
+	UpdateEntityTransforms(entities, SphereModelTr, *threadPool);
+	viewFrustum = Frustum::FromMatrix(WorldProj * WorldView);
+
+	UpdateLights();
+	if (isForward)
+		UpdateLightClusters();
+
+	// Internal resolution for this frame, capped by what the targets hold
+	renderWidth = std::min(resolution.ScaledWidth(width), sceneColor.width);
+	renderHeight = std::min(resolution.ScaledHeight(height), sceneColor.height);
+	upscaling = renderWidth != width || renderHeight != height;
+	glViewport(0, 0, renderWidth, renderHeight);
+	snprintf(renderSizeText, sizeof(renderSizeText), "%dx%d", renderWidth, renderHeight);
+
+	sceneTimer.Begin();
 	if (isForward)
 		ForwardShading();
 	else
 		DeferredShading();
+	sceneTimer.End();
+
+	UpscalePass();
+	localLights.EndFrame();
 
-	// After all drawing, schedule a call to the animate procedure in 10 ms.
-	glutTimerFunc(10, animate, 1);
+	// Measurements arrive a few frames late, adjust when one does
+	sceneTimer.Poll();
+	if (sceneTimer.TakeCollectedMilliseconds() > 0.0f)
+		resolution.Update(sceneTimer.Milliseconds());
 
+	if (frameCapture) {
+		frameCapture->close();
+		delete frameCapture;
+		frameCapture = NULL;
+		captureFrame = false;
+	}
 }
 
 void Scene::ForwardShading()
 {
 
-	if (isShadowEnabled) {
+	if (isShadowEnabled && useShadowCascades) {
+		DrawShadowCascades();
+		BlurShadowCascades();
+		DrawLightingWithShadows();
+	}
+	else if (isShadowEnabled) {
 		DrawShadows();
+		if (shadowBlurBenchmarkRequested) {
+			BenchmarkShadowBlur();
+			shadowBlurBenchmarkRequested = false;
+		}
 		BlurPass();
 		DrawLightingWithShadows();
 	}
@@ -489,9 +778,17 @@ void Scene::ForwardShading()
 		DrawLightingParallaxMapping();
 	}
 	else {
+		UseSSAOSource(gBufferForSSAO);
 		SSAOGeometryPass();
+		if (ssaoBenchmarkRequested) {
+			BenchmarkSSAO();
+			ssaoBenchmarkRequested = false;
+		}
 		SSAOOcclusionCalculatePass();
-		//SSAOOcclusionBlurPass();
+		if (ssaoSaveRequested) {
+			SaveSSAOBuffers();
+			ssaoSaveRequested = false;
+		}
 		DrawLightingSSAO();
 	}
 
@@ -500,8 +797,22 @@ void Scene::ForwardShading()
 void Scene::DeferredShading()
 {
 	DeferredShadingGeometryPass();
+	// AO straight from the deferred gBuffer; the ambient term applies it
+	if (isSSAOEnabled) {
+		UseSSAOSource(gBuffer);
+		SSAOOcclusionCalculatePass();
+	}
+	DeferredShadingLightingPass();
+}
 
-	//DeferredShadingLightingPass();
+////////////////////////////////////////////////////////////////////////
+// Points the SSAO passes at a gBuffer.  The AO history was built from
+// the other one, so a switch drops it.
+void Scene::UseSSAOSource(FBO& source)
+{
+	if (ssaoSource != &source)
+		ssaoHistoryValid = false;
+	ssaoSource = &source;
 }
 
 void Scene::BuildKernelWeights()
@@ -551,18 +862,18 @@ float Scene::NormalDistribution(float value, float mean, float deviation)
 	return std::exp(-valueSquared / (2.0f * variance)) / (Sqrt2Pi * deviation);
 }
 
-void Scene::BuildKernelWeightsWithNormalDistribution()
+void Scene::BuildKernelWeightsWithNormalDistribution(float deviation)
 {
 	float total = 0.0f;
 	float current;
 
 	for (int i = 0; i < blurHalfWidth; ++i) {
-		current = NormalDistribution(float(blurHalfWidth - i), 0.0f, 2.0f);
+		current = NormalDistribution(float(blurHalfWidth - i), 0.0f, deviation);
 		blurWeightArray[i] = blurWeightArray[(blurWidth - i)] = current;
 		total += 2.0f * current;
 	}
 
-	blurWeightArray[blurHalfWidth] = NormalDistribution(0.0f, 0.0f, 2.0f);
+	blurWeightArray[blurHalfWidth] = NormalDistribution(0.0f, 0.0f, deviation);
 	total += blurWeightArray[blurHalfWidth];
 
 	// Normalize the values so that they sum to 1
@@ -572,112 +883,80 @@ void Scene::BuildKernelWeightsWithNormalDistribution()
 	}
 }
 
-void Scene::BuildSSAOSampleKernel()
+////////////////////////////////////////////////////////////////////////
+// Radii of the three boxes whose cascade has the variance of
+// blurWeightArray (Kovesi, "Fast almost-Gaussian filtering").  A box of
+// width w has variance (w^2 - 1) / 12: the boxes take the odd widths
+// just below and above the ideal one, as many of each as lands closest.
+void Scene::BuildBoxBlurRadii()
 {
-	for (unsigned int i = 0; i < MAX_SAMPLE_VALUES_SSAO; ++i) {
-		float scale = static_cast<float>(i) / static_cast<float>(MAX_SAMPLE_VALUES_SSAO);
-		vec3 v;
-		v.x = 2.0f * (float)rand() / RAND_MAX - 1.0f;
-		v.y = 2.0f * (float)rand() / RAND_MAX - 1.0f;
-		v.z = 2.0f * (float)rand() / RAND_MAX - 1.0f;
-
-		// closer to the origin
-		v *= (0.1f + 0.9f * scale * scale);
-
-		ssaoKernel[i] = v;
+	const int boxes = 3;
+	float variance = 0.0f;
+	for (int i = 0; i <= blurWidth; ++i)
+		variance += blurWeightArray[i] * float((i - blurHalfWidth) * (i - blurHalfWidth));
+
+	int lower = int(std::sqrt(12.0f * variance / boxes + 1.0f));
+	if (lower % 2 == 0)
+		--lower;
+	lower = std::max(lower, 1);
+	int upper = lower + 2;
+	float ideal = (12.0f * variance - boxes * lower * lower - 4.0f * boxes * lower - 3.0f * boxes) / (-4.0f * lower - 4.0f);
+	int lowerCount = std::min(std::max(int(std::floor(ideal + 0.5f)), 0), boxes);
+
+	int reach = 0;
+	for (int i = 0; i < boxes; ++i) {
+		boxBlurRadii[i] = ((i < lowerCount ? lower : upper) - 1) / 2;
+		reach += boxBlurRadii[i];
 	}
+	// blurBox.comp extends its lines by at most MAX_BLUR_WIDTH
+	for (int i = boxes - 1; reach > MAX_BLUR_WIDTH; i = (i + boxes - 1) % boxes)
+		if (boxBlurRadii[i] > 0) {
+			--boxBlurRadii[i];
+			--reach;
+		}
+}
+
+void Scene::BuildSSAOSampleKernel()
+{
+	// Shared with the CPU reference so both sample the same points
+	BuildSSAOKernel(ssaoKernel);
 }
 
 void Scene::BuildNoiseForSSAOKernel()
 {
 	// We use this to introduce some randomness for better results
 	// Otherwise we need a lot more sampling to make it look realistic
-	GLfloat x, y;
-	float arraySize = NOISE_SIZE * NOISE_SIZE;
-	for (GLuint i = 0; i < arraySize; ++i) { //16 = 4 x 4 array of vectors
-		x = randomNumbers(randomNumberGenerator) * 2.0f - 1.0f;
-		y = randomNumbers(randomNumberGenerator) * 2.0f - 1.0f;
-		ssaoNoise.push_back(vec3(x, y, 0.0f)); // z = 0 because this is oriented in tangent space and we're rotating around z
-	}
+	ssaoNoise.resize(NOISE_SIZE * NOISE_SIZE);
+	BuildSSAONoise(&ssaoNoise[0]);
 
 	ssaoNoiseTexture.GenerateTextureForSSAONoise(&ssaoNoise[0]);
 }
 
 ////////////////////////////////////////////////////////////////////////
-// A small helper function to draw a model after settings its lighting
-// and modeling parameters.
-void Scene::DrawModel(const int program, Model* m)
+// Replays the first count lists in order on the GL thread, writing
+// them to the frame capture as well if one is in progress.
+void Scene::ReplayCommandLists(std::vector<CommandList>& lists, int count)
 {
-	int loc;
-	loc = glGetUniformLocation(program, "ModelMatrix");
-	glUniformMatrix4fv(loc, 1, GL_TRUE, centralTr.Pntr());
-
-	//This is the N parameter used in lighting calculation
-	loc = glGetUniformLocation(program, "NormalMatrix");
-	glUniformMatrix4fv(loc, 1, GL_FALSE, centralTr.inverse().Pntr());
-
-	//Material properties
-	//Kd = diffuse constant
-	loc = glGetUniformLocation(program, "diffuse");
-	glUniform3fv(loc, 1, &m->diffuseColor[0]);
-
-	//Ks = specular constant
-	loc = glGetUniformLocation(program, "specular");
-	glUniform3fv(loc, 1, &m->specularColor[0]);
-
-	//shininess - the one used in Phong equation (0..infinite, infinite being mirror-like)
-	loc = glGetUniformLocation(program, "shininess;");
-	glUniform1f(loc, m->shininess);
-
-	loc = glGetUniformLocation(program, "isTextured");
-	glUniform1i(loc, false);
-
-	m->DrawVAO();
+	for (int i = 0; i < count; ++i) {
+		if (frameCapture)
+			lists[i].Serialize(*frameCapture);
+		ReplayGL(lists[i]);
+	}
 }
 
-
 ////////////////////////////////////////////////////////////////////////
-// A small helper function for DrawScene to draw all the environment
-// spheres.
-void Scene::DrawSpheres(unsigned int program)
+// Draws every entity carrying the bits of flagMask (e.g. the
+// environment spheres or the central model).  The entities are
+// culled and recorded into command lists on the worker threads, then
+// the lists are replayed in order.  Pass a NULL frustum for passes
+// that don't look through the camera.
+void Scene::DrawEntities(unsigned int program, unsigned int flagMask, const Frustum* frustum)
 {
     CHECKERROR;
-    float t = 1.0;
-    float s = 200.0;
-    
-    int loc;
+	int listCount = RecordEntityDraws(entities, flagMask, frustum, *threadPool, entityCommands);
+	ReplayCommandLists(entityCommands, listCount);
 
-	loc = glGetUniformLocation(program, "specular");
-	glUniform3fv(loc, 1, &spherePolygons->specularColor[0]);
-
-	loc = glGetUniformLocation(program, "shininess");
-	glUniform1f(loc, spherePolygons->shininess);
-
-    for (int i=0;  i<2*nSpheres;  i+=2) {
-        float u = float(i)/(2*nSpheres);
-
-        for (int j=2;  j<=nSpheres/2;  j+=2) {
-            float v = float(j)/(nSpheres);
-            vec3 color = HSV2RGB(u, 1.0f-2.0f*fabs(v-0.5f), 1.0f);
-
-            float s = 3.0f* sin(v*3.14f);
-            MAT4 M = SphereModelTr*Rotate(2, 360.0f*u)*Rotate(1, 180.0f*v)
-                     *Translate(0.0f, 0.0f, 30.0f)*Scale(s,s,s) ;
-            loc = glGetUniformLocation(program, "ModelMatrix");
-            glUniformMatrix4fv(loc, 1, GL_TRUE, M.Pntr());
-            
-            loc = glGetUniformLocation(program, "NormalMatrix");
-            glUniformMatrix4fv(loc, 1, GL_FALSE, M.inverse().Pntr());
-
-            loc = glGetUniformLocation(program, "diffuse");
-            glUniform3fv(loc, 1, &color[0]);
-
-			loc = glGetUniformLocation(program, "isTextured");
-			glUniform1i(loc, false);
-
-            spherePolygons->DrawVAO(); } }
-
-	loc = glGetUniformLocation(program, "ModelMatrix");
+	int loc = glGetUniformLocation(program, "ModelMatrix");
 	glUniformMatrix4fv(loc, 1, GL_TRUE, Identity.Pntr());
 	loc = glGetUniformLocation(program, "NormalMatrix");
 	glUniformMatrix4fv(loc, 1, GL_FALSE, Identity.Pntr());
@@ -812,7 +1091,7 @@ void Scene::DeferredShadingGeometryPass()
 	gBuffer.Bind();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-	glViewport(0, 0, width, height);
+	glViewport(0, 0, renderWidth, renderHeight);
 	glEnable(GL_DEPTH_TEST);
 
 	// Use lighting pass shader
@@ -827,28 +1106,44 @@ void Scene::DeferredShadingGeometryPass()
 
 	// Draw the scene objects.
 
-	if (drawSpheres) DrawSpheres(program);
+	if (drawSpheres) DrawEntities(program, ENTITY_ENVIRONMENT, &viewFrustum);
 	DrawSun(program);
 	if (drawGround) DrawGround(program);
-	DrawModel(program, centralPolygons);
+	DrawEntities(program, ENTITY_CENTRAL, &viewFrustum);
 	CHECKERROR;
 
 	gBuffer.Unbind();
 	groundTexture.Unbind();
 	// Done with shader program
 	deferredShaderGBufferPass.Unuse();
+}
+
+void Scene::DeferredShadingLightingPass()
+{
+	BindOutputTarget();
+
+	localLightTimer.Begin();
+	if (localLightMode == TILED_COMPUTE)
+		DrawLocalLightsTiled();
+	else {
+		DeferredShadingAmbientPass();
+		DrawLocalLights();
+	}
+	localLightTimer.End();
+
+	localLightTimer.Poll();
+	if (localLightTimer.TakeCollectedMilliseconds() > 0.0f)
+		localLightMs = localLightTimer.AverageMilliseconds();
 
 	debugging.Use();
-	program = debugging.program;
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
+	int program = debugging.program;
 	MAT4 DebugMatrix = Translate(0.65f, 0.65f, 0.5f) * Scale(0.3f, 0.3f, 0.3f);
 	int location = glGetUniformLocation(program, "DebugMatrix");
 	glUniformMatrix4fv(location, 1, GL_TRUE, DebugMatrix.Pntr());
 
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, gBuffer.gPosition);
-	loc = glGetUniformLocation(program, "fboToDebug");
+	glBindTexture(GL_TEXTURE_2D, gBuffer.gNormal);
+	int loc = glGetUniformLocation(program, "fboToDebug");
 	glUniform1i(loc, 1);
 
 	fullScreenQuad.Draw();
@@ -856,12 +1151,6 @@ void Scene::DeferredShadingGeometryPass()
 	debugging.Unuse();
 }
 
-void Scene::DeferredShadingLightingPass()
-{
-	DeferredShadingAmbientPass();
-	DrawLocalLights();
-}
-
 
 void Scene::DrawShadows()
 {
@@ -896,18 +1185,127 @@ void Scene::DrawShadows()
 	loc = glGetUniformLocation(program, "lightDistance");
 	glUniform1f(loc, lightDist);
 
+	loc = glGetUniformLocation(program, "Orthographic");
+	glUniform1i(loc, 0);
+
 	//Draw geo
-	if (drawSpheres) DrawSpheres(program);
+	if (drawSpheres) DrawEntities(program, ENTITY_ENVIRONMENT, NULL);
 	if (drawGround) DrawGround(program); 
-	DrawModel(program, centralPolygons);
+	DrawEntities(program, ENTITY_CENTRAL, NULL);
 	DrawSun(program);
 
  	shadowBufferObject.Unbind();
 	shadowShader.Unuse();
 }
 
+////////////////////////////////////////////////////////////////////////
+// Renders the cascades due this frame (see shadowcascades.h), the sun
+// taken as a directional light toward lightDir.  The shadow shader
+// writes the linear depth of the orthographic projections.
+void Scene::DrawShadowCascades()
+{
+	cascades.Validate();
+	cascadesRendered = cascades.Fit(WorldView, rx, ry, front, lightDir - lightPosition, vec3(0.0f), groundRadius);
+
+	int program = shadowShader.program;
+
+	shadowShader.Use();
+
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+
+	int loc = glGetUniformLocation(program, "C");
+	glUniform1f(loc, esmCValue);
+	loc = glGetUniformLocation(program, "Orthographic");
+	glUniform1i(loc, 1);
+
+	// Cleared to the far end of the depth range
+	float farValue = exp(esmCValue);
+	glClearColor(farValue, farValue, farValue, 1.0f);
+	for (int i = 0; i < cascades.count; ++i) {
+		if (!(cascadesRendered & (1u << i)))
+			continue;
+		cascades.BindLayer(i);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		loc = glGetUniformLocation(program, "LightViewMatrix");
+		glUniformMatrix4fv(loc, 1, GL_TRUE, cascades.lightView[i].Pntr());
+		loc = glGetUniformLocation(program, "LightProjectionMatrix");
+		glUniformMatrix4fv(loc, 1, GL_TRUE, cascades.lightProjection[i].Pntr());
+
+		if (drawSpheres) DrawEntities(program, ENTITY_ENVIRONMENT, NULL);
+		if (drawGround) DrawGround(program);
+		DrawEntities(program, ENTITY_CENTRAL, NULL);
+	}
+	cascades.Unbind();
+	CHECKERROR;
+
+	shadowShader.Unuse();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Blurs the cascades just rendered, all in one dispatch of blur.comp
+// built with LAYERED: a slice of work groups per rendered layer, as
+// many as the largest of them needs.
+void Scene::BlurShadowCascades()
+{
+	const int stripWidth = 64, segmentHeight = 256; // STRIP and SEGMENT in the shader
+	int layers[MaxShadowCascades];
+	int layerCount = 0, largest = 0;
+	for (int i = 0; i < cascades.count; ++i) {
+		if (cascadesRendered & (1u << i)) {
+			layers[layerCount++] = i;
+			largest = std::max(largest, cascades.resolution[i]);
+		}
+	}
+	if (layerCount == 0)
+		return;
+
+	int program = cascadeBlurShader.program;
+	cascadeBlurShader.Use();
+
+	int loc = glGetUniformLocation(program, "BlurHalfWidth");
+	glUniform1i(loc, blurHalfWidth);
+	loc = glGetUniformLocation(program, "BlurWidth");
+	glUniform1i(loc, blurWidth);
+	loc = glGetUniformLocation(program, "CascadeResolution");
+	glUniform1iv(loc, MaxShadowCascades, cascades.resolution);
+	loc = glGetUniformLocation(program, "Layers");
+	glUniform1iv(loc, layerCount, layers);
+
+	loc = glGetUniformBlockIndex(program, "Kernel");
+	glUniformBlockBinding(program, loc, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBlockIDForBlurring);
+
+	glBindImageTexture(0, cascades.shadowArray, 0, GL_TRUE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, cascades.blurredArray, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+
+	glDispatchCompute((largest + stripWidth - 1) / stripWidth, (largest + segmentHeight - 1) / segmentHeight, layerCount);
+	// The lighting pass samples the result
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	CHECKERROR;
+
+	cascadeBlurShader.Unuse();
+}
+
 void Scene::BlurPass()
 {
+	if (shadowBlurFilter == BLUR_BOXES)
+		BoxBlurPass();
+	else if (shadowBlurFilter == BLUR_SUMMED_AREA_TABLE)
+		BuildShadowSAT();
+	else
+		WeightedBlurPass();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Blurs the shadow map into blurImage in one dispatch
+// (shaders/blur.comp), a work group per strip of 64 columns by 256
+// rows.  The weights live in the Kernel block, uploaded by
+// UploadBlurKernel when they change.
+void Scene::WeightedBlurPass()
+{
+	const int stripWidth = 64, segmentHeight = 256; // STRIP and SEGMENT in the shader
 	int program = blurShader.program;
 
 	blurShader.Use();
@@ -918,49 +1316,162 @@ void Scene::BlurPass()
 	loc = glGetUniformLocation(program, "BlurWidth");
 	glUniform1i(loc, blurWidth);
 
-	// Sending calculated weights
 	loc = glGetUniformBlockIndex(program, "Kernel");
 	glUniformBlockBinding(program, loc, 0);
 	glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniformBlockIDForBlurring);
-	glBufferData(GL_UNIFORM_BUFFER, (MAX_BLUR_WIDTH + 1) * sizeof(float), blurWeightArray, GL_STATIC_DRAW);
+
+	// Input - output images
+	glBindImageTexture(0, shadowBufferObject.texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, blurImage.textureId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+	glDispatchCompute((shadowBufferObject.width + stripWidth - 1) / stripWidth,
+		(shadowBufferObject.height + segmentHeight - 1) / segmentHeight, 1);
+	// The lighting pass samples the result
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	CHECKERROR;
+
+	blurShader.Unuse();
+}
+
+////////////////////////////////////////////////////////////////////////
+// The same blur from three box filters (shaders/blurBox.comp), a work
+// group per line: the rows into boxBlurTemp, then its columns into
+// blurImage.  A box needs its whole line for the running sums, so the
+// passes stay separate rather than sharing a strip like blur.comp.
+void Scene::BoxBlurPass()
+{
+	int program = boxBlurShader.program;
+
+	boxBlurShader.Use();
+
+	int loc = glGetUniformLocation(program, "BoxRadii");
+	glUniform3iv(loc, 1, boxBlurRadii);
 
 	ivec2 direction(1, 0);
 	loc = glGetUniformLocation(program, "Direction");
 	glUniform2iv(loc, 1, &direction[0]);
+	glBindImageTexture(0, shadowBufferObject.texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, boxBlurTemp.textureId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute(shadowBufferObject.height, 1, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	direction = ivec2(0, 1);
+	glUniform2iv(loc, 1, &direction[0]);
+	glBindImageTexture(0, boxBlurTemp.textureId, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, blurImage.textureId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute(shadowBufferObject.width, 1, 1);
+	// The lighting pass samples the result
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	CHECKERROR;
+
+	boxBlurShader.Unuse();
+}
 
-	// Sending input - output images
-	int imageUnit = 0;
+////////////////////////////////////////////////////////////////////////
+// Summed-area table of the shadow map (shaders/shadowSAT.comp): the
+// rows, then the columns in place.  Nothing is blurred here; the
+// lighting pass filters each pixel over its own rectangle.
+void Scene::BuildShadowSAT()
+{
+	int program = shadowSATShader.program;
 
-	// Input
-	loc = glGetUniformLocation(program, "OriginalShadowMap");
-	glBindImageTexture(imageUnit, shadowBufferObject.texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
-	++imageUnit;
-	//Output
-	loc = glGetUniformLocation(program, "BlurredShadowMap");
-	glBindImageTexture(imageUnit, tempImage.textureId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	shadowSATShader.Use();
 
-	glDispatchCompute(shadowBufferObject.width / 128, shadowBufferObject.height, 1);
+	int loc = glGetUniformLocation(program, "C");
+	glUniform1f(loc, esmCValue);
+	loc = glGetUniformLocation(program, "SATC");
+	glUniform1f(loc, satCValue);
 
-	direction = ivec2(0, 1);
+	glBindImageTexture(0, shadowBufferObject.texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, shadowSAT.textureId, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
+
+	ivec2 direction(1, 0);
 	loc = glGetUniformLocation(program, "Direction");
 	glUniform2iv(loc, 1, &direction[0]);
-	imageUnit = 0;
-	// Input
-	loc = glGetUniformLocation(program, "OriginalShadowMap");
-	glBindImageTexture(imageUnit, tempImage.textureId, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
-	++imageUnit;
-	//Output
-	loc = glGetUniformLocation(program, "BlurredShadowMap");
-	glBindImageTexture(imageUnit, blurImage.textureId, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
-	glDispatchCompute(shadowBufferObject.width / 128, shadowBufferObject.height, 1);
-	blurShader.Unuse();
+	int firstPassLoc = glGetUniformLocation(program, "FirstPass");
+	glUniform1i(firstPassLoc, 1);
+	glDispatchCompute(shadowBufferObject.height, 1, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	direction = ivec2(0, 1);
+	glUniform2iv(loc, 1, &direction[0]);
+	glUniform1i(firstPassLoc, 0);
+	glDispatchCompute(shadowBufferObject.width, 1, 1);
+	// The lighting pass fetches the table
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	CHECKERROR;
+
+	shadowSATShader.Unuse();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Times the filters at blur widths from 8 to MAX_BLUR_WIDTH, each
+// width with a Gaussian of deviation halfWidth / 2 (as BuildKernelWeights
+// uses) so the two filters blur alike.  Restores the weights after.
+// Building the summed-area table does not depend on the width; it is
+// timed alongside for comparison.
+void Scene::BenchmarkShadowBlur()
+{
+	const int widths[] = { 8, 16, 32, 48, 64, 80, MAX_BLUR_WIDTH };
+	const int runs = 10;
+	ShadowBlurFilter savedFilter = shadowBlurFilter;
+	int savedHalfWidth = blurHalfWidth;
+
+	GLuint query;
+	glGenQueries(1, &query);
+
+	printf("Shadow blur benchmark, %dx%d, ms per blur over %d runs\n", shadowBufferObject.width, shadowBufferObject.height, runs);
+	printf("  width  weighted       boxes  table  box radii\n");
+	for (int w = 0; w < ArrayCount(widths); ++w) {
+		blurHalfWidth = widths[w] / 2;
+		blurWidth = 2 * blurHalfWidth;
+		BuildKernelWeightsWithNormalDistribution(blurHalfWidth / 2.0f);
+		BuildBoxBlurRadii();
+		UploadBlurKernel();
+
+		const ShadowBlurFilter filters[] = { BLUR_WEIGHTED, BLUR_BOXES, BLUR_SUMMED_AREA_TABLE };
+		float ms[3];
+		for (int f = 0; f < 3; ++f) {
+			shadowBlurFilter = filters[f];
+			for (int run = -1; run < runs; ++run) { // run -1 warms up untimed
+				if (run == 0)
+					glBeginQuery(GL_TIME_ELAPSED, query);
+				BlurPass();
+			}
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+			ms[f] = float(ns) / 1.0e6f / runs;
+		}
+		printf("  %5d  %8.3f  %10.3f  %5.3f  %d %d %d\n", blurWidth, ms[0], ms[1], ms[2], boxBlurRadii[0], boxBlurRadii[1], boxBlurRadii[2]);
+	}
+
+	glDeleteQueries(1, &query);
+	shadowBlurFilter = savedFilter;
+	blurHalfWidth = savedHalfWidth;
+	blurWidth = 2 * blurHalfWidth;
+	memset(blurWeightArray, 0, (MAX_BLUR_WIDTH+1) * sizeof(float));
+	BuildKernelWeightsWithNormalDistribution();
+	BuildBoxBlurRadii();
+	UploadBlurKernel();
+	CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Copies blurWeightArray into the Kernel uniform block BlurPass reads.
+void Scene::UploadBlurKernel()
+{
+	glBindBuffer(GL_UNIFORM_BUFFER, uniformBlockIDForBlurring);
+	glBufferData(GL_UNIFORM_BUFFER, (MAX_BLUR_WIDTH + 1) * sizeof(float), blurWeightArray, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 
 void Scene::DrawLightingWithShadows()
 {
 	// Reset the viewport, and clear the screen
-	glViewport(0, 0, width, height);
+	BindOutputTarget();
 	glClearColor(0.5, 0.5, 0.5, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -1002,6 +1513,42 @@ void Scene::DrawLightingWithShadows()
 	loc = glGetUniformLocation(program, "blurredShadowMap");
 	glUniform1i(loc, 6);
 
+	// Or the summed-area table, filtered per pixel
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D, shadowSAT.textureId);
+	loc = glGetUniformLocation(program, "ShadowSAT");
+	glUniform1i(loc, 7);
+	loc = glGetUniformLocation(program, "SummedAreaTable");
+	glUniform1i(loc, shadowBlurFilter == BLUR_SUMMED_AREA_TABLE);
+	loc = glGetUniformLocation(program, "SATC");
+	glUniform1f(loc, satCValue);
+	loc = glGetUniformLocation(program, "LightSize");
+	glUniform1f(loc, shadowLightSize);
+	loc = glGetUniformLocation(program, "MaxFilterRadius");
+	glUniform1i(loc, shadowMaxFilterRadius);
+
+	// Or the cascades, on a unit above the light clusters'
+	glActiveTexture(GL_TEXTURE11);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, cascades.blurredArray);
+	loc = glGetUniformLocation(program, "CascadeMaps");
+	glUniform1i(loc, 11);
+	loc = glGetUniformLocation(program, "Cascaded");
+	glUniform1i(loc, useShadowCascades);
+	if (useShadowCascades) {
+		loc = glGetUniformLocation(program, "CascadeCount");
+		glUniform1i(loc, cascades.count);
+		loc = glGetUniformLocation(program, "CascadeMatrices");
+		glUniformMatrix4fv(loc, MaxShadowCascades, GL_TRUE, cascades.shadowMatrix[0].Pntr());
+
+		// Pixels whose blur reached past a cascade's corner take the next
+		vec2 ranges[MaxShadowCascades];
+		float border = (blurHalfWidth + 1.0f) / cascades.size;
+		for (int i = 0; i < MaxShadowCascades; ++i)
+			ranges[i] = vec2(border, float(cascades.resolution[i]) / cascades.size - border);
+		loc = glGetUniformLocation(program, "CascadeRange");
+		glUniform2fv(loc, MaxShadowCascades, &ranges[0][0]);
+	}
+
 	// Front - back values for mapping ESM depth value
 	loc = glGetUniformLocation(program, "groundRadius");
 	glUniform1f(loc, groundRadius);
@@ -1026,11 +1573,13 @@ void Scene::DrawLightingWithShadows()
 	loc = glGetUniformLocation(program, "mode");
 	glUniform1i(loc, mode);
 
+	BindLightClusters(program);
+
 	// Draw the scene objects.
 	DrawSun(program);
-	if (drawSpheres) DrawSpheres(program);
+	if (drawSpheres) DrawEntities(program, ENTITY_ENVIRONMENT, &viewFrustum);
 	if (drawGround) DrawGround(program);
-	DrawModel(program, centralPolygons);
+	DrawEntities(program, ENTITY_CENTRAL, &viewFrustum);
 
 	CHECKERROR;
 
@@ -1038,6 +1587,10 @@ void Scene::DrawLightingWithShadows()
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE6);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE11);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 	// Done with shader program
 	lightingShaderWithShadow.Unuse();
 
@@ -1068,17 +1621,6 @@ void Scene::DrawLightingWithShadows()
 
 	fullScreenQuad.Draw();
 
-	DebugMatrix = Translate(-0.65f, -0.25f, 0.5f) * Scale(0.3f, 0.3f, 0.3f);
-	location = glGetUniformLocation(program, "DebugMatrix");
-	glUniformMatrix4fv(location, 1, GL_TRUE, DebugMatrix.Pntr());
-
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, tempImage.textureId);
-	loc = glGetUniformLocation(program, "fboToDebug");
-	glUniform1i(loc, 7);
-
-	fullScreenQuad.Draw();
-
 	debugging.Unuse();
 
 	CHECKERROR;
@@ -1086,7 +1628,7 @@ void Scene::DrawLightingWithShadows()
 
 void Scene::DrawLightingParallaxMapping()
 {
-	glViewport(0, 0, width, height);
+	BindOutputTarget();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	// Use lighting pass shader
@@ -1147,11 +1689,13 @@ void Scene::DrawLightingParallaxMapping()
 	loc = glGetUniformLocation(program, "heightScale");
 	glUniform1f(loc, heightScale);
 
+	BindLightClusters(program);
+
 	// Draw the scene objects.
 	DrawSun(program);
-	if (drawSpheres) DrawSpheres(program);
+	if (drawSpheres) DrawEntities(program, ENTITY_ENVIRONMENT, &viewFrustum);
 	if (drawGround) DrawGround(program);
-	if(drawObject) DrawModel(program, centralPolygons);
+	if(drawObject) DrawEntities(program, ENTITY_CENTRAL, &viewFrustum);
 
 	CHECKERROR;
 
@@ -1240,7 +1784,7 @@ void Scene::SSAOGeometryPass()
 	loc = glGetUniformLocation(program, "ProjectionMatrix");
 	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
 
-	DrawModel(program, centralPolygons);
+	DrawEntities(program, ENTITY_CENTRAL, &viewFrustum);
 	if(drawGround) DrawGround(program);
 	CHECKERROR;
 
@@ -1259,7 +1803,7 @@ void Scene::SSAOGeometryPass()
 	glUniformMatrix4fv(location, 1, GL_TRUE, DebugMatrix.Pntr());
 
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, gBufferForSSAO.gPositionDepth);
+	glBindTexture(GL_TEXTURE_2D, gBufferForSSAO.depth);
 	loc = glGetUniformLocation(program, "fboToDebug");
 	glUniform1i(loc, 1);
 
@@ -1268,42 +1812,63 @@ void Scene::SSAOGeometryPass()
 	debugging.Unuse();*/
 }
 
+////////////////////////////////////////////////////////////////////////
+// Occlusion at full, half or quarter resolution.  The smaller ones run
+// on min/max downsampled depth and are brought back to ssaoFBO by
+// a bilateral upsample, so the later passes always read full size AO.
+// The deinterleaved and compute methods are always full resolution.
 void Scene::SSAOOcclusionCalculatePass()
 {
-	ssaoOcclusionCalculatePass.Use();
-	ssaoFBO.Bind();
-	glClearColor(1.0, 1.0, 1.0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT);
-
-	int program = ssaoOcclusionCalculatePass.program;
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, gBufferForSSAO.gPositionDepth);
-	int loc = glGetUniformLocation(program, "gPositionDepth");
-	glUniform1i(loc, 1);
-
-	// sending kernel data
-	loc = glGetUniformLocation(program, "SampleArray");
-	glUniform3fv(loc, MAX_SAMPLE_VALUES_SSAO, (const GLfloat*)&ssaoKernel[0]);
-
-	loc = glGetUniformLocation(program, "ProjectionMatrix");
-	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
-
-	loc = glGetUniformLocation(program, "KernelSize");
-	glUniform1i(loc, MAX_SAMPLE_VALUES_SSAO);
+	ssaoTimer.Begin();
+	if (ssaoMethod == SSAO_DEINTERLEAVED)
+		SSAODeinterleaved();
+	else if (ssaoMethod == SSAO_COMPUTE)
+		SSAOOcclusionTiled();
+	else if (ssaoResolution == SSAO_FULL) {
+		bool depthPyramid = ssaoUseDepthPyramid && ssaoMethod == SSAO_KERNEL;
+		if (depthPyramid)
+			SSAODepthPyramid();
+		SSAOOcclusion(ssaoSource->depth, ssaoFBO, renderWidth, renderHeight, depthPyramid);
+	}
+	else {
+		int halfWidth = (renderWidth + 1) / 2, halfHeight = (renderHeight + 1) / 2;
+		SSAODownsample(ssaoSource->depth, renderWidth, renderHeight, ssaoHalfDepth);
+
+		FBO* depth = &ssaoHalfDepth;
+		int lowWidth = halfWidth, lowHeight = halfHeight;
+		if (ssaoResolution == SSAO_QUARTER) {
+			SSAODownsample(ssaoHalfDepth.texture, halfWidth, halfHeight, ssaoQuarterDepth);
+			depth = &ssaoQuarterDepth;
+			lowWidth = (halfWidth + 1) / 2;
+			lowHeight = (halfHeight + 1) / 2;
+		}
 
-	loc = glGetUniformLocation(program, "Radius");
-	glUniform1f(loc, ssaoRadius);
+		ssaoLowFBO.Resize(depth->width, depth->height);
+		SSAOOcclusion(depth->texture, ssaoLowFBO, lowWidth, lowHeight);
+		SSAOUpsample(lowWidth, lowHeight, depth->texture);
+	}
 
-	fullScreenQuad.Draw();
+	if (ssaoTemporal) {
+		if (!ssaoHistoryValid)
+			ssaoStillFrames = 0;
+		SSAOTemporalResolve();
+		++ssaoFrame;
+		++ssaoStillFrames;
+	}
+	else
+		ssaoHistoryValid = false;
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (isSSAOBlurred)
+		SSAOOcclusionBlurPass();
+	ssaoTimer.End();
 
-	ssaoFBO.Unbind();
-	ssaoOcclusionCalculatePass.Unuse();
+	ssaoTimer.Poll();
+	if (ssaoTimer.TakeCollectedMilliseconds() > 0.0f)
+		ssaoMs = ssaoTimer.AverageMilliseconds();
+	glViewport(0, 0, renderWidth, renderHeight);
 
 	/*debugging.Use();
-	program = debugging.program;
+	int program = debugging.program;
 	glViewport(0, 0, width, height);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -1313,7 +1878,7 @@ void Scene::SSAOOcclusionCalculatePass()
 
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, ssaoFBO.texture);
-	loc = glGetUniformLocation(program, "fboToDebug");
+	int loc = glGetUniformLocation(program, "fboToDebug");
 	glUniform1i(loc, 1);
 
 	fullScreenQuad.Draw();
@@ -1321,21 +1886,607 @@ void Scene::SSAOOcclusionCalculatePass()
 	debugging.Unuse();*/
 }
 
-void Scene::SSAOOcclusionBlurPass()
+// The kernel or horizon pass proper, over the lower left w x h pixels
+// of target
+void Scene::SSAOOcclusion(unsigned int depth, FBO& target, int w, int h, bool depthPyramid)
 {
-	ssaoOcclusionBlurPass.Use();
-	ssaoBlurFBO.Bind();
-
+	int kernelSize = ssaoTemporal ? ssaoTemporalSamples : ssaoKernelSize;
+	int variant = 0;
+	while (variant < SSAOKernelVariants - 1 && SSAOKernelSizes[variant] < kernelSize)
+		++variant;
+	ShaderProgram& pass = ssaoMethod == SSAO_HORIZON ? ssaoHorizonPass : ssaoOcclusionCalculatePasses[variant];
+	pass.Use();
+	target.Bind();
+	glViewport(0, 0, w, h);
+	glClearColor(1.0, 1.0, 1.0, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, ssaoFBO.texture);
-	int loc = glGetUniformLocation(ssaoOcclusionBlurPass.program, "ssaoTexture");
-	glUniform1i(loc, 0);
+
+	int program = pass.program;
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, depth);
+	int loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 1);
+
+	// sending kernel data
+	loc = glGetUniformLocation(program, "SampleArray");
+	glUniform3fv(loc, MAX_SAMPLE_VALUES_SSAO, (const GLfloat*)&ssaoKernel[0]);
+
+	loc = glGetUniformLocation(program, "ProjectionMatrix");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	BindSSAONormals(program, 3);
+
+	loc = glGetUniformLocation(program, "Radius");
+	glUniform1f(loc, ssaoRadius);
+
+	loc = glGetUniformLocation(program, "RenderScale");
+	glUniform2f(loc, float(w) / target.width, float(h) / target.height);
+	loc = glGetUniformLocation(program, "NormalScale");
+	glUniform2f(loc, float(renderWidth) / ssaoSource->width, float(renderHeight) / ssaoSource->height);
+
+	loc = glGetUniformLocation(program, "Temporal");
+	glUniform1i(loc, ssaoTemporal);
+	loc = glGetUniformLocation(program, "FrameIndex");
+	glUniform1i(loc, ssaoTemporal ? ssaoFrame % 1024 : 0);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, ssaoNoiseTexture.textureId);
+	loc = glGetUniformLocation(program, "NoiseTexture");
+	glUniform1i(loc, 2);
+
+	loc = glGetUniformLocation(program, "UseDepthPyramid");
+	glUniform1i(loc, depthPyramid);
+	if (depthPyramid) {
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, ssaoDepthPyramid.textureId);
+		loc = glGetUniformLocation(program, "DepthPyramid");
+		glUniform1i(loc, 4);
+		loc = glGetUniformLocation(program, "PyramidLevels");
+		glUniform1i(loc, SSAOPyramidLevels);
+		loc = glGetUniformLocation(program, "PyramidSize");
+		glUniform2i(loc, renderWidth, renderHeight);
+	}
+
+	// horizon pass only
+	loc = glGetUniformLocation(program, "Size");
+	glUniform2i(loc, w, h);
+	loc = glGetUniformLocation(program, "Directions");
+	glUniform1i(loc, ssaoHorizonDirections);
+	loc = glGetUniformLocation(program, "Steps");
+	glUniform1i(loc, ssaoHorizonSteps);
 
 	fullScreenQuad.Draw();
 
-	ssaoBlurFBO.Unbind(); 
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	target.Unbind();
+	pass.Unuse();
+}
+
+////////////////////////////////////////////////////////////////////////
+// Binds ssaoSource's normals for shaders/ssaoNormals.glsl.  The deferred
+// gBuffer packs world normals; the shader unpacks and rotates them.
+void Scene::BindSSAONormals(int program, int unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->gNormal);
+	int loc = glGetUniformLocation(program, "gNormal");
+	glUniform1i(loc, unit);
+	loc = glGetUniformLocation(program, "PackedNormals");
+	glUniform1i(loc, ssaoSource == &gBuffer);
+	loc = glGetUniformLocation(program, "ViewMatrix");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldView.Pntr());
+}
+
+////////////////////////////////////////////////////////////////////////
+// Binds the AO the deferred ambient term is scaled by, the same size as
+// the gBuffer.  Off, the shaders skip the lookup.
+void Scene::BindSSAOResult(int program, int unit)
+{
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, isSSAOBlurred ? ssaoBlurFBO.texture : ssaoFBO.texture);
+	int loc = glGetUniformLocation(program, "AOMap");
+	glUniform1i(loc, unit);
+	loc = glGetUniformLocation(program, "AOEnabled");
+	glUniform1i(loc, isSSAOEnabled);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Builds the linear depth pyramid of the rendered area, a dispatch per
+// level (shaders/ssaoDepthPyramid.comp).  Level l covers renderWidth >> l
+// by renderHeight >> l texels; like the deinterleaved layers, the
+// texture follows the size of the targets and is only reallocated when
+// the window changes.
+void Scene::SSAODepthPyramid()
+{
+	if (ssaoSource->width != ssaoPyramidWidth || ssaoSource->height != ssaoPyramidHeight) {
+		ssaoDepthPyramid.Delete();
+		ssaoDepthPyramid.GenerateMipmappedTexture(ssaoSource->width, ssaoSource->height, SSAOPyramidLevels, GL_R32F, GL_RED);
+		ssaoPyramidWidth = ssaoSource->width;
+		ssaoPyramidHeight = ssaoSource->height;
+	}
+
+	ssaoDepthPyramidPass.Use();
+	int program = ssaoDepthPyramidPass.program;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->depth);
+	int loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 0);
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	int levelWidth = renderWidth, levelHeight = renderHeight;
+	for (int level = 0; level < SSAOPyramidLevels; ++level) {
+		int sourceWidth = levelWidth, sourceHeight = levelHeight;
+		levelWidth = std::max(renderWidth >> level, 1);
+		levelHeight = std::max(renderHeight >> level, 1);
+
+		loc = glGetUniformLocation(program, "Level");
+		glUniform1i(loc, level);
+		loc = glGetUniformLocation(program, "Size");
+		glUniform2i(loc, levelWidth, levelHeight);
+		loc = glGetUniformLocation(program, "SourceSize");
+		glUniform2i(loc, sourceWidth, sourceHeight);
+		glBindImageTexture(0, ssaoDepthPyramid.textureId, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glBindImageTexture(1, ssaoDepthPyramid.textureId, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+
+		// the next level reads this one as an image, the kernel pass as a texture
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	ssaoDepthPyramidPass.Unuse();
+	CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Frames after which the history holds what any frame before them added
+// at less than an 8 bit step: each blend keeps 1 - Blend of it.
+int Scene::SSAOConvergenceFrames() const
+{
+	if (ssaoTemporalBlend >= 1.0f)
+		return 1;
+	return int(ceil(log(1.0f / 256.0f) / log(1.0f - std::max(ssaoTemporalBlend, 0.01f))));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Blends this frame's AO in ssaoFBO into the history reprojected from
+// last frame (shaders/ssaoTemporal.frag), then copies the result back
+// into ssaoFBO for the lighting pass.  The history keeps its own view
+// depth and normal so stale texels can be recognised.
+void Scene::SSAOTemporalResolve()
+{
+	FBO& previous = ssaoHistory[ssaoHistoryIndex];
+	FBO& current = ssaoHistory[1 - ssaoHistoryIndex];
+
+	ssaoTemporalPass.Use();
+	current.Bind();
+	glViewport(0, 0, renderWidth, renderHeight);
+	glDisable(GL_DEPTH_TEST);
+
+	int program = ssaoTemporalPass.program;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, ssaoFBO.texture);
+	int loc = glGetUniformLocation(program, "CurrentAO");
+	glUniform1i(loc, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->depth);
+	loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 1);
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	previous.Validate();
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, previous.texture);
+	loc = glGetUniformLocation(program, "History");
+	glUniform1i(loc, 2);
+
+	loc = glGetUniformLocation(program, "Size");
+	glUniform2i(loc, renderWidth, renderHeight);
+	loc = glGetUniformLocation(program, "HistorySize");
+	glUniform2i(loc, ssaoPreviousWidth, ssaoPreviousHeight);
+	loc = glGetUniformLocation(program, "HistoryValid");
+	glUniform1i(loc, ssaoHistoryValid);
+
+	loc = glGetUniformLocation(program, "ViewInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldView.inverse().Pntr());
+	loc = glGetUniformLocation(program, "PreviousView");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, ssaoPreviousView.Pntr());
+	loc = glGetUniformLocation(program, "PreviousViewProjection");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, ssaoPreviousViewProjection.Pntr());
+
+	loc = glGetUniformLocation(program, "Blend");
+	glUniform1f(loc, ssaoTemporalBlend);
+	loc = glGetUniformLocation(program, "DepthTolerance");
+	glUniform1f(loc, 0.05f);
+	loc = glGetUniformLocation(program, "NormalTolerance");
+	glUniform1f(loc, 0.9f);
+
+	fullScreenQuad.Draw();
+	CHECKERROR;
+
+	// Back into ssaoFBO, AO is the red channel of both
+	ssaoFBO.Validate();
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, current.fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, ssaoFBO.fbo);
+	glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_DEPTH_TEST);
+	current.Unbind();
+	ssaoTemporalPass.Unuse();
+
+	ssaoHistoryIndex = 1 - ssaoHistoryIndex;
+	ssaoHistoryValid = true;
+	ssaoPreviousView = WorldView;
+	ssaoPreviousViewProjection = WorldProj * WorldView;
+	ssaoPreviousWidth = renderWidth;
+	ssaoPreviousHeight = renderHeight;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Halves the rendered part of a depth buffer into target, keeping
+// the nearest or farthest of every 2x2 block (shaders/ssaoDownsample.frag).
+void Scene::SSAODownsample(unsigned int source, int sourceWidth, int sourceHeight, FBO& target)
+{
+	ssaoDownsamplePass.Use();
+	target.Bind();
+	glViewport(0, 0, (sourceWidth + 1) / 2, (sourceHeight + 1) / 2);
+	glDisable(GL_DEPTH_TEST);
+
+	int program = ssaoDownsamplePass.program;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, source);
+	int loc = glGetUniformLocation(program, "Source");
+	glUniform1i(loc, 0);
+
+	loc = glGetUniformLocation(program, "SourceSize");
+	glUniform2i(loc, sourceWidth, sourceHeight);
+
+	fullScreenQuad.Draw();
+	CHECKERROR;
+
+	glEnable(GL_DEPTH_TEST);
+	target.Unbind();
+	ssaoDownsamplePass.Unuse();
+}
+
+void Scene::SSAOUpsample(int lowWidth, int lowHeight, unsigned int lowDepth)
+{
+	ssaoUpsamplePass.Use();
+	ssaoFBO.Bind();
+	glViewport(0, 0, renderWidth, renderHeight);
+	glDisable(GL_DEPTH_TEST);
+
+	int program = ssaoUpsamplePass.program;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, ssaoLowFBO.texture);
+	int loc = glGetUniformLocation(program, "LowAO");
+	glUniform1i(loc, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, lowDepth);
+	loc = glGetUniformLocation(program, "LowDepth");
+	glUniform1i(loc, 1);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->depth);
+	loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 2);
+
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	loc = glGetUniformLocation(program, "LowSize");
+	glUniform2i(loc, lowWidth, lowHeight);
+	loc = glGetUniformLocation(program, "Size");
+	glUniform2i(loc, renderWidth, renderHeight);
+	loc = glGetUniformLocation(program, "Factor");
+	glUniform1i(loc, ssaoResolution == SSAO_QUARTER ? 4 : 2);
+	loc = glGetUniformLocation(program, "DepthSharpness");
+	glUniform1f(loc, ssaoDepthSharpness);
+
+	fullScreenQuad.Draw();
+	CHECKERROR;
+
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_DEPTH_TEST);
+	ssaoFBO.Unbind();
+	ssaoUpsamplePass.Unuse();
+}
+
+////////////////////////////////////////////////////////////////////////
+// The kernel pass as a compute dispatch over 16x16 tiles whose depth,
+// plus an apron the size of the projected radius, is shared by the
+// group (shaders/ssaoOcclusionTiled.comp).  Writes ssaoFBO directly.
+void Scene::SSAOOcclusionTiled()
+{
+	ssaoFBO.Validate(); // written as an image, never bound
+	ssaoOcclusionTiledPass.Use();
+	int program = ssaoOcclusionTiledPass.program;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->depth);
+	int loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 0);
+	BindSSAONormals(program, 1);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, ssaoNoiseTexture.textureId);
+	loc = glGetUniformLocation(program, "NoiseTexture");
+	glUniform1i(loc, 2);
+	glActiveTexture(GL_TEXTURE0);
+
+	loc = glGetUniformLocation(program, "RenderSize");
+	glUniform2i(loc, renderWidth, renderHeight);
+	loc = glGetUniformLocation(program, "SampleArray");
+	glUniform3fv(loc, MAX_SAMPLE_VALUES_SSAO, (const GLfloat*)&ssaoKernel[0]);
+	loc = glGetUniformLocation(program, "ProjectionMatrix");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+	loc = glGetUniformLocation(program, "KernelSize");
+	glUniform1i(loc, ssaoTemporal ? ssaoTemporalSamples : ssaoKernelSize);
+	loc = glGetUniformLocation(program, "Radius");
+	glUniform1f(loc, ssaoRadius);
+	loc = glGetUniformLocation(program, "Temporal");
+	glUniform1i(loc, ssaoTemporal);
+	loc = glGetUniformLocation(program, "FrameIndex");
+	glUniform1i(loc, ssaoTemporal ? ssaoFrame % 1024 : 0);
+
+	glBindImageTexture(0, ssaoFBO.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((renderWidth + 15) / 16, (renderHeight + 15) / 16, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+	ssaoOcclusionTiledPass.Unuse();
+	CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Deinterleaved occlusion (shaders/ssaoDeinterleave.comp and friends):
+// depth split into 4x4 quarter resolution layers, the kernel run per
+// layer with the layer's noise vector as its only rotation, and the
+// layers put back together into ssaoFBO.  The layer arrays follow the
+// size of the targets, not the rendered part, so they are only
+// reallocated when the window changes.
+void Scene::SSAODeinterleaved()
+{
+	ssaoFBO.Validate(); // written as an image, never bound
+	int layerWidth = (ssaoFBO.width + 3) / 4, layerHeight = (ssaoFBO.height + 3) / 4;
+	if (layerWidth != ssaoLayerWidth || layerHeight != ssaoLayerHeight) {
+		ssaoDepthLayers.Delete();
+		ssaoAOLayers.Delete();
+		ssaoDepthLayers.GenerateTextureArray(layerWidth, layerHeight, 16, GL_R32F, GL_RED);
+		ssaoAOLayers.GenerateTextureArray(layerWidth, layerHeight, 16, GL_R32F, GL_RED);
+		ssaoLayerWidth = layerWidth;
+		ssaoLayerHeight = layerHeight;
+	}
+	int groupsX = (renderWidth + 7) / 8, groupsY = (renderHeight + 7) / 8;
+
+	// Split
+	ssaoDeinterleavePass.Use();
+	int program = ssaoDeinterleavePass.program;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->depth);
+	int loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 0);
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+	loc = glGetUniformLocation(program, "RenderSize");
+	glUniform2i(loc, renderWidth, renderHeight);
+	glBindImageTexture(0, ssaoDepthLayers.textureId, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute(groupsX, groupsY, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	ssaoDeinterleavePass.Unuse();
+
+	// Occlusion, one layer per z
+	ssaoDeinterleavedOcclusionPass.Use();
+	program = ssaoDeinterleavedOcclusionPass.program;
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, ssaoDepthLayers.textureId);
+	loc = glGetUniformLocation(program, "DepthLayers");
+	glUniform1i(loc, 0);
+	loc = glGetUniformLocation(program, "RenderSize");
+	glUniform2i(loc, renderWidth, renderHeight);
+	loc = glGetUniformLocation(program, "LayerSize");
+	glUniform2i(loc, (renderWidth + 3) / 4, (renderHeight + 3) / 4);
+	BindSSAONormals(program, 1);
+	glActiveTexture(GL_TEXTURE0);
+	loc = glGetUniformLocation(program, "SampleArray");
+	glUniform3fv(loc, MAX_SAMPLE_VALUES_SSAO, (const GLfloat*)&ssaoKernel[0]);
+	loc = glGetUniformLocation(program, "LayerNoise");
+	glUniform3fv(loc, 16, (const GLfloat*)&ssaoNoise[0]);
+	loc = glGetUniformLocation(program, "ProjectionMatrix");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
+	loc = glGetUniformLocation(program, "KernelSize");
+	glUniform1i(loc, ssaoKernelSize);
+	loc = glGetUniformLocation(program, "Radius");
+	glUniform1f(loc, ssaoRadius);
+	glBindImageTexture(0, ssaoAOLayers.textureId, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((renderWidth + 31) / 32, (renderHeight + 31) / 32, 16);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	ssaoDeinterleavedOcclusionPass.Unuse();
+
+	// Merge
+	ssaoReinterleavePass.Use();
+	program = ssaoReinterleavePass.program;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, ssaoAOLayers.textureId);
+	loc = glGetUniformLocation(program, "AOLayers");
+	glUniform1i(loc, 0);
+	loc = glGetUniformLocation(program, "RenderSize");
+	glUniform2i(loc, renderWidth, renderHeight);
+	glBindImageTexture(0, ssaoFBO.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute(groupsX, groupsY, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+	ssaoReinterleavePass.Unuse();
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Writes this frame's view space positions and GPU AO as PFM files for
+// the CPU reference (ssaoreference.h) and prints the command that
+// compares them.  Only the full resolution kernel method without
+// temporal accumulation computes the same thing as the reference.
+void Scene::SaveSSAOBuffers()
+{
+	const char* positionsFile = "ssao_positions.pfm";
+	const char* aoFile = "ssao_gpu.pfm";
+	FloatImage depth, x, y, z, ao;
+	depth.Resize(renderWidth, renderHeight);
+	ao.Resize(renderWidth, renderHeight);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, ssaoSource->fbo);
+	glReadPixels(0, 0, renderWidth, renderHeight, GL_DEPTH_COMPONENT, GL_FLOAT, &depth.data[0]);
+	PositionsFromDepth(depth, WorldProj, x, y, z);
+
+	// ssaoBlurFBO is stale when the blur is off
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, isSSAOBlurred ? ssaoBlurFBO.fbo : ssaoFBO.fbo);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, renderWidth, renderHeight, GL_RED, GL_FLOAT, &ao.data[0]);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	CHECKERROR;
+
+	if (WritePFM(positionsFile, x, y, z) && WritePFM(aoFile, ao)) {
+		printf("Saved %s and %s (%dx%d)%s\n", positionsFile, aoFile, renderWidth, renderHeight,
+			ssaoMethod != SSAO_KERNEL || ssaoResolution != SSAO_FULL || ssaoTemporal || ssaoUseDepthPyramid
+			? ", not the reference's method" : "");
+		printf("  compare with: -ssaoref %s ssao_cpu.pfm %g %d %d %s\n", positionsFile, ssaoRadius, ssaoKernelSize,
+			isSSAOBlurred ? ssaoBlurRadius : 0, aoFile);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Times the occlusion methods over a range of radii and prints a
+// table per resolution: the rendered size, then smaller ones with the
+// geometry pass redrawn at each.  Larger radii spread the kernel's taps
+// further, which is where the kernel pass loses its texture cache; the
+// pyramid column includes building the pyramid.  Blocks on the
+// queries, so it only runs when asked for from the tweak bar.
+void Scene::BenchmarkSSAO()
+{
+	const float radii[] = { 0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 8.0f };
+	const float scales[] = { 1.0f, 0.75f, 0.5f };
+	const SSAOMethod methods[] = { SSAO_KERNEL, SSAO_KERNEL, SSAO_COMPUTE, SSAO_DEINTERLEAVED, SSAO_HORIZON };
+	const int methodCount = ArrayCount(methods);
+	const int runs = 10;
+	float savedRadius = ssaoRadius;
+	SSAOMethod savedMethod = ssaoMethod;
+	bool savedTemporal = ssaoTemporal;
+	int savedWidth = renderWidth, savedHeight = renderHeight;
+	ssaoTemporal = false; // full kernels
+
+	GLuint query;
+	glGenQueries(1, &query);
+
+	printf("SSAO benchmark, ms per pass over %d runs\n", runs);
+	printf("  kernel, compute and deinterleaved: %d taps, horizon: %d taps\n", ssaoKernelSize, 2 * ssaoHorizonDirections * ssaoHorizonSteps);
+	for (int s = 0; s < ArrayCount(scales); ++s) {
+		renderWidth = std::max(int(savedWidth * scales[s]), 1);
+		renderHeight = std::max(int(savedHeight * scales[s]), 1);
+		glViewport(0, 0, renderWidth, renderHeight);
+		SSAOGeometryPass();
+
+		printf("  %dx%d\n", renderWidth, renderHeight);
+		printf("  radius    kernel  kernel+pyramid  compute tiles  deinterleaved   horizon\n");
+		for (int r = 0; r < ArrayCount(radii); ++r) {
+			ssaoRadius = radii[r];
+			float ms[methodCount];
+			for (int m = 0; m < methodCount; ++m) {
+				ssaoMethod = methods[m];
+				bool depthPyramid = m == 1;
+				for (int run = -1; run < runs; ++run) { // run -1 warms up untimed
+					if (run == 0)
+						glBeginQuery(GL_TIME_ELAPSED, query);
+					if (ssaoMethod == SSAO_DEINTERLEAVED)
+						SSAODeinterleaved();
+					else if (ssaoMethod == SSAO_COMPUTE)
+						SSAOOcclusionTiled();
+					else {
+						if (depthPyramid)
+							SSAODepthPyramid();
+						SSAOOcclusion(ssaoSource->depth, ssaoFBO, renderWidth, renderHeight, depthPyramid);
+					}
+				}
+				glEndQuery(GL_TIME_ELAPSED);
+
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+				ms[m] = float(ns) / 1.0e6f / runs;
+			}
+			printf("  %6.2f  %8.3f  %14.3f  %13.3f  %13.3f  %8.3f\n", radii[r], ms[0], ms[1], ms[2], ms[3], ms[4]);
+		}
+	}
+
+	glDeleteQueries(1, &query);
+	ssaoRadius = savedRadius;
+	ssaoMethod = savedMethod;
+	ssaoTemporal = savedTemporal;
+	renderWidth = savedWidth;
+	renderHeight = savedHeight;
+	glViewport(0, 0, renderWidth, renderHeight);
+	SSAOGeometryPass(); // the frame goes on with the rendered size
+	CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Separable bilateral blur of ssaoFBO into ssaoBlurFBO
+// (shaders/ssaoOcclusionBlurPass.comp): rows into ssaoBlurTemp, then
+// columns.  Each dispatch is a group per 128 texels of a row/column.
+void Scene::SSAOOcclusionBlurPass()
+{
+	// written as images, never bound
+	ssaoBlurTemp.Validate();
+	ssaoBlurFBO.Validate();
+
+	ssaoOcclusionBlurPass.Use();
+	int program = ssaoOcclusionBlurPass.program;
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, ssaoSource->depth);
+	int loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 1);
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	BindSSAONormals(program, 2);
+
+	loc = glGetUniformLocation(program, "AO");
+	glUniform1i(loc, 0);
+	loc = glGetUniformLocation(program, "RenderSize");
+	glUniform2i(loc, renderWidth, renderHeight);
+	loc = glGetUniformLocation(program, "BlurRadius");
+	glUniform1i(loc, std::min(std::max(ssaoBlurRadius, 0), 8));
+	loc = glGetUniformLocation(program, "DepthSharpness");
+	glUniform1f(loc, ssaoDepthSharpness);
+
+	const int tileSize = 128;
+	int directionLoc = glGetUniformLocation(program, "Direction");
+
+	// Rows
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, ssaoFBO.texture);
+	glUniform2i(directionLoc, 1, 0);
+	glBindImageTexture(0, ssaoBlurTemp.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((renderWidth + tileSize - 1) / tileSize, renderHeight, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	// Columns
+	glBindTexture(GL_TEXTURE_2D, ssaoBlurTemp.texture);
+	glUniform2i(directionLoc, 0, 1);
+	glBindImageTexture(0, ssaoBlurFBO.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((renderHeight + tileSize - 1) / tileSize, renderWidth, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
 	ssaoOcclusionBlurPass.Unuse();
+	CHECKERROR;
 
 	/*debugging.Use();
 	int program = debugging.program;
@@ -1356,6 +2507,7 @@ void Scene::SSAOOcclusionBlurPass()
 
 void Scene::DrawLightingSSAO()
 {
+	BindOutputTarget();
 	lightingShaderSSAO.Use();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	// Use lighting pass shader
@@ -1372,11 +2524,6 @@ void Scene::DrawLightingSSAO()
 	loc = glGetUniformLocation(program, "ssaoFBOBlurred");
 	glUniform1i(loc, 2);
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, gBufferForSSAO.gPositionDepth);
-	loc = glGetUniformLocation(program, "gPosition");
-	glUniform1i(loc, 3);
-
 	// Send the perspective and viewing matrices to the shader
 	loc = glGetUniformLocation(program, "ProjectionMatrix");
 	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
@@ -1393,8 +2540,8 @@ void Scene::DrawLightingSSAO()
 	glUniform3fv(loc, 1, &ambientColor[0]);
 
 	float widthFloat, heightFloat;
-	widthFloat = static_cast<float>(width);
-	heightFloat = static_cast<float>(height);
+	widthFloat = static_cast<float>(ssaoFBO.width);
+	heightFloat = static_cast<float>(ssaoFBO.height);
 	loc = glGetUniformLocation(program, "Width");
 	glUniform1f(loc, widthFloat);
 
@@ -1411,10 +2558,12 @@ void Scene::DrawLightingSSAO()
 	loc = glGetUniformLocation(program, "IsBlurred");
 	glUniform1i(loc, isSSAOBlurred);
 
-	if (drawSpheres) DrawSpheres(program);
+	BindLightClusters(program);
+
+	if (drawSpheres) DrawEntities(program, ENTITY_ENVIRONMENT, &viewFrustum);
 	DrawSun(program);
 	if (drawGround) DrawGround(program);
-	DrawModel(program, centralPolygons);
+	DrawEntities(program, ENTITY_CENTRAL, &viewFrustum);
 	CHECKERROR;
 
 	glActiveTexture(GL_TEXTURE1);
@@ -1452,8 +2601,8 @@ void Scene::DeferredShadingAmbientPass()
 	GLuint loc;
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, gBuffer.gPosition);
-	loc = glGetUniformLocation(program, "gPositionMap");
+	glBindTexture(GL_TEXTURE_2D, gBuffer.depth);
+	loc = glGetUniformLocation(program, "gDepthMap");
 	glUniform1i(loc, 0);
 
 	glActiveTexture(GL_TEXTURE1);
@@ -1477,6 +2626,11 @@ void Scene::DeferredShadingAmbientPass()
 	loc = glGetUniformLocation(program, "ambientLight");
 	glUniform3fv(loc, 1, &ambientColor[0]);
 
+	loc = glGetUniformLocation(program, "RenderScale");
+	glUniform2f(loc, float(renderWidth) / gBuffer.width, float(renderHeight) / gBuffer.height);
+
+	BindSSAOResult(program, 4);
+
 	fullScreenQuad.Draw();
 	CHECKERROR;
 
@@ -1485,6 +2639,66 @@ void Scene::DeferredShadingAmbientPass()
 	deferredShaderAmbientPass.Unuse();
 }
 
+////////////////////////////////////////////////////////////////////////
+// Called once a window resize has settled.  The targets only record
+// the size here and trade their attachments at their next Bind.
+void Scene::ResizeTargets(int w, int h)
+{
+	gBuffer.Resize(w, h);
+	gBufferForSSAO.Resize(w, h);
+	ssaoFBO.Resize(w, h);
+	ssaoBlurFBO.Resize(w, h);
+	ssaoBlurTemp.Resize(w, h);
+	ssaoHalfDepth.Resize((w + 1) / 2, (h + 1) / 2);
+	ssaoQuarterDepth.Resize((w + 3) / 4, (h + 3) / 4);
+	ssaoHistory[0].Resize(w, h);
+	ssaoHistory[1].Resize(w, h);
+	ssaoHistoryValid = false; // new attachments
+	sceneColor.Resize(w, h);
+	tiledLighting.Resize(w, h);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Where the final (lit) image of a frame goes: straight to the window
+// at full resolution, otherwise into sceneColor for the upscale.
+void Scene::BindOutputTarget()
+{
+	if (upscaling)
+		sceneColor.Bind();
+	else
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, renderWidth, renderHeight);
+}
+
+void Scene::UpscalePass()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+	if (!upscaling)
+		return;
+
+	glDisable(GL_DEPTH_TEST);
+	upscalePass.Use();
+	int program = upscalePass.program;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, sceneColor.texture);
+	int loc = glGetUniformLocation(program, "sceneColor");
+	glUniform1i(loc, 0);
+
+	loc = glGetUniformLocation(program, "RenderScale");
+	glUniform2f(loc, float(renderWidth) / sceneColor.width, float(renderHeight) / sceneColor.height);
+
+	loc = glGetUniformLocation(program, "Filter");
+	glUniform1i(loc, upscaleFilter);
+
+	fullScreenQuad.Draw();
+	CHECKERROR;
+
+	upscalePass.Unuse();
+	glEnable(GL_DEPTH_TEST);
+}
+
 void Scene::DrawLocalLights()
 {
 	glEnable(GL_BLEND);
@@ -1500,8 +2714,8 @@ void Scene::DrawLocalLights()
 	GLuint loc = 0;
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, gBuffer.gPosition);
-	loc = glGetUniformLocation(program, "gPositionMap");
+	glBindTexture(GL_TEXTURE_2D, gBuffer.depth);
+	loc = glGetUniformLocation(program, "gDepthMap");
 	glUniform1i(loc, 0);
 
 	glActiveTexture(GL_TEXTURE1);
@@ -1526,10 +2740,13 @@ void Scene::DrawLocalLights()
 	glUniform3fv(loc, 1, &ambientColor[0]);
 
 	loc = glGetUniformLocation(program, "Width");
-	glUniform1i(loc, width);
+	glUniform1i(loc, gBuffer.width);
 
 	loc = glGetUniformLocation(program, "Height");
-	glUniform1i(loc, height);
+	glUniform1i(loc, gBuffer.height);
+
+	loc = glGetUniformLocation(program, "RenderScale");
+	glUniform2f(loc, float(renderWidth) / gBuffer.width, float(renderHeight) / gBuffer.height);
 
 	loc = glGetUniformLocation(program, "ProjectionMatrix");
 	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.Pntr());
@@ -1537,37 +2754,247 @@ void Scene::DrawLocalLights()
 	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldView.Pntr());
 	loc = glGetUniformLocation(program, "ViewInverse");
 	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldView.inverse().Pntr());
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	UploadLightInstances();
+
+	// The instances only carry light indices, the lights come from the light store
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_BUFFER, localLights.Texture());
+	loc = glGetUniformLocation(program, "Lights");
+	glUniform1i(loc, 4);
+
+	// One instanced draw per proxy LOD, whatever the light count
+	loc = glGetUniformLocation(program, "ProxyScale");
+	for (int lod = 0; lod < LightVolumeLODCount; ++lod) {
+		if (lightLodCounts[lod] == 0)
+			continue;
+
+		Model* proxy = LocalLight::VolumeModel(lod);
+		glUniform1f(loc, LocalLight::VolumeScale(lod));
+
+		// The proxies are only drawn here, so their VAOs keep the instance attributes
+		size_t first = lightLodFirst[lod] * sizeof(unsigned int);
+		glBindVertexArray(proxy->vao);
+		glBindBuffer(GL_ARRAY_BUFFER, lightInstanceBuffer);
+		glEnableVertexAttribArray(4);
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, 0, (void*)first);
+		glVertexAttribDivisor(4, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glDrawElementsInstanced(proxy->shape == 4 ? GL_QUADS : GL_TRIANGLES, proxy->shape * proxy->count,
+			GL_UNSIGNED_INT, 0, lightLodCounts[lod]);
+	}
+	glBindVertexArray(0);
+	CHECKERROR;
 
-	for (unsigned int i = 0; i < localLights.size(); ++i) {
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
 
-		LocalLight const * localLight = &localLights[i];
+	deferredShaderLocalLightPass.Unuse();
 
-		loc = glGetUniformLocation(program, "LightPosition");
-		glUniform3fv(loc, 1, &localLight->lightPos[0]);
-		
-		loc = glGetUniformLocation(program, "LightRange");
-		glUniform1f(loc, localLight->radius);
+}
 
-		loc = glGetUniformLocation(program, "LightColor");
-		glUniform3fv(loc, 1, &localLight->lightColor[0]);
+////////////////////////////////////////////////////////////////////////
+// Moves the animated lights and brings the GPU copy of the light
+// store up to date, for every light pass of the frame.
+void Scene::UpdateLights()
+{
+	if (animateLights)
+		AnimateLights(localLights, lightTime, *threadPool);
+	localLights.Upload(*threadPool);
+	lightsUploaded = localLights.UploadedLights();
+	CHECKERROR;
+}
 
-		loc = glGetUniformLocation(program, "Attenuation");
-		glUniform2fv(loc, 1, &localLight->attenuationVector[0]);
+////////////////////////////////////////////////////////////////////////
+// Refills the instance buffer of the light volume pass.  Each light
+// gets the coarsest proxy that still looks round at its projected
+// radius, lights entirely behind the eye are dropped, and the rest are
+// stored grouped by proxy so that every LOD is one contiguous range.
+void Scene::UploadLightInstances()
+{
+	const int lightsPerBatch = 256;
+	const unsigned char culled = 0xff;
+	int lightCount = localLights.Count();
+	int batchCount = (lightCount + lightsPerBatch - 1) / lightsPerBatch;
+	lightLods.resize(lightCount);
+
+	// Projected radius = range * focal length / depth, in pixels of the rendered area
+	float pixelsPerUnit = WorldProj[1][1] * renderHeight * 0.5f;
+
+	threadPool->ParallelFor(batchCount, [&](int batch) {
+		int end = std::min(lightCount, (batch + 1) * lightsPerBatch);
+		for (int i = batch * lightsPerBatch; i < end; ++i) {
+			float radius = localLights.radius[i];
+			float depth = -(WorldView[2][0] * localLights.posX[i] + WorldView[2][1] * localLights.posY[i]
+				+ WorldView[2][2] * localLights.posZ[i] + WorldView[2][3]);
+
+			if (depth < -radius)
+				lightLods[i] = culled;
+			else if (depth <= radius)
+				lightLods[i] = LightVolumeLODCount - 1;
+			else
+				lightLods[i] = static_cast<unsigned char>(LocalLight::VolumeLOD(radius * pixelsPerUnit / depth));
+		}
+	});
 
-		// Model matrix will be just a radius and we'll be coloring inside that radius
-		MAT4 ModelMatrix = Translate(localLight->lightPos)*Scale(vec3(localLight->radius));
+	for (int lod = 0; lod < LightVolumeLODCount; ++lod)
+		lightLodCounts[lod] = 0;
+	for (int i = 0; i < lightCount; ++i) {
+		if (lightLods[i] != culled)
+			++lightLodCounts[lightLods[i]];
+	}
 
-		loc = glGetUniformLocation(program, "ModelMatrix");
-		glUniformMatrix4fv(loc, 1, GL_TRUE, ModelMatrix.Pntr());
+	int instanceCount = 0;
+	for (int lod = 0; lod < LightVolumeLODCount; ++lod) {
+		lightLodFirst[lod] = instanceCount;
+		instanceCount += lightLodCounts[lod];
+	}
 
-		localLight->lightModel->DrawVAO();
-		
-		//fullScreenQuad.Draw();
+	int next[LightVolumeLODCount];
+	for (int lod = 0; lod < LightVolumeLODCount; ++lod)
+		next[lod] = lightLodFirst[lod];
+
+	lightInstances.resize(instanceCount);
+	for (int i = 0; i < lightCount; ++i) {
+		if (lightLods[i] != culled)
+			lightInstances[next[lightLods[i]]++] = i;
 	}
-	glDisable(GL_BLEND);
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_CULL_FACE);
 
-	deferredShaderLocalLightPass.Unuse();
+	// Orphaned like the tiled pass's light buffer
+	glBindBuffer(GL_ARRAY_BUFFER, lightInstanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, lightInstances.size() * sizeof(unsigned int), NULL, GL_STREAM_DRAW);
+	if (instanceCount > 0)
+		glBufferSubData(GL_ARRAY_BUFFER, 0, lightInstances.size() * sizeof(unsigned int), &lightInstances[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Refills the light buffer of the tiled pass: positions move to view
+// space here once instead of in every tile.
+void Scene::UploadLightBuffer()
+{
+	const int lightsPerBatch = 256;
+	int lightCount = localLights.Count();
+	int batchCount = (lightCount + lightsPerBatch - 1) / lightsPerBatch;
+	lightBufferData.resize(2 * lightCount);
+
+	threadPool->ParallelFor(batchCount, [&](int batch) {
+		int end = std::min(lightCount, (batch + 1) * lightsPerBatch);
+		for (int i = batch * lightsPerBatch; i < end; ++i) {
+			vec3 p(localLights.posX[i], localLights.posY[i], localLights.posZ[i]);
+			vec3 viewPosition;
+			for (int row = 0; row < 3; ++row)
+				viewPosition[row] = WorldView[row][0] * p.x + WorldView[row][1] * p.y + WorldView[row][2] * p.z + WorldView[row][3];
+			lightBufferData[2 * i] = vec4(viewPosition, localLights.radius[i]);
+			lightBufferData[2 * i + 1] = vec4(localLights.colorR[i], localLights.colorG[i], localLights.colorB[i], 1.0f);
+		}
+	});
+
+	// Orphan the old storage, the previous frame may still read it
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, lightBufferData.size() * sizeof(vec4), NULL, GL_STREAM_DRAW);
+	if (lightCount > 0)
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, lightBufferData.size() * sizeof(vec4), &lightBufferData[0]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Ambient and local lights in one compute dispatch over 16x16 tiles
+// (shaders/deferredTiledLighting.comp), then copied to the output.
+void Scene::DrawLocalLightsTiled()
+{
+	const int tileSize = 16;
+
+	UploadLightBuffer();
+	tiledLighting.Validate();
+
+	deferredShaderTiledLightPass.Use();
+	int program = deferredShaderTiledLightPass.program;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.depth);
+	int loc = glGetUniformLocation(program, "gDepthMap");
+	glUniform1i(loc, 0);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.gNormal);
+	loc = glGetUniformLocation(program, "gNormalMap");
+	glUniform1i(loc, 1);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.gSpecular);
+	loc = glGetUniformLocation(program, "gSpecularMap");
+	glUniform1i(loc, 2);
+
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, gBuffer.gDifSpec);
+	loc = glGetUniformLocation(program, "gDifSpecMap");
+	glUniform1i(loc, 3);
+
+	loc = glGetUniformLocation(program, "RenderSize");
+	glUniform2i(loc, renderWidth, renderHeight);
+
+	loc = glGetUniformLocation(program, "ViewMatrix");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldView.Pntr());
+	loc = glGetUniformLocation(program, "ProjectionInverse");
+	glUniformMatrix4fv(loc, 1, GL_TRUE, WorldProj.inverse().Pntr());
+
+	loc = glGetUniformLocation(program, "AmbientLight");
+	glUniform3fv(loc, 1, &ambientColor[0]);
+	BindSSAOResult(program, 4);
+
+	loc = glGetUniformLocation(program, "LightCount");
+	glUniform1i(loc, localLights.Count());
 
-}
\ No newline at end of file
+	loc = glGetUniformLocation(program, "ShowTileLightCount");
+	glUniform1i(loc, showTileLightCount);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, lightBuffer);
+	glBindImageTexture(0, tiledLighting.texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	glDispatchCompute((renderWidth + tileSize - 1) / tileSize, (renderHeight + tileSize - 1) / tileSize, 1);
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+	CHECKERROR;
+
+	deferredShaderTiledLightPass.Unuse();
+
+	BindOutputTarget();
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, tiledLighting.fbo);
+	glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	BindOutputTarget();
+	CHECKERROR;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Bins the local lights into the froxels of this frame's camera for
+// the forward passes (see lightclusters.h).
+void Scene::UpdateLightClusters()
+{
+	if (!clusteredLighting)
+		return;
+
+	int lightCount = localLights.Count();
+	lightSpheres.resize(lightCount);
+	for (int i = 0; i < lightCount; ++i)
+		lightSpheres[i] = vec4(localLights.posX[i], localLights.posY[i], localLights.posZ[i], localLights.radius[i]);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	lightClusters.SetProjection(WorldProj, front, back);
+	lightClusters.Build(lightCount ? &lightSpheres[0] : NULL, lightCount, WorldView, *threadPool);
+	clusterBuildMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	lightClusters.Upload();
+	CHECKERROR;
+}
+
+void Scene::BindLightClusters(unsigned int program)
+{
+	// Above the units the forward passes use for their own textures
+	const int firstUnit = 8;
+	lightClusters.Bind(program, firstUnit, localLights.Texture(), renderWidth, renderHeight, clusteredLighting);
+}
@@ -22,13 +22,28 @@ using namespace glm;
 #include "fbo.h"
 #include "FSQ.h"
 #include "LocalLight.h"
+#include "commandlist.h"
+#include "threadpool.h"
+#include "entities.h"
+#include "gputimer.h"
+#include "dynamicresolution.h"
+#include "lightclusters.h"
+#include "lightstore.h"
+#include "shadowcascades.h"
 
 #include <vector>
+#include <algorithm>
 #include <random>
+#include <fstream>
 
 #define MAX_BLUR_WIDTH 100
 #define MAX_SAMPLE_VALUES_SSAO 128
 
+// Kernel sizes the SSAO kernel pass is compiled for, one program each
+const int SSAOKernelVariants = 5;
+const int SSAOKernelSizes[SSAOKernelVariants] = { 8, 16, 32, 64, 128 };
+const int SSAOPyramidLevels = 6; // linear depth pyramid, full resolution to 1/32
+
 enum GBufferDebugMode {
 	G_POS,
 	G_NORM,
@@ -52,6 +67,34 @@ enum ShadowDebugMode {
 	SHADOW_DEBUG_COUNT
 };
 
+// How the deferred path applies the local lights
+enum LocalLightMode {
+	LIGHT_VOLUMES,  // a blended sphere per light
+	TILED_COMPUTE   // one compute dispatch, lights culled per 16x16 tile
+};
+
+// Resolution the SSAO occlusion pass runs at
+enum SSAOResolution {
+	SSAO_FULL,
+	SSAO_HALF,    // min/max downsampled depth, bilateral upsample
+	SSAO_QUARTER
+};
+
+// How the SSAO occlusion pass samples
+enum SSAOMethod {
+	SSAO_KERNEL,        // 8 to 128 taps in the normal's hemisphere
+	SSAO_DEINTERLEAVED, // the same taps on 4x4 quarter resolution depth layers
+	SSAO_HORIZON,       // GTAO: horizons marched in a few screen directions
+	SSAO_COMPUTE        // the kernel taps from shared memory depth tiles
+};
+
+// How BlurPass filters the exponential shadow map
+enum ShadowBlurFilter {
+	BLUR_WEIGHTED, // a tap per weight of blurWeightArray
+	BLUR_BOXES,    // three running sum boxes of the same variance
+	BLUR_SUMMED_AREA_TABLE // no blur; lighting filters a summed-area table per pixel
+};
+
 class Scene
 {
 public:
@@ -63,6 +106,7 @@ public:
     bool drawGround;
 	bool drawShadows;
 	bool drawObject;
+	bool isAnimating;
 	bool isForward;
 	bool isShadowEnabled;
 	bool isSSAOEnabled;
@@ -90,6 +134,17 @@ public:
 	int blurHalfWidth, blurWidth;
 	float blurWeightArray[MAX_BLUR_WIDTH+1];
 	GLuint uniformBlockIDForBlurring;
+	ShadowBlurFilter shadowBlurFilter;
+	int boxBlurRadii[3]; // from blurWeightArray, see BuildBoxBlurRadii
+	bool shadowBlurBenchmarkRequested; // time both filters over a range of widths next frame
+	float satCValue;           // the summed-area table's ESM constant, below esmCValue
+	float shadowLightSize;     // contact hardening, see lightingSoftShadow.frag
+	int shadowMaxFilterRadius;
+
+	// Cascaded shadow maps in place of the single one
+	bool useShadowCascades;
+	ShadowCascades cascades;
+	unsigned int cascadesRendered; // a bit per cascade DrawShadowCascades rendered
 
 	// height scaling for Parallax mapping
 	float heightScale;
@@ -101,10 +156,39 @@ public:
 	std::vector<vec3> ssaoNoise;
 	Texture ssaoNoiseTexture;
 	float ssaoRadius;
+	int ssaoKernelSize; // one of SSAOKernelSizes
+	SSAOResolution ssaoResolution;
+	float ssaoDepthSharpness; // bilateral upsample and blur depth weight
+	int ssaoBlurRadius;       // texels each side, at most 8
+	GPUTimer ssaoTimer;
+	float ssaoMs;
+	SSAOMethod ssaoMethod;
+	Texture ssaoDepthLayers, ssaoAOLayers; // deinterleaved: 16 layers each
+	int ssaoLayerWidth, ssaoLayerHeight;
+	bool ssaoUseDepthPyramid;  // kernel taps read a level picked by their distance
+	Texture ssaoDepthPyramid;  // view z mip chain (shaders/ssaoDepthPyramid.comp)
+	int ssaoPyramidWidth, ssaoPyramidHeight;
+	int ssaoHorizonDirections, ssaoHorizonSteps; // taps = 2 * directions * steps
+	bool ssaoBenchmarkRequested; // time both methods over a range of radii next frame
+	bool ssaoSaveRequested;      // write positions and AO as PFM files next frame
+
+	// Temporal SSAO: few rotated samples a frame, accumulated in a
+	// reprojected history
+	bool ssaoTemporal;
+	int ssaoTemporalSamples;
+	float ssaoTemporalBlend;
+	unsigned int ssaoFrame;
+	FBO ssaoHistory[2]; // AO, view depth, world normal; ping-pong
+	int ssaoHistoryIndex;
+	bool ssaoHistoryValid;
+	int ssaoStillFrames; // accumulated since the last change
+	MAT4 ssaoPreviousView, ssaoPreviousViewProjection;
+	int ssaoPreviousWidth, ssaoPreviousHeight;
 
     int centralType;
     int centralModel;
 	int lightIndex = 0;
+	LightHandle selectedLight = InvalidLight; // the light the tweak bar and mouse edit
     MAT4 centralTr;
 	MAT4 SunModelTr;
 	MAT4 SphereModelTr;
@@ -124,7 +208,31 @@ public:
 	vec3 lightColor;
 
 	// Local lights
-	std::vector<LocalLight> localLights;
+	LightStore localLights;
+	bool animateLights;
+	float lightTime; // seconds of light animation so far
+	unsigned int lightsUploaded; // written to the GPU this frame
+	LocalLightMode localLightMode;
+	bool showTileLightCount;
+	GPUTimer localLightTimer;
+	float localLightMs;
+
+	// Light volumes: one instance (a light index) per light, grouped by proxy LOD
+	std::vector<unsigned int> lightInstances;
+	std::vector<unsigned char> lightLods;
+	int lightLodFirst[LightVolumeLODCount];
+	int lightLodCounts[LightVolumeLODCount];
+	GLuint lightInstanceBuffer;
+
+	// Tiled lighting: view space lights for the compute pass
+	std::vector<vec4> lightBufferData;
+	GLuint lightBuffer;
+
+	// Clustered lighting: local lights binned into froxels for the forward passes
+	LightClusters lightClusters;
+	bool clusteredLighting;
+	float clusterBuildMs;
+	std::vector<vec4> lightSpheres;
 
 	// Global Lights
 	vec3 lightPosition;
@@ -138,13 +246,28 @@ public:
 	//FBO
 	FBO gBuffer;
 	FBO gBufferForSSAO;
+	FBO* ssaoSource; // depth and normals the SSAO passes read: gBufferForSSAO (forward) or gBuffer (deferred)
 	FBO shadowBufferObject;
 	FBO ssaoFBO; // for the final floating-point result
 	FBO ssaoBlurFBO;
+	FBO ssaoBlurTemp; // between the blur's row and column passes
+	FBO ssaoHalfDepth, ssaoQuarterDepth; // checkerboard min/max downsamples
+	FBO ssaoLowFBO;                            // AO at half or quarter resolution
+	FBO sceneColor; // scaled scene output, upscaled to the window
+	FBO tiledLighting; // written by the tiled lighting compute pass
 
     // Viewport
     int width, height;
 
+	// Dynamic resolution: screen-sized passes draw into the lower left
+	// renderWidth x renderHeight of their targets
+	DynamicResolution resolution;
+	GPUTimer sceneTimer;
+	int renderWidth, renderHeight;
+	bool upscaling;
+	int upscaleFilter;
+	char renderSizeText[32];
+
     // Shader programs
 	// PARALLAX
 	ShaderProgram lightingShaderParallaxMapping;
@@ -152,23 +275,39 @@ public:
 	// SSAO
 	ShaderProgram lightingShaderSSAO;
 	ShaderProgram gBufferPassForSSAO;
-	ShaderProgram ssaoOcclusionCalculatePass;
+	ShaderProgram ssaoOcclusionCalculatePasses[SSAOKernelVariants]; // per kernel size
 	ShaderProgram ssaoOcclusionBlurPass;
+	ShaderProgram ssaoDownsamplePass;
+	ShaderProgram ssaoUpsamplePass;
+	ShaderProgram ssaoDeinterleavePass;
+	ShaderProgram ssaoDeinterleavedOcclusionPass;
+	ShaderProgram ssaoReinterleavePass;
+	ShaderProgram ssaoHorizonPass;
+	ShaderProgram ssaoTemporalPass;
+	ShaderProgram ssaoDepthPyramidPass;
+	ShaderProgram ssaoOcclusionTiledPass;
 
 	// Deferred
 	ShaderProgram deferredShaderGBufferPass;
 	ShaderProgram deferredShaderAmbientPass;
 	ShaderProgram deferredShaderLocalLightPass;
+	ShaderProgram deferredShaderTiledLightPass;
 
 	// ESM
 	ShaderProgram shadowShader;
 	ShaderProgram blurShader;
+	ShaderProgram boxBlurShader;
+	ShaderProgram shadowSATShader;
+	ShaderProgram cascadeBlurShader;
 	ShaderProgram verticalBlurShader;
 	ShaderProgram lightingShaderWithShadow;
 
 	// Debug program
 	ShaderProgram debugging;
 
+	// Final upscale to the window
+	ShaderProgram upscalePass;
+
     // The polygon models (VAOs - Vertex Array Objects)
     Model* centralPolygons;
     Model* spherePolygons;
@@ -177,6 +316,24 @@ public:
 
 	FSQ fullScreenQuad;
 
+	// Drawable objects (environment spheres, central model) in SoA form
+	EntityStore entities;
+	MeshHandle sphereMesh, centralMesh;
+	unsigned int centralEntity;
+	Frustum viewFrustum;
+
+	// Rotation of the sphere environment in degrees, advanced only while animating
+	float animationAngle;
+	int lastAnimationTick;
+
+	// Worker threads record per-object draw commands, the GLUT thread replays them
+	ThreadPool* threadPool;
+	std::vector<CommandList> entityCommands;
+
+	// Frame capture: every replayed command list of the next frame is written to a file
+	bool captureFrame;
+	std::ofstream* frameCapture;
+
     // Texture
     Texture groundTexture;
 	Texture groundNormal;
@@ -188,52 +345,100 @@ public:
 
 	Texture groundClassic;
 
-	Texture tempImage;
 	Texture blurImage;
+	Texture boxBlurTemp; // between the box filter's row and column passes
+	Texture shadowSAT;   // RG32F, hi + lo sums
 
     // Main methods
     void InitializeScene();
     void DrawScene();
 	void InitializeLights(int nLights, bool randomized = false, bool allWhite = false);
+	void SetLightCount(int count);
 
     // Helper methods
     void SetCentralModel(const int i);
-	void SetLightIndex(const int i) { lightIndex = i; };
+	void SetLightIndex(const int i);
+	void AddLight(bool randomized, bool allWhite = false);
+	void BuildEntities();
+	void SetAnimating(bool animating);
+	// The environment spheres only move while shown, the lights while
+	// animated, and temporal SSAO until its history has converged
+	bool NeedsAnimationFrame() const
+	{
+		return (isAnimating && drawSpheres) || animateLights
+			|| (ssaoTemporal && isSSAOEnabled && ssaoStillFrames < SSAOConvergenceFrames());
+	}
+	// Something besides the animation clock changed what the AO history holds
+	void RestartSSAOConvergence() { ssaoStillFrames = 0; }
+	int SSAOConvergenceFrames() const;
     void DrawSun(unsigned int program);
-	void DrawSpheres(unsigned int program);
+	void DrawEntities(unsigned int program, unsigned int flagMask, const Frustum* frustum);
     void DrawGround(unsigned int program);
-	void DrawModel(const int program, Model * m);
+	void ReplayCommandLists(std::vector<CommandList>& lists, int count);
 
 private:
 	// Deferred shading draws
 	void DeferredShadingGeometryPass();
 	void DeferredShadingAmbientPass();
+	void UpdateLights();
 	void DrawLocalLights();
+	void UploadLightInstances();
+	void DrawLocalLightsTiled();
+	void UploadLightBuffer();
 	void DeferredShadingLightingPass();
 
 	// Forward draws
 	// ESM
 	void DrawShadows();
 	void BlurPass();
+	void WeightedBlurPass();
+	void BoxBlurPass();
+	void BuildShadowSAT();
+	void DrawShadowCascades();
+	void BlurShadowCascades();
+	void UploadBlurKernel();
+	void BenchmarkShadowBlur();
 	void DrawLightingWithShadows();
 
 	// PARALLAX
 	void DrawLightingParallaxMapping();
 
+	// Clustered local lights
+	void UpdateLightClusters();
+	void BindLightClusters(unsigned int program);
+
 	// SSAO
 	void SSAOGeometryPass();
 	void SSAOOcclusionCalculatePass();
+	void SSAOOcclusion(unsigned int depth, FBO& target, int w, int h, bool depthPyramid = false);
+	void SSAODepthPyramid();
+	void UseSSAOSource(FBO& source);
+	void BindSSAONormals(int program, int unit);
+	void BindSSAOResult(int program, int unit);
+	void SSAODownsample(unsigned int source, int sourceWidth, int sourceHeight, FBO& target);
+	void SSAOUpsample(int lowWidth, int lowHeight, unsigned int lowDepth);
+	void SSAODeinterleaved();
+	void SSAOOcclusionTiled();
+	void SSAOTemporalResolve();
+	void BenchmarkSSAO();
+	void SaveSSAOBuffers();
 	void SSAOOcclusionBlurPass();
 	void DrawLightingSSAO();
 	
 	void ForwardShading();
 	void DeferredShading();
 
+	// Dynamic resolution
+	void ResizeTargets(int w, int h);
+	void BindOutputTarget();
+	void UpscalePass();
+
 	// ESM
 	void BuildKernelWeights();
 	float ComputeWeight(int counter);
 	float NormalDistribution(float value, float mean, float deviation);
-	void BuildKernelWeightsWithNormalDistribution();
+	void BuildKernelWeightsWithNormalDistribution(float deviation = 2.0f);
+	void BuildBoxBlurRadii();
 
 	// SSAO
 	void BuildSSAOSampleKernel();
@@ -33,6 +33,40 @@ char* ReadFile(const char* name)
     return content;
 }
 
+// Replaces every #include "file" line with the contents of that file,
+// looked up in folder.  Included files may include others.
+std::string ExpandIncludes(const std::string& source, const std::string& folder, int depth = 0)
+{
+    if (depth > 8) {
+        printf("Shader includes nested too deep in %s\n", folder.c_str());
+        return source; }
+
+    std::string result;
+    size_t lineStart = 0;
+    while (lineStart < source.size()) {
+        size_t lineEnd = source.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+            lineEnd = source.size();
+        std::string line = source.substr(lineStart, lineEnd - lineStart);
+
+        size_t first = line.find_first_not_of(" \t");
+        size_t open = line.find('"');
+        size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (first != std::string::npos && line.compare(first, 8, "#include") == 0 && close != std::string::npos) {
+            std::string path = folder + line.substr(open + 1, close - open - 1);
+            char* included = ReadFile(path.c_str());
+            result += ExpandIncludes(included, folder, depth + 1);
+            result += "\n";
+            delete[] included; }
+        else {
+            result += line;
+            result += "\n"; }
+
+        lineStart = lineEnd + 1;
+    }
+    return result;
+}
+
 // Asks OpenGL to create an empty shader program.
 void ShaderProgram::CreateProgram()
 { 
@@ -52,11 +86,22 @@ void ShaderProgram::Unuse()
 }
 
 // Read, send to OpenGL, and compile a single file into a shader program.
-void ShaderProgram::CreateShader(const char* fileName, int type)
+void ShaderProgram::CreateShader(const char* fileName, int type, const char* defines)
 {
     // Read the source from the named file
     char* src = ReadFile(fileName);
-    const char* psrc[1] = {src};
+
+    std::string name(fileName);
+    size_t slash = name.find_last_of("/\\");
+    std::string folder = slash == std::string::npos ? "" : name.substr(0, slash + 1);
+    std::string source = ExpandIncludes(src, folder);
+
+    // Defines have to follow the #version line
+    if (defines) {
+        size_t versionEnd = source.find('\n') + 1;
+        source.insert(versionEnd, std::string(defines) + "\n"); }
+
+    const char* psrc[1] = {source.c_str()};
 
     // Create a shader and attach, hand it the source, and compile it.
     int shader = glCreateShader(type);
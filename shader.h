@@ -12,13 +12,18 @@
 #ifndef _SHADER_
 #define _SHADER_
 
+#include <string>
+
 class ShaderProgram
 {
 public:
     int program;
     
     void CreateProgram();
-    void CreateShader(const char* fileName, const int type);
+    // Lines of the form #include "file" are replaced by that file (found
+    // next to the shader), and defines, if given, is inserted right
+    // after the #version line.
+    void CreateShader(const char* fileName, const int type, const char* defines = NULL);
     void LinkProgram();
     void Use();
     void Unuse();
@@ -0,0 +1,65 @@
+// Clustered local lights for the forward passes, included by their
+// fragment shaders.  LightClusters (lightclusters.h) bins the lights
+// into froxels on the CPU; a pixel finds its froxel from its screen
+// position and view depth and lights itself with that froxel's list.
+
+uniform bool ClusteredLightsEnabled;
+uniform usamplerBuffer ClusterRanges;       // first index, count
+uniform usamplerBuffer ClusterLightIndices;
+uniform samplerBuffer ClusterLights;        // 3 texels per light: world position and range, color, attenuation
+
+uniform ivec3 ClusterGrid;        // tiles x, tiles y, depth slices
+uniform vec2 ClusterDepth;        // near plane, slices / log(far/near)
+uniform vec2 ClusterScreenSize;   // rendered size in pixels
+uniform mat4 ViewMatrix;
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932384626433832795
+#endif
+
+int ClusterIndex(vec3 worldPosition)
+{
+	float depth = -(ViewMatrix * vec4(worldPosition, 1.0)).z;
+	int slice = int(floor(log(max(depth, ClusterDepth.x) / ClusterDepth.x) * ClusterDepth.y));
+	ivec2 tile = ivec2(gl_FragCoord.xy / ClusterScreenSize * vec2(ClusterGrid.xy));
+
+	slice = clamp(slice, 0, ClusterGrid.z - 1);
+	tile = clamp(tile, ivec2(0), ClusterGrid.xy - 1);
+	return (slice * ClusterGrid.y + tile.y) * ClusterGrid.x + tile.x;
+}
+
+// Sum of the froxel's lights at a surface point, all vectors in world
+// space (N and V normalized), same BRDF as the main light
+vec3 ClusteredLighting(vec3 position, vec3 N, vec3 V, vec3 Kd, vec3 Ks, float alpha)
+{
+	if (!ClusteredLightsEnabled)
+		return vec3(0.0);
+
+	uvec2 range = texelFetch(ClusterRanges, ClusterIndex(position)).xy;
+
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < range.y; ++i) {
+		int light = int(texelFetch(ClusterLightIndices, int(range.x + i)).r);
+		vec4 sphere = texelFetch(ClusterLights, 3 * light);
+
+		vec3 toLight = sphere.xyz - position;
+		float distance = length(toLight);
+		if (distance >= sphere.w)
+			continue;
+
+		vec3 L = toLight / distance;
+		vec3 H = normalize(L + V);
+
+		float LN = max(dot(L, N), 0.0);
+		float HN = max(dot(H, N), 0.0);
+		float LH = dot(L, H);
+
+		vec3 F = Ks + (1 - Ks) * pow((1 - LH), 5);
+		float D = ((alpha + 2) / (2 * M_PI)) * pow(HN, alpha);
+		float G = 1 / pow(LH, 2);
+
+		vec3 BRDF = (Kd / M_PI) + (F * G * D) / 4;
+		result += BRDF * texelFetch(ClusterLights, 3 * light + 1).rgb * LN * ((sphere.w - distance) / sphere.w);
+	}
+	return result;
+}
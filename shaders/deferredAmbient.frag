@@ -2,11 +2,14 @@
 
 uniform vec3 ambientLight;
 
-uniform sampler2D gPositionMap;
+uniform sampler2D gDepthMap;
 uniform sampler2D gNormalMap;
 uniform sampler2D gSpecularMap;
 uniform sampler2D gDifSpecMap;
 uniform int gBufDebug;
+uniform vec2 RenderScale; // rendered part of the gBuffer (dynamic resolution)
+uniform bool AOEnabled;
+uniform sampler2D AOMap;  // same size as the gBuffer
 
 in vec2 texCoord;
 
@@ -24,7 +27,7 @@ void main(){
 	/*vec3 outputColor;
 	switch(gBufDebug){
 	case G_POS:
-		outputColor = texture(gPositionMap, texCoord.st).rgb;
+		outputColor = texture(gDepthMap, texCoord.st).rrr;
 		break;
 	case G_NORM:
 		outputColor = texture(gNormalMap, texCoord.st).rgb;
@@ -45,6 +48,8 @@ void main(){
 	}
 	color = vec4(outputColor * ambientLight, 1.0f);*/
 
-	vec3 outputColor = texture(gDifSpecMap, texCoord.st).rgb; 
+	vec3 outputColor = texture(gDifSpecMap, texCoord.st * RenderScale).rgb; 
+	if (AOEnabled)
+		outputColor *= texture(AOMap, texCoord.st * RenderScale).r;
 	color = vec4(outputColor * ambientLight, 1.0);
 }
\ No newline at end of file
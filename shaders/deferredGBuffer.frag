@@ -1,14 +1,16 @@
 #version 330
 
+#include "gBufferPacking.glsl"
+
 in vec4 Vertex;
 in vec3 VertexNormal;
 in vec2 VertexTexture;
 in vec3 VertexTangent;
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec4 gDifSpec;
-layout (location = 3) out vec3 gSpecular;
+// Position isn't stored, it's rebuilt from the depth buffer
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gDifSpec;
+layout (location = 2) out vec4 gSpecular;
 
 //in
 in vec2 texCoord;
@@ -25,9 +27,8 @@ uniform sampler2D groundTexture;
 
 void main()
 {
-	gPosition = worldPos;
-	gNormal = normalize(normalVec);
-	gDifSpec.a = shininess;
+	gNormal = EncodeNormal(normalize(normalVec));
+	gDifSpec.a = EncodeShininess(shininess);
 
 	if (isTextured == 1)
 		gDifSpec.rgb = diffuse * texture(groundTexture, texCoord.st).rgb;
@@ -36,6 +37,6 @@ void main()
 
 	
 
-	gSpecular = specular;
+	gSpecular = vec4(specular, 1.0);
 	
 }
@@ -1,5 +1,7 @@
 #version 330
 
+#include "gBufferPacking.glsl"
+
 #define G_POS 0
 #define G_NORM 1
 #define G_DIFF_XYZ 2
@@ -11,22 +13,22 @@
 
 uniform vec3 AmbientLight;
 
-uniform sampler2D gPositionMap;
+uniform sampler2D gDepthMap;
 uniform sampler2D gNormalMap;
 uniform sampler2D gSpecularMap;
 uniform sampler2D gDifSpecMap;
 uniform int gBufDebug;
 
 uniform int Width, Height;
+uniform vec2 RenderScale; // rendered part of the gBuffer (dynamic resolution)
 
-uniform float LightRange;
-
-uniform mat4 ProjectionMatrix, ViewMatrix, ViewInverse;
-uniform vec3 LightPosition;
-uniform vec3 LightColor;
-uniform vec2 Attenuation;
+uniform mat4 ProjectionMatrix, ViewMatrix, ViewInverse, ProjectionInverse;
 
 in vec2 texCoord;
+flat in vec3 LightPosition;
+flat in float LightRange;
+flat in vec3 LightColor;
+flat in vec2 Attenuation;
 
 out vec4 color;
 
@@ -34,10 +36,13 @@ void main(){
 	vec2 texCoords = vec2(gl_FragCoord.x/Width, gl_FragCoord.y/Height);
 
 	// Getting the information of texel back from the texture
-	vec3 position = texture(gPositionMap, texCoords).rgb;
-	vec3 normal = texture(gNormalMap, texCoords).rgb;
-	vec3 diffuse = texture(gDifSpecMap, texCoords).rgb;
-	float shininess = texture(gDifSpecMap, texCoords).a;
+	float depth = texture(gDepthMap, texCoords).r;
+	vec3 viewPosition = ReconstructViewPosition(texCoords / RenderScale, depth, ProjectionInverse);
+	vec3 position = (ViewInverse * vec4(viewPosition, 1.0)).xyz;
+	vec3 normal = DecodeNormal(texture(gNormalMap, texCoords).rg);
+	vec4 difSpec = texture(gDifSpecMap, texCoords);
+	vec3 diffuse = difSpec.rgb;
+	float shininess = DecodeShininess(difSpec.a);
 	vec3 specular = texture(gSpecularMap, texCoords).rgb;
 
 	// Values to be used in BRDF
@@ -5,11 +5,30 @@ layout (location = 1) in vec3 vertColor;
 layout (location = 2) in vec3 vertNormal;
 layout (location = 3) in vec3 vertTexCoord;
 
-uniform mat4 ProjectionMatrix, ViewMatrix, ModelMatrix;
+// Per instance, the light's index in the light store (Scene::DrawLocalLights)
+layout (location = 4) in int lightIndex;
+
+// 3 texels per light: world position and range, color, attenuation
+uniform samplerBuffer Lights;
+
+uniform mat4 ProjectionMatrix, ViewMatrix;
+uniform float ProxyScale; // pushes the proxy's faces out to the light's range
 
 out vec2 texCoord;
+flat out vec3 LightPosition;
+flat out float LightRange;
+flat out vec3 LightColor;
+flat out vec2 Attenuation;
 
 void main(){
 	texCoord = vec2(vertTexCoord.x, vertTexCoord.y);
-	gl_Position = ProjectionMatrix * ViewMatrix * ModelMatrix * vertPosition;
-}
\ No newline at end of file
+
+	vec4 positionRange = texelFetch(Lights, 3 * lightIndex);
+	LightPosition = positionRange.xyz;
+	LightRange = positionRange.w;
+	LightColor = texelFetch(Lights, 3 * lightIndex + 1).rgb;
+	Attenuation = texelFetch(Lights, 3 * lightIndex + 2).xy;
+
+	vec3 position = LightPosition + vertPosition.xyz * (LightRange * ProxyScale);
+	gl_Position = ProjectionMatrix * ViewMatrix * vec4(position, 1.0);
+}
@@ -0,0 +1,51 @@
+// G-buffer encoding, included by the deferred shaders.  gbufferpacking.h
+// has the same functions in C++.
+//
+//   gNormal   RG16     octahedral normal
+//   gDifSpec  RGBA8    diffuse, shininess (sqrt of shininess/MAX_SHININESS)
+//   gSpecular RGB10A2  specular, alpha = 1 where geometry was drawn
+//   depth     32F      position is rebuilt from it
+
+#define MAX_SHININESS 256.0
+
+// Sign that treats 0 as positive, so the fold is continuous at the seams
+vec2 SignNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Projects the unit sphere onto the octahedron |x|+|y|+|z| = 1, folds
+// the lower half over the upper one and returns the square in [0,1]
+vec2 EncodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * SignNotZero(n.xy);
+	return e * 0.5 + 0.5;
+}
+
+vec3 DecodeNormal(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * SignNotZero(n.xy);
+	return normalize(n);
+}
+
+float EncodeShininess(float shininess)
+{
+	return sqrt(clamp(shininess / MAX_SHININESS, 0.0, 1.0));
+}
+
+float DecodeShininess(float encoded)
+{
+	return encoded * encoded * MAX_SHININESS;
+}
+
+// uv and depth in [0,1] (uv relative to the rendered area)
+vec3 ReconstructViewPosition(vec2 uv, float depth, mat4 projectionInverse)
+{
+	vec4 ndc = vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec4 view = projectionInverse * ndc;
+	return view.xyz / view.w;
+}
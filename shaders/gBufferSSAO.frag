@@ -5,12 +5,14 @@
 ////////////////////////////////////////////////////////////////////////
 #version 330
 
-layout (location = 0) out vec3 gPositionDepth;
+// Only the normal: the SSAO passes rebuild positions from the depth
+// buffer (ssaoDepth.glsl)
+layout (location = 0) out vec3 gNormal;
 
 //in
-in vec3 viewPosition;
+in vec3 viewNormal;
 
 void main()
 {	
-	gPositionDepth = viewPosition;
+	gNormal = normalize(viewNormal);
 }
\ No newline at end of file
@@ -18,12 +18,12 @@ uniform mat4 ProjectionMatrix;
 uniform mat4 NormalMatrix;
 
 //out
-out vec3 viewPosition;
+out vec3 viewNormal;
 
 void main()
 {
 	mat4 MVMatrix = ViewMatrix * ModelMatrix;
 	mat4 MVPMatrix = ProjectionMatrix * MVMatrix;
-	viewPosition = (MVMatrix * vertex).xyz;
+	viewNormal = mat3(ViewMatrix) * (mat3(NormalMatrix) * vertexNormal);
 	gl_Position = MVPMatrix * vertex;
 }
\ No newline at end of file
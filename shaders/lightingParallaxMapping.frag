@@ -6,6 +6,8 @@
 #version 330
 #define M_PI 3.1415926535897932384626433832795
 
+#include "clusteredLights.glsl"
+
 //in
 in vec3 normalVec;
 in vec2 texCoord;
@@ -89,6 +91,10 @@ void main()
 	vec3 BRDF = (Kd / M_PI) + (F * G * D) /4;
 
 	gl_FragColor.xyz = BRDF * (Light) * LN + Ambient * diffuse;
+
+	// Local lights work in world space, TBN goes the other way
+	vec3 worldN = isTextured && isNormalMapped ? transpose(TBN) * N : N;
+	gl_FragColor.xyz += ClusteredLighting(worldPos, worldN, normalize(originalEyeVec), Kd, specular, shininess);
 }
 
 vec2 ApplyParallaxMapping(vec2 texCoord, vec3 eyeVec){
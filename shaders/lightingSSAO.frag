@@ -2,6 +2,8 @@
 
 #define M_PI 3.1415926535897932384626433832795
 
+#include "clusteredLights.glsl"
+
 uniform vec3 Ambient;
 uniform vec3 Light;
 
@@ -16,11 +18,11 @@ in vec3 lightVec;
 in vec3 eyeVec;
 in vec2 texCoord;
 in vec3 normalVec;
+in vec3 worldPos;
 
 uniform sampler2D groundTexture;
 uniform sampler2D ssaoFBO;
 uniform sampler2D ssaoFBOBlurred;
-uniform sampler2D gPosition;
 
 uniform float Width;
 uniform float Height;
@@ -32,7 +34,7 @@ vec2 CalcScreenTexCoord()
 
 void main(){
 
-	gl_FragColor = vec4(texture(ssaoFBO, CalcScreenTexCoord()).x);
+	gl_FragColor = vec4(IsBlurred ? texture(ssaoFBOBlurred, CalcScreenTexCoord()).x : texture(ssaoFBO, CalcScreenTexCoord()).x);
 	return;
 
 	vec3 N = normalize(normalVec);
@@ -60,9 +62,10 @@ void main(){
 
 	vec4 FinalAmbient = vec4(Ambient, 1.0f);
 	if(IsAOEnabled){
-		FinalAmbient *= texture(ssaoFBO, CalcScreenTexCoord()).r;
+		FinalAmbient *= IsBlurred ? texture(ssaoFBOBlurred, CalcScreenTexCoord()).r : texture(ssaoFBO, CalcScreenTexCoord()).r;
 	}
 
 	gl_FragColor.xyz = BRDF * (Light) * LN + FinalAmbient.xyz * diffuse;
+	gl_FragColor.xyz += ClusteredLighting(worldPos, N, V, Kd, specular, shininess);
 	
 }
\ No newline at end of file
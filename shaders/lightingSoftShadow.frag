@@ -6,6 +6,8 @@
 #version 330
 #define M_PI 3.1415926535897932384626433832795
 
+#include "clusteredLights.glsl"
+
 //in
 in vec3 normalVec;
 in vec3 lightVec;
@@ -33,6 +35,22 @@ uniform sampler2D groundTexture;
 uniform sampler2D shadowMap;
 uniform sampler2D blurredShadowMap;
 
+// Contact hardening from the summed-area table (shadowSAT.comp) in
+// place of blurredShadowMap
+uniform bool SummedAreaTable;
+uniform sampler2D ShadowSAT;  // sums of exp(SATC * (depth - 1)), hi + lo
+uniform float SATC;
+uniform float LightSize;      // filter radius in texels for a receiver twice the blocker's distance
+uniform int MaxFilterRadius;  // in texels, also the blocker search's reach
+
+// Cascaded shadows for the sun (shadowcascades.h) in place of both
+#define MAX_CASCADES 4
+uniform bool Cascaded;
+uniform int CascadeCount;
+uniform mat4 CascadeMatrices[MAX_CASCADES]; // world to layer coordinates and depth
+uniform vec2 CascadeRange[MAX_CASCADES];    // usable layer coordinates, min and max
+uniform sampler2DArray CascadeMaps;         // blurred
+
 #define	PIXEL_DEPTH 0
 #define	PIXEL_DEPTH_MAPPED 1
 #define LIGHT_DEPTH 2
@@ -52,6 +70,70 @@ float saturate(float value){
 	return clamp(value, 0.0, 1.0);
 }
 
+// Table entry; the sum left of or below the map is 0
+vec2 SATFetch(int x, int y){
+	if (x < 0 || y < 0)
+		return vec2(0.0);
+	return texelFetch(ShadowSAT, ivec2(x, y), 0).xy;
+}
+
+// PCSS with the filter from the summed-area table: the mean depth of
+// the blockers around the pixel sizes the rectangle, which then costs
+// four fetches however large it is.  Depths are mapped to [0, 1].
+float ContactHardeningVisibility(vec2 shadowIndex, float receiver){
+	ivec2 size = textureSize(ShadowSAT, 0);
+	vec2 texel = shadowIndex * vec2(size);
+
+	// Blocker search, a 4x4 grid from the unfiltered map
+	float blockerSum = 0.0;
+	int blockers = 0;
+	for (int y = 0; y < 4; ++y)
+		for (int x = 0; x < 4; ++x) {
+			vec2 offset = (vec2(x, y) - 1.5) / 1.5 * float(MaxFilterRadius);
+			ivec2 tap = clamp(ivec2(texel + offset), ivec2(0), size - 1);
+			float depth = log(texelFetch(shadowMap, tap, 0).r) / C;
+			if (depth < receiver - 0.002) {
+				blockerSum += depth;
+				++blockers;
+			}
+		}
+	if (blockers == 0)
+		return 1.0;
+
+	// Penumbra from the distances to the light
+	float near = lightDistance - groundRadius;
+	float blockerDistance = near + blockerSum / float(blockers) * 2.0 * groundRadius;
+	float receiverDistance = near + receiver * 2.0 * groundRadius;
+	int radius = clamp(int(LightSize * (receiverDistance - blockerDistance) / blockerDistance + 0.5), 1, MaxFilterRadius);
+
+	ivec2 center = clamp(ivec2(texel), ivec2(0), size - 1);
+	ivec2 low = max(center - radius, ivec2(0)) - 1; // exclusive
+	ivec2 high = min(center + radius, size - 1);
+	vec2 a = SATFetch(high.x, high.y);
+	vec2 b = SATFetch(low.x, high.y);
+	vec2 c = SATFetch(high.x, low.y);
+	vec2 d = SATFetch(low.x, low.y);
+	// Nearby entries first, hi and lo parts apart
+	float sum = ((a.x - b.x) - (c.x - d.x)) + ((a.y - b.y) - (c.y - d.y));
+	float area = float((high.x - low.x) * (high.y - low.y));
+
+	return saturate(sum / area * exp(-SATC * (receiver - 1.0)));
+}
+
+// From the first cascade whose usable part holds the point; the
+// nearer cascades are the sharper.  Past the last one is lit.
+float CascadeVisibility(vec3 position){
+	for (int i = 0; i < CascadeCount; ++i) {
+		vec3 coord = (CascadeMatrices[i] * vec4(position, 1.0)).xyz;
+		if (all(greaterThanEqual(coord.xy, vec2(CascadeRange[i].x))) &&
+			all(lessThanEqual(coord.xy, vec2(CascadeRange[i].y))) && coord.z <= 1.0) {
+			float occluder = texture(CascadeMaps, vec3(coord.xy, float(i))).r;
+			return saturate(occluder * exp(-C * coord.z));
+		}
+	}
+	return 1.0;
+}
+
 void main()
 {	
 	vec3 N = normalize(normalVec);
@@ -92,6 +174,10 @@ void main()
 	float receiver = mapValue(pixelDepth, lightDistance - groundRadius, lightDistance + groundRadius);
 
 	visibility = saturate(occluder * exp(-C * receiver));
+	if (SummedAreaTable)
+		visibility = ContactHardeningVisibility(shadowIndex, receiver);
+	if (Cascaded)
+		visibility = CascadeVisibility(worldPos);
 
 	// bias to be used to prevent floating point calculation errors
 	// doing so stops shadow acne problem
@@ -105,6 +191,8 @@ void main()
 	}else{ // This is for defining areas out of shadow frustum. For this assignment, the light source is like a directional light 
 		inShadow = true;
 	}
+	if (Cascaded) // the cascades cover the view, visibility has it all
+		inShadow = false;
 
 	//*********** BRDF PART *****************
 
@@ -140,6 +228,7 @@ void main()
 	case NONE_SHADOW: // clear debugging
 		if(inShadow){ // if the fragment is in the shadow area, I don't need to calculate BRDF - just multipyling color with ambient light
 			gl_FragColor.xyz = Ambient * diffuse; // Default value
+			gl_FragColor.xyz += ClusteredLighting(worldPos, N, V, Kd, specular, shininess);
 			//gl_FragColor.xyz = vec3(1.0f, 0.8f, 0.2f); //For debugging
 		}else{
 			vec3 F = specular + (1 - specular) * pow((1 - LH), 5);
@@ -153,6 +242,7 @@ void main()
 			BRDF = max(BRDF, vec3(0.0));
 
 			gl_FragColor.xyz = BRDF * (Light) * LN + Ambient * diffuse;
+			gl_FragColor.xyz += ClusteredLighting(worldPos, N, V, Kd, specular, shininess);
 		}
 	}
 
@@ -10,6 +10,7 @@ in vec4 position;
 uniform float C;
 uniform float groundRadius;
 uniform float lightDistance;
+uniform bool Orthographic; // a cascade, whose depth is linear already
 
 float mapValue(float value, float min, float max){
 	return (value - min) / (max - min);
@@ -25,6 +26,8 @@ void main()
 
 	float depth = (1.0 / gl_FragCoord.w);
 	float mappedDepth = mapValue(depth, lightDistance - groundRadius, lightDistance + groundRadius);
+	if (Orthographic)
+		mappedDepth = gl_FragCoord.z;
 
 	gl_FragData[0].r = exp(C * mappedDepth);
 
@@ -0,0 +1,48 @@
+// View space from the SSAO depth buffers, included by the SSAO passes.
+// The SSAO geometry pass keeps only hardware depth and normals; the
+// passes rebuild positions with the inverse projection.  A depth buffer
+// here is the depth texture of gBufferForSSAO or, in deferred mode, of
+// the deferred gBuffer, or an R32F downsample holding the same values.
+//
+// Cleared depth (1) is the background.  It comes back at z = +1, so
+// the passes keep testing z >= 0 for it.
+
+uniform mat4 ProjectionInverse;
+
+// View z of a depth value; a perspective depth does not depend on x, y
+float ViewDepth(float depth)
+{
+	if (depth >= 1.0)
+		return 1.0;
+	vec2 zw = (ProjectionInverse * vec4(0.0, 0.0, depth * 2.0 - 1.0, 1.0)).zw;
+	return zw.x / zw.y;
+}
+
+// uv in [0,1] over the rendered area
+vec3 ViewPosition(vec2 uv, float depth)
+{
+	if (depth >= 1.0)
+		return vec3(0.0, 0.0, 1.0);
+	vec4 view = ProjectionInverse * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	return view.xyz / view.w;
+}
+
+// Position at a pixel center of a depth buffer with size rendered pixels
+vec3 FetchViewPosition(sampler2D depthBuffer, ivec2 pixel, ivec2 size)
+{
+	return ViewPosition((vec2(pixel) + 0.5) / vec2(size), texelFetch(depthBuffer, pixel, 0).r);
+}
+
+// Normal from the neighbor on the side that continues the surface
+vec3 ViewNormal(sampler2D depthBuffer, ivec2 pixel, ivec2 size, vec3 center)
+{
+	ivec2 last = size - 1;
+	vec3 left = FetchViewPosition(depthBuffer, clamp(pixel - ivec2(1, 0), ivec2(0), last), size);
+	vec3 right = FetchViewPosition(depthBuffer, clamp(pixel + ivec2(1, 0), ivec2(0), last), size);
+	vec3 down = FetchViewPosition(depthBuffer, clamp(pixel - ivec2(0, 1), ivec2(0), last), size);
+	vec3 up = FetchViewPosition(depthBuffer, clamp(pixel + ivec2(0, 1), ivec2(0), last), size);
+
+	vec3 dx = abs(right.z - center.z) < abs(center.z - left.z) ? right - center : center - left;
+	vec3 dy = abs(up.z - center.z) < abs(center.z - down.z) ? up - center : center - down;
+	return normalize(cross(dx, dy));
+}
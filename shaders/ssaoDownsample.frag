@@ -0,0 +1,27 @@
+#version 330
+
+// Halves the depth buffer for low resolution AO.  Of each 2x2 block
+// one depth is kept as is, never an average: the nearest on even
+// checkerboard texels and the farthest on odd ones, so both sides of
+// a silhouette survive in the smaller buffer.  Depth grows with
+// distance and the background is cleared to 1, the farthest there is.
+
+out float FragDepth;
+
+uniform sampler2D Source;
+uniform ivec2 SourceSize; // rendered part of Source in pixels
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	ivec2 corner = 2 * pixel;
+	ivec2 last = SourceSize - 1;
+
+	float d0 = texelFetch(Source, min(corner, last), 0).r;
+	float d1 = texelFetch(Source, min(corner + ivec2(1, 0), last), 0).r;
+	float d2 = texelFetch(Source, min(corner + ivec2(0, 1), last), 0).r;
+	float d3 = texelFetch(Source, min(corner + ivec2(1, 1), last), 0).r;
+
+	bool nearest = ((pixel.x + pixel.y) & 1) == 0;
+	FragDepth = nearest ? min(min(d0, d1), min(d2, d3)) : max(max(d0, d1), max(d2, d3));
+}
@@ -0,0 +1,95 @@
+#version 330
+
+// Horizon based occlusion, after GTAO (Jimenez et al., "Practical
+// Realtime Strategies for Accurate Indirect Occlusion").  A few screen
+// space directions are marched on both sides of the pixel; in each
+// direction's slice the highest horizon found bounds the visible arc,
+// and the cosine weighted visibility of that arc around the projected
+// normal has a closed form.  Taps = 2 * Directions * Steps.
+
+#define M_PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966
+
+#include "ssaoDepth.glsl"
+
+out vec4 FragColor;
+
+uniform sampler2D gDepthMap;
+uniform sampler2D NoiseTexture; // 4x4, tiled: slice rotation and step jitter
+uniform ivec2 Size;             // rendered part of gDepthMap in pixels
+uniform mat4 ProjectionMatrix;
+uniform float Radius;           // view space
+uniform int Directions;
+uniform int Steps;
+uniform int FrameIndex;         // temporal mode: shifts the noise every frame
+
+// Cosine of the highest horizon along direction, starting from lowest
+float Horizon(ivec2 pixel, vec3 position, vec3 V, vec2 direction, float stepPixels, float jitter, float lowest)
+{
+	float horizonCos = lowest;
+	for (int j = 0; j < Steps; ++j) {
+		ivec2 tap = pixel + ivec2(round(direction * stepPixels * (float(j) + jitter)));
+		if (any(lessThan(tap, ivec2(0))) || any(greaterThanEqual(tap, Size)))
+			break;
+
+		vec3 samplePosition = FetchViewPosition(gDepthMap, tap, Size);
+		if (samplePosition.z >= 0.0) // background never occludes
+			continue;
+
+		vec3 delta = samplePosition - position;
+		float distance = length(delta);
+		float sampleCos = dot(delta / distance, V);
+
+		// Occluders fade out towards the radius
+		float falloff = clamp(1.0 - distance * distance / (Radius * Radius), 0.0, 1.0);
+		horizonCos = max(horizonCos, mix(lowest, sampleCos, falloff));
+	}
+	return horizonCos;
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec3 position = FetchViewPosition(gDepthMap, pixel, Size);
+	if (position.z >= 0.0) {
+		FragColor = vec4(1.0);
+		return;
+	}
+	vec3 N = ViewNormal(gDepthMap, pixel, Size, position);
+	vec3 V = normalize(-position);
+
+	// Radius on screen, spread over the steps; at least a pixel a step
+	float radiusPixels = min(Radius * ProjectionMatrix[1][1] * 0.5 * float(Size.y) / -position.z, 256.0);
+	float stepPixels = max(radiusPixels / float(Steps), 1.0);
+
+	vec2 noise = texture(NoiseTexture, gl_FragCoord.xy / 4.0).xy * 0.5 + 0.5;
+	noise = fract(noise + float(FrameIndex) * vec2(0.618034, 0.754878));
+
+	float visibility = 0.0;
+	for (int i = 0; i < Directions; ++i) {
+		float phi = (float(i) + noise.x) * M_PI / float(Directions);
+		vec2 omega = vec2(cos(phi), sin(phi));
+
+		// Slice plane through V and omega, normal projected into it
+		vec3 direction = vec3(omega, 0.0);
+		vec3 orthoDirection = direction - dot(direction, V) * V;
+		vec3 axis = normalize(cross(direction, V));
+		vec3 projectedNormal = N - axis * dot(N, axis);
+		float projectedLength = length(projectedNormal);
+
+		float cosN = clamp(dot(projectedNormal, V) / projectedLength, 0.0, 1.0);
+		float n = sign(dot(orthoDirection, projectedNormal)) * acos(cosN);
+
+		float cos1 = Horizon(pixel, position, V, omega, stepPixels, noise.y, cos(n + HALF_PI));
+		float cos0 = Horizon(pixel, position, V, -omega, stepPixels, noise.y, cos(n - HALF_PI));
+
+		float h0 = n + clamp(-acos(cos0) - n, -HALF_PI, HALF_PI);
+		float h1 = n + clamp(acos(cos1) - n, -HALF_PI, HALF_PI);
+
+		float arc0 = (cosN + 2.0 * h0 * sin(n) - cos(2.0 * h0 - n)) / 4.0;
+		float arc1 = (cosN + 2.0 * h1 * sin(n) - cos(2.0 * h1 - n)) / 4.0;
+		visibility += projectedLength * (arc0 + arc1);
+	}
+
+	FragColor = vec4(visibility / float(Directions));
+}
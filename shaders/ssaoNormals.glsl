@@ -0,0 +1,19 @@
+// View space normals for the SSAO passes, included by the ones that
+// read them.  In forward mode they come from gBufferForSSAO as they are;
+// in deferred mode from the deferred gBuffer, whose world normals are
+// packed octahedrally (gBufferPacking.glsl).  Fetched, not filtered:
+// blending packed normals across the octahedron's folds is meaningless.
+
+#include "gBufferPacking.glsl"
+
+uniform sampler2D gNormal;
+uniform bool PackedNormals;
+uniform mat4 ViewMatrix;   // packed normals only
+
+vec3 FetchNormal(ivec2 pixel)
+{
+	vec4 stored = texelFetch(gNormal, pixel, 0);
+	if (PackedNormals)
+		return normalize(mat3(ViewMatrix) * DecodeNormal(stored.xy));
+	return normalize(stored.xyz);
+}
@@ -1,40 +1,101 @@
 #version 330
 
-uniform sampler2D gPositionDepth;
+// KERNEL_SIZE (8, 16, 32, 64 or 128) is defined by the program, one
+// program per size, so the sample loop has a constant bound and is
+// unrolled.  The samples used are every (128 / KERNEL_SIZE)th of the
+// 128 kernel points, which are ordered by distance, so a small kernel
+// still covers the whole radius.
+#ifndef KERNEL_SIZE
+#define KERNEL_SIZE 128
+#endif
+#define KERNEL_STRIDE (128 / KERNEL_SIZE)
+
+#include "ssaoDepth.glsl"
+#include "ssaoNormals.glsl"
+
+uniform sampler2D gDepthMap;   // full resolution depth or a downsample of it
 uniform int gBufDebug;
-uniform int KernelSize;
 uniform float NoiseSize;
 uniform float Radius;
 
-uniform vec3 SampleArray[128];
+uniform vec3 SampleArray[128]; // hemisphere around +z
 uniform mat4 ProjectionMatrix;
+uniform vec2 RenderScale; // rendered part of the targets (dynamic resolution)
+uniform vec2 NormalScale; // rendered part of gNormal (full resolution)
+
+// Temporal mode: the strided subset shifts every frame and the noise
+// rotation advances by the golden angle, so the history sees every
+// sample in every orientation
+uniform bool Temporal;
+uniform int FrameIndex;
+uniform sampler2D NoiseTexture;
+
+// Depth pyramid mode (full resolution only): taps read linear depth
+// from a level that grows with their distance to the pixel, so taps
+// stay about 2^LOG_TAP_SPREAD texels apart whatever the radius and
+// neighbouring pixels keep hitting the same cache lines
+#define LOG_TAP_SPREAD 3
+uniform bool UseDepthPyramid;
+uniform sampler2D DepthPyramid; // view z, see ssaoDepthPyramid.comp
+uniform int PyramidLevels;
+uniform ivec2 PyramidSize;      // rendered pixels covered by level 0
 
 in vec2 texCoord;
 
+// View z of the surface seen at target texture coordinates uv
+float TapDepth(vec2 uv)
+{
+	if (!UseDepthPyramid)
+		return ViewDepth(texture(gDepthMap, uv).r);
+
+	vec2 tap = uv / RenderScale * vec2(PyramidSize);
+	float distance = length(tap - gl_FragCoord.xy);
+	int level = clamp(int(log2(max(distance, 1.0))) - LOG_TAP_SPREAD, 0, PyramidLevels - 1);
+	ivec2 texel = clamp(ivec2(tap), ivec2(0), PyramidSize - 1) >> level;
+	return texelFetch(DepthPyramid, min(texel, max(PyramidSize >> level, 1) - 1), level).r;
+}
+
 void main()
 {
-	vec3 position = texture(gPositionDepth, texCoord).xyz;
+	vec3 position = ViewPosition(texCoord, texture(gDepthMap, texCoord * RenderScale).r);
+	if (position.z >= 0.0) { // background
+		gl_FragColor = vec4(1.0);
+		return;
+	}
+	vec3 normal = FetchNormal(ivec2(texCoord * NormalScale * vec2(textureSize(gNormal, 0))));
 
-	float AO = 0.0;
+	// Tangent frame around the normal, spun about it by the noise
+	vec2 noise = texture(NoiseTexture, gl_FragCoord.xy / 4.0).xy;
+	int first = 0;
+	if (Temporal) {
+		float angle = atan(noise.y, noise.x) + float(FrameIndex) * 2.39996323; // golden angle
+		noise = vec2(cos(angle), sin(angle));
+		first = FrameIndex % KERNEL_STRIDE;
+	}
+	vec3 randomVec = vec3(noise, 0.0);
+	vec3 tangent = randomVec - normal * dot(randomVec, normal);
+	tangent = dot(tangent, tangent) > 1e-6 ? normalize(tangent) : normalize(cross(normal, vec3(1.0, 0.0, 0.0)));
+	mat3 TBN = mat3(tangent, cross(normal, tangent), normal);
 
-	for(int i = 0; i < KernelSize; i++){
-		vec3 samplePos = position + SampleArray[i];
-		vec4 offset = vec4(samplePos, 1.0);
-		offset = ProjectionMatrix * offset; //Project to the back plane
-		offset.xy /= offset.w; //perspective division
-		offset.xy = offset.xy * 0.5 + vec2(0.5); // [0,1] range
+	float AO = 0.0;
+	for (int i = 0; i < KERNEL_SIZE; i++) {
+		vec3 samplePos = position + TBN * SampleArray[i * KERNEL_STRIDE + first] * Radius;
 
-		float sampleDepth = texture(gPositionDepth, offset.xy).b;
+		vec4 offset = ProjectionMatrix * vec4(samplePos, 1.0); // project to the screen
+		offset.xy /= offset.w;
+		offset.xy = (offset.xy * 0.5 + vec2(0.5)) * RenderScale;
 
-		/*float rangeCheck = smoothstep(0.0, 1.0, Radius / abs(position.z - sampleDepth));
-		AO += (sampleDepth >= samplePos.z ? 1.0 : 0.0) * rangeCheck;*/
+		float sampleDepth = TapDepth(offset.xy);
+		if (sampleDepth >= 0.0) // background
+			continue;
 
-		if(abs(position.z - sampleDepth) < Radius){
-			AO += step(sampleDepth, samplePos.z);
-		}
+		// Occluded when the surface seen there is in front of the sample;
+		// surfaces far outside the radius fade out instead of darkening
+		float rangeCheck = smoothstep(0.0, 1.0, Radius / abs(position.z - sampleDepth));
+		AO += (sampleDepth >= samplePos.z + 0.025 ? 1.0 : 0.0) * rangeCheck;
 	}
 
-	AO = 1.0 - AO/128.0;
+	AO = 1.0 - AO / float(KERNEL_SIZE);
 
 	gl_FragColor = vec4(pow(AO, 2.0));
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+#version 330
+
+// Temporal accumulation of AO.  Each pixel finds where its surface was
+// last frame through the previous view projection and blends this
+// frame's (few sample, rotated) AO into the history found there.
+// History is dropped where the surface it describes is not this one:
+// after a disocclusion the stored depth disagrees with the depth the
+// point had last frame, and across creases the normals disagree.
+//
+// History texels: AO, view depth (-z), octahedral world normal.
+
+#include "gBufferPacking.glsl"
+#include "ssaoDepth.glsl"
+
+out vec4 FragColor;
+
+uniform sampler2D CurrentAO;
+uniform sampler2D gDepthMap;     // this frame's depth
+uniform sampler2D History;
+uniform ivec2 Size;              // rendered part of this frame's targets
+uniform ivec2 HistorySize;       // rendered part of the history last frame
+uniform bool HistoryValid;
+uniform mat4 ViewInverse;
+uniform mat4 PreviousView;
+uniform mat4 PreviousViewProjection;
+uniform float Blend;             // weight of this frame's AO
+uniform float DepthTolerance;    // relative
+uniform float NormalTolerance;   // minimum cosine
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float ao = texelFetch(CurrentAO, pixel, 0).r;
+	vec3 position = FetchViewPosition(gDepthMap, pixel, Size);
+	if (position.z >= 0.0) {
+		FragColor = vec4(1.0, 0.0, 0.0, 0.0);
+		return;
+	}
+
+	vec3 world = (ViewInverse * vec4(position, 1.0)).xyz;
+	vec3 normal = normalize((ViewInverse * vec4(ViewNormal(gDepthMap, pixel, Size, position), 0.0)).xyz);
+
+	float result = ao;
+	if (HistoryValid) {
+		vec4 clip = PreviousViewProjection * vec4(world, 1.0);
+		vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+		ivec2 previous = ivec2(floor(uv * vec2(HistorySize)));
+
+		if (clip.w > 0.0 && all(greaterThanEqual(previous, ivec2(0))) && all(lessThan(previous, HistorySize))) {
+			vec4 history = texelFetch(History, previous, 0);
+			float expectedDepth = -(PreviousView * vec4(world, 1.0)).z;
+
+			bool depthMatches = abs(history.g - expectedDepth) < DepthTolerance * expectedDepth;
+			bool normalMatches = dot(DecodeNormal(history.ba), normal) > NormalTolerance;
+			if (depthMatches && normalMatches)
+				result = mix(history.r, ao, Blend);
+		}
+	}
+
+	FragColor = vec4(result, -position.z, EncodeNormal(normal));
+}
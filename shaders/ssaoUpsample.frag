@@ -0,0 +1,62 @@
+#version 330
+
+// Joint bilateral upsample of low resolution AO.  Each pixel blends
+// the four nearest low resolution values with bilinear weights scaled
+// by how well their depth and normal match the pixel's own, so AO
+// does not bleed across silhouettes.
+
+#include "ssaoDepth.glsl"
+
+out float FragColor;
+
+uniform sampler2D LowAO;
+uniform sampler2D LowDepth;
+uniform sampler2D gDepthMap;   // full resolution depth
+uniform ivec2 LowSize;         // rendered part of the low resolution targets
+uniform ivec2 Size;            // rendered part of gDepthMap
+uniform int Factor;            // 2 or 4
+uniform float DepthSharpness;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec3 position = FetchViewPosition(gDepthMap, pixel, Size);
+	if (position.z >= 0.0) {
+		FragColor = 1.0;
+		return;
+	}
+	vec3 normal = ViewNormal(gDepthMap, pixel, Size, position);
+
+	vec2 low = (vec2(pixel) + 0.5) / float(Factor) - 0.5;
+	ivec2 base = ivec2(floor(low));
+	vec2 f = low - vec2(base);
+
+	float total = 0.0;
+	float weightSum = 0.0;
+	float nearestAO = 1.0;
+	float nearestDifference = 1e30;
+	for (int i = 0; i < 4; ++i) {
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tap = clamp(base + offset, ivec2(0), LowSize - 1);
+		vec3 tapPosition = FetchViewPosition(LowDepth, tap, LowSize);
+		float ao = texelFetch(LowAO, tap, 0).r;
+
+		float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+		float difference = abs(tapPosition.z - position.z) / -position.z;
+		float depthWeight = 1.0 / (1.0 + DepthSharpness * difference);
+		depthWeight *= depthWeight;
+		float normalWeight = pow(max(dot(normal, ViewNormal(LowDepth, tap, LowSize, tapPosition)), 0.0), 8.0);
+
+		float weight = (bilinear + 1e-3) * depthWeight * normalWeight;
+		total += weight * ao;
+		weightSum += weight;
+
+		if (difference < nearestDifference) {
+			nearestDifference = difference;
+			nearestAO = ao;
+		}
+	}
+
+	// Nothing matched (thin features): take the closest depth instead
+	FragColor = weightSum > 1e-4 ? total / weightSum : nearestAO;
+}
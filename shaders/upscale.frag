@@ -0,0 +1,71 @@
+#version 330
+
+// Upscales the dynamically sized scene image to the window.  Only the
+// lower left RenderScale part of sceneColor holds the current frame.
+
+in vec2 texCoord;
+
+out vec4 FragColor;
+
+uniform sampler2D sceneColor;
+uniform vec2 RenderScale;
+uniform int Filter; // 0 bilinear, 1 Catmull-Rom
+
+vec4 SampleClamped(vec2 uv, vec2 minUV, vec2 maxUV)
+{
+	return texture(sceneColor, clamp(uv, minUV, maxUV));
+}
+
+// Catmull-Rom bicubic with 9 bilinear fetches: the two middle weights
+// of each axis are merged into one fetch placed between the texels.
+vec4 CatmullRom(vec2 uv, vec2 texSize, vec2 minUV, vec2 maxUV)
+{
+	vec2 samplePos = uv * texSize;
+	vec2 texPos1 = floor(samplePos - 0.5) + 0.5;
+	vec2 f = samplePos - texPos1;
+
+	vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+	vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+	vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+	vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+	vec2 w12 = w1 + w2;
+	vec2 offset12 = w2 / w12;
+
+	vec2 texPos0 = (texPos1 - 1.0) / texSize;
+	vec2 texPos3 = (texPos1 + 2.0) / texSize;
+	vec2 texPos12 = (texPos1 + offset12) / texSize;
+
+	vec4 result = vec4(0.0);
+	result += SampleClamped(vec2(texPos0.x,  texPos0.y),  minUV, maxUV) * w0.x  * w0.y;
+	result += SampleClamped(vec2(texPos12.x, texPos0.y),  minUV, maxUV) * w12.x * w0.y;
+	result += SampleClamped(vec2(texPos3.x,  texPos0.y),  minUV, maxUV) * w3.x  * w0.y;
+
+	result += SampleClamped(vec2(texPos0.x,  texPos12.y), minUV, maxUV) * w0.x  * w12.y;
+	result += SampleClamped(vec2(texPos12.x, texPos12.y), minUV, maxUV) * w12.x * w12.y;
+	result += SampleClamped(vec2(texPos3.x,  texPos12.y), minUV, maxUV) * w3.x  * w12.y;
+
+	result += SampleClamped(vec2(texPos0.x,  texPos3.y),  minUV, maxUV) * w0.x  * w3.y;
+	result += SampleClamped(vec2(texPos12.x, texPos3.y),  minUV, maxUV) * w12.x * w3.y;
+	result += SampleClamped(vec2(texPos3.x,  texPos3.y),  minUV, maxUV) * w3.x  * w3.y;
+
+	// The negative lobes can overshoot
+	return max(result, vec4(0.0));
+}
+
+void main()
+{
+	vec2 texSize = vec2(textureSize(sceneColor, 0));
+
+	// Stay half a texel inside the rendered part so filtering never
+	// picks up what an older, larger frame left outside of it
+	vec2 minUV = 0.5 / texSize;
+	vec2 maxUV = RenderScale - 0.5 / texSize;
+
+	vec2 uv = texCoord * RenderScale;
+
+	if (Filter == 1)
+		FragColor = CatmullRom(uv, texSize, minUV, maxUV);
+	else
+		FragColor = SampleClamped(uv, minUV, maxUV);
+}
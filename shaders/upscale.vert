@@ -0,0 +1,13 @@
+#version 330
+
+layout (location = 0) in vec4 vertPosition;
+layout (location = 1) in vec3 vertColor;
+layout (location = 2) in vec3 vertNormal;
+layout (location = 3) in vec3 vertTexCoord;
+
+out vec2 texCoord;
+
+void main(){
+	texCoord = vec2(vertTexCoord.x, vertTexCoord.y);
+	gl_Position = vertPosition;
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////
+// Cascaded exponential shadow maps.  See shadowcascades.h.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cmath>
+
+#include <glload/gl_3_3.h>
+#include <glload/gl_load.hpp>
+
+#include "shadowcascades.h"
+
+ShadowCascades::ShadowCascades()
+	: count(3), distance(250.0f), lambda(0.5f), shadowArray(0), blurredArray(0), size(0),
+	  fbo(0), depthBuffer(0), frame(0), refitPending(true)
+{
+	const int intervals[MaxShadowCascades] = { 1, 1, 2, 4 };
+	for (int i = 0; i < MaxShadowCascades; ++i) {
+		resolution[i] = 1024;
+		interval[i] = intervals[i];
+		splitDepth[i] = 0.0f;
+	}
+	for (int i = 0; i < 13; ++i)
+		fitKey[i] = 0.0f;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Both arrays get MaxShadowCascades layers at the largest resolution in
+// use, so changing the count or a smaller resolution keeps them.
+void ShadowCascades::Validate()
+{
+	count = std::min(std::max(count, 2), MaxShadowCascades);
+	int needed = 0;
+	for (int i = 0; i < count; ++i)
+		needed = std::max(needed, resolution[i]);
+	if (needed == size)
+		return;
+	size = needed;
+
+	unsigned int* arrays[2] = { &shadowArray, &blurredArray };
+	for (int a = 0; a < 2; ++a) {
+		if (*arrays[a])
+			glDeleteTextures(1, arrays[a]);
+		glGenTextures(1, arrays[a]);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, *arrays[a]);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, size, size, MaxShadowCascades, 0, GL_RED, GL_FLOAT, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (!fbo)
+		glGenFramebuffers(1, &fbo);
+	if (depthBuffer)
+		glDeleteRenderbuffers(1, &depthBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	refitPending = true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Orthographic projection, as glOrtho
+static MAT4 Orthographic(float left, float right, float bottom, float top, float nearPlane, float farPlane)
+{
+	MAT4 P;
+	P[0][0] = 2.0f / (right - left);
+	P[0][3] = -(right + left) / (right - left);
+	P[1][1] = 2.0f / (top - bottom);
+	P[1][3] = -(top + bottom) / (top - bottom);
+	P[2][2] = -2.0f / (farPlane - nearPlane);
+	P[2][3] = -(farPlane + nearPlane) / (farPlane - nearPlane);
+	return P;
+}
+
+static vec3 TransformPoint(const MAT4& M, vec3 p)
+{
+	return vec3(M[0][0] * p.x + M[0][1] * p.y + M[0][2] * p.z + M[0][3],
+		M[1][0] * p.x + M[1][1] * p.y + M[1][2] * p.z + M[1][3],
+		M[2][0] * p.x + M[2][1] * p.y + M[2][2] * p.z + M[2][3]);
+}
+
+unsigned int ShadowCascades::Fit(MAT4 view, float rx, float ry, float front,
+	vec3 lightDirection, vec3 sceneCenter, float sceneRadius)
+{
+	lightDirection = normalize(lightDirection);
+
+	// Everything but the camera's placement; a change refits every cascade
+	float key[13] = { lightDirection.x, lightDirection.y, lightDirection.z, float(count),
+		distance, lambda, rx, ry, front };
+	for (int i = 0; i < MaxShadowCascades; ++i)
+		key[9 + i] = float(resolution[i]);
+	bool refitAll = refitPending || !std::equal(key, key + 13, fitKey);
+	std::copy(key, key + 13, fitKey);
+	refitPending = false;
+
+	// Light space: looking down lightDirection, z toward the light
+	vec3 up = std::fabs(lightDirection.z) > 0.99f ? vec3(0.0f, 1.0f, 0.0f) : vec3(0.0f, 0.0f, 1.0f);
+	vec3 right = normalize(cross(lightDirection, up));
+	up = cross(right, lightDirection);
+	MAT4 rotation;
+	for (int j = 0; j < 3; ++j) {
+		rotation[0][j] = right[j];
+		rotation[1][j] = up[j];
+		rotation[2][j] = -lightDirection[j];
+	}
+
+	MAT4 eyeToWorld = view.inverse();
+	unsigned int due = 0;
+	float nearDepth = front;
+	for (int i = 0; i < count; ++i) {
+		// Practical split scheme: a blend of logarithmic and uniform
+		float t = float(i + 1) / count;
+		float farDepth = lambda * front * std::pow(distance / front, t) + (1.0f - lambda) * (front + (distance - front) * t);
+		if (refitAll || (frame + i) % std::max(interval[i], 1) == 0) {
+			FitCascade(i, eyeToWorld, nearDepth, farDepth, rx, ry, rotation, sceneCenter, sceneRadius);
+			due |= 1u << i;
+		}
+		nearDepth = farDepth;
+	}
+	++frame;
+	return due;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Bounding sphere of the slice between nearDepth and farDepth: its
+// center is on the view axis where the near and far corners are
+// equally far, or on the far face if that is closer.  Then a texel
+// snapped orthographic box around it, deepened toward the light to
+// take in every caster of the scene.
+void ShadowCascades::FitCascade(int cascade, const MAT4& eyeToWorld, float nearDepth, float farDepth,
+	float rx, float ry, const MAT4& rotation, vec3 sceneCenter, float sceneRadius)
+{
+	float k2 = rx * rx + ry * ry; // squared corner offset per unit of depth
+	float centerDepth = std::min(0.5f * (nearDepth + farDepth) * (1.0f + k2), farDepth);
+	float radius = std::sqrt(farDepth * farDepth * k2 + (farDepth - centerDepth) * (farDepth - centerDepth));
+	vec3 center = TransformPoint(rotation, TransformPoint(eyeToWorld, vec3(0.0f, 0.0f, -centerDepth)));
+
+	// Whole texels, sideways and in depth
+	float texel = 2.0f * radius / resolution[cascade];
+	center.x = std::floor(center.x / texel) * texel;
+	center.y = std::floor(center.y / texel) * texel;
+	float top = std::max(center.z + radius, TransformPoint(rotation, sceneCenter).z + sceneRadius);
+	top = std::ceil(top / texel) * texel;
+	float bottom = std::floor((center.z - radius) / texel) * texel;
+
+	lightView[cascade] = rotation;
+	lightProjection[cascade] = Orthographic(center.x - radius, center.x + radius,
+		center.y - radius, center.y + radius, -top, -bottom);
+
+	// Into the used corner of the layer
+	float scale = float(resolution[cascade]) / size;
+	shadowMatrix[cascade] = Translate(0.5f * scale, 0.5f * scale, 0.5f) * Scale(0.5f * scale, 0.5f * scale, 0.5f)
+		* lightProjection[cascade] * lightView[cascade];
+	splitDepth[cascade] = farDepth;
+}
+
+void ShadowCascades::BindLayer(int cascade)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadowArray, 0, cascade);
+	glViewport(0, 0, resolution[cascade], resolution[cascade]);
+}
+
+void ShadowCascades::Unbind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////
+// Cascaded exponential shadow maps for the sun, taken as a directional
+// light.  The view frustum up to distance is cut into count slices
+// (between uniform and logarithmic splits by lambda), and every slice
+// gets an orthographic light projection around its bounding sphere.
+// The sphere depends only on the slice's depths and the field of view,
+// so the projection keeps its size as the camera turns, and its center
+// is snapped to whole texels in light space, so the shadow edges stay
+// put as the camera moves.
+//
+// The cascades are layers of one R32F texture array, allocated at the
+// largest cascade's resolution; a smaller cascade renders into the
+// corner of its layer and its shadow matrix scales into that corner.
+// A cascade is refit and rendered every interval frames only, and keeps
+// the matrices it was rendered with in between; the lighting shader
+// picks, per pixel, the first cascade that covers it.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _SHADOWCASCADES_
+#define _SHADOWCASCADES_
+
+#include "transform.h"
+
+const int MaxShadowCascades = 4;
+
+class ShadowCascades
+{
+public:
+	ShadowCascades();
+
+	int count;                         // 2 to MaxShadowCascades
+	float distance;                    // far end of the last slice, from the eye
+	float lambda;                      // 0 uniform splits, 1 logarithmic
+	int resolution[MaxShadowCascades]; // texels per side
+	int interval[MaxShadowCascades];   // frames between updates
+
+	// Reallocates the arrays if the resolutions changed them; before Fit
+	void Validate();
+
+	// Refits the cascades due this frame for a camera (view, and rx, ry,
+	// front as given to Perspective) and the light's direction.  Casters
+	// are looked for within the scene's bounding sphere.  Returns a bit
+	// per cascade to render.
+	unsigned int Fit(MAT4 view, float rx, float ry, float front,
+		vec3 lightDirection, vec3 sceneCenter, float sceneRadius);
+
+	// Targets a cascade's layer, viewport included
+	void BindLayer(int cascade);
+	void Unbind();
+
+	// Per cascade, as of its last Fit
+	MAT4 lightView[MaxShadowCascades], lightProjection[MaxShadowCascades];
+	MAT4 shadowMatrix[MaxShadowCascades]; // world to layer coordinates and depth in [0, 1]
+	float splitDepth[MaxShadowCascades];  // far end of the slice
+
+	unsigned int shadowArray, blurredArray; // GL_TEXTURE_2D_ARRAY, R32F
+	int size;                               // of the layers
+
+private:
+	void FitCascade(int cascade, const MAT4& eyeToWorld, float nearDepth, float farDepth,
+		float rx, float ry, const MAT4& rotation, vec3 sceneCenter, float sceneRadius);
+
+	unsigned int fbo, depthBuffer;
+	unsigned int frame;
+	float fitKey[13];  // what the fits depend on besides the camera; a change refits all
+	bool refitPending; // new layers hold nothing yet
+};
+
+#endif
@@ -0,0 +1,747 @@
+///////////////////////////////////////////////////////////////////////
+// CPU reference of the SSAO pipeline, see ssaoreference.h.
+//
+// The scalar and AVX2 paths do the same float operations in the same
+// order (no FMA), so they agree to rounding; the shaders may differ a
+// little more where the GPU contracts to FMA or filters differently.
+////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "ssaoreference.h"
+#include "threadpool.h"
+
+// MSVC takes AVX2 intrinsics anywhere; GCC and Clang need the function
+// compiled for it, which keeps the rest of the program runnable on any
+// x86-64 (the path is only taken after CpuHasAVX2)
+#if defined(_MSC_VER)
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+const int MaxBlurRadius = 8; // as in the blur shader
+const float OcclusionBias = 0.025f;
+const int RowsPerJob = 8;
+
+////////////////////////////////////////////////////////////////////////
+// Kernel and noise
+
+void BuildSSAOKernel(vec3 kernel[SSAOKernelPoints])
+{
+	std::default_random_engine generator(1);
+	std::uniform_real_distribution<float> random(0.0f, 1.0f);
+
+	for (int i = 0; i < SSAOKernelPoints; ++i) {
+		float scale = static_cast<float>(i) / static_cast<float>(SSAOKernelPoints);
+		vec3 v;
+		v.x = 2.0f * random(generator) - 1.0f;
+		v.y = 2.0f * random(generator) - 1.0f;
+		v.z = random(generator); // hemisphere around +z, turned onto the normal in the shader
+		v = normalize(v) * random(generator);
+
+		// closer to the origin
+		v *= (0.1f + 0.9f * scale * scale);
+
+		kernel[i] = v;
+	}
+}
+
+void BuildSSAONoise(vec3 noise[SSAONoiseSize * SSAONoiseSize])
+{
+	std::default_random_engine generator;
+	std::uniform_real_distribution<float> random(0.0f, 1.0f);
+
+	for (int i = 0; i < SSAONoiseSize * SSAONoiseSize; ++i) {
+		float x = random(generator) * 2.0f - 1.0f;
+		float y = random(generator) * 2.0f - 1.0f;
+		noise[i] = vec3(x, y, 0.0f); // z = 0, rotates about the normal
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+
+SSAOReferenceSettings::SSAOReferenceSettings()
+	: radius(1.0f), kernelSize(64), blurRadius(4), depthSharpness(50.0f), useAVX(true)
+{
+}
+
+// The taps of one blur span: for every tap k in [-radius, radius], where
+// its values for the span's first pixel are (the span's other pixels
+// follow one float apart)
+struct SSAOReference::BlurLines {
+	int radius;
+	float weights[2 * MaxBlurRadius + 1];
+	const float* ao[2 * MaxBlurRadius + 1];
+	const float* z[2 * MaxBlurRadius + 1];
+	const float* nx[2 * MaxBlurRadius + 1];
+	const float* ny[2 * MaxBlurRadius + 1];
+	const float* nz[2 * MaxBlurRadius + 1];
+};
+
+SSAOReference::SSAOReference()
+{
+	vec3 kernel[SSAOKernelPoints];
+	vec3 noise[SSAONoiseSize * SSAONoiseSize];
+	BuildSSAOKernel(kernel);
+	BuildSSAONoise(noise);
+	SetKernel(kernel);
+	SetNoise(noise);
+	SetProjection(Perspective(0.2f, 0.2f, 0.1f, 1000.0f));
+}
+
+void SSAOReference::SetKernel(const vec3* kernel)
+{
+	for (int i = 0; i < SSAOKernelPoints; ++i) {
+		kernelX[i] = kernel[i].x;
+		kernelY[i] = kernel[i].y;
+		kernelZ[i] = kernel[i].z;
+	}
+}
+
+void SSAOReference::SetNoise(const vec3* noise)
+{
+	for (int i = 0; i < SSAONoiseSize * SSAONoiseSize; ++i) {
+		noiseX[i] = noise[i].x;
+		noiseY[i] = noise[i].y;
+	}
+}
+
+void SSAOReference::SetProjection(const MAT4& P)
+{
+	MAT4 copy = P;
+	for (int row = 0; row < 4; ++row)
+		for (int column = 0; column < 4; ++column)
+			projection[row][column] = copy[row][column];
+}
+
+// Calls job(row) for every row, on the pool if there is one
+static void ForEachRow(ThreadPool* pool, int height, const std::function<void(int)>& job)
+{
+	int jobs = (height + RowsPerJob - 1) / RowsPerJob;
+	auto band = [&](int j) {
+		int end = std::min(height, (j + 1) * RowsPerJob);
+		for (int row = j * RowsPerJob; row < end; ++row)
+			job(row);
+	};
+	if (pool)
+		pool->ParallelFor(jobs, band);
+	else
+		for (int j = 0; j < jobs; ++j)
+			band(j);
+}
+
+void SSAOReference::Run(const FloatImage& x, const FloatImage& y, const FloatImage& z, FloatImage& ao, ThreadPool* pool)
+{
+	int width = z.width, height = z.height;
+	bool avx = settings.useAVX && CpuHasAVX2();
+	normalX.Resize(width, height);
+	normalY.Resize(width, height);
+	normalZ.Resize(width, height);
+	occlusion.Resize(width, height);
+	ao.Resize(width, height);
+
+	ForEachRow(pool, height, [&](int row) { Normals(x, y, z, row); });
+	ForEachRow(pool, height, [&](int row) { OcclusionRow(x, y, z, row, avx); });
+
+	int radius = std::min(std::max(settings.blurRadius, 0), MaxBlurRadius);
+	if (radius == 0) {
+		ao.data = occlusion.data;
+		return;
+	}
+
+	BlurLines lines;
+	lines.radius = radius;
+	float sigma = 0.5f * radius + 0.5f;
+	for (int k = -radius; k <= radius; ++k)
+		lines.weights[k + radius] = expf(-float(k * k) / (2.0f * sigma * sigma));
+
+	// Rows: each row copied with radius texels of clamped apron per side
+	blurTemp.Resize(width, height);
+	ForEachRow(pool, height, [&](int row) {
+		int padded = width + 2 * radius;
+		std::vector<float> apron(5 * padded);
+		const float* sources[5] = { occlusion.Row(row), z.Row(row), normalX.Row(row), normalY.Row(row), normalZ.Row(row) };
+		for (int c = 0; c < 5; ++c)
+			for (int i = 0; i < padded; ++i)
+				apron[c * padded + i] = sources[c][std::min(std::max(i - radius, 0), width - 1)];
+
+		BlurLines span = lines;
+		for (int k = 0; k <= 2 * radius; ++k) {
+			span.ao[k] = &apron[k];
+			span.z[k] = &apron[padded + k];
+			span.nx[k] = &apron[2 * padded + k];
+			span.ny[k] = &apron[3 * padded + k];
+			span.nz[k] = &apron[4 * padded + k];
+		}
+		BlurSpan(span, width, blurTemp.Row(row), avx);
+	});
+
+	// Columns, a row of pixels at a time
+	ForEachRow(pool, height, [&](int row) {
+		BlurLines span = lines;
+		for (int k = 0; k <= 2 * radius; ++k) {
+			int source = std::min(std::max(row + k - radius, 0), height - 1);
+			span.ao[k] = blurTemp.Row(source);
+			span.z[k] = z.Row(source);
+			span.nx[k] = normalX.Row(source);
+			span.ny[k] = normalY.Row(source);
+			span.nz[k] = normalZ.Row(source);
+		}
+		BlurSpan(span, width, ao.Row(row), avx);
+	});
+}
+
+////////////////////////////////////////////////////////////////////////
+// Normal from the neighbour on the side that continues the surface,
+// as ViewNormal in the shaders
+void SSAOReference::Normals(const FloatImage& x, const FloatImage& y, const FloatImage& z, int row)
+{
+	int width = z.width, height = z.height;
+	int down = std::max(row - 1, 0), up = std::min(row + 1, height - 1);
+
+	for (int i = 0; i < width; ++i) {
+		int left = std::max(i - 1, 0), right = std::min(i + 1, width - 1);
+		vec3 center(x.Row(row)[i], y.Row(row)[i], z.Row(row)[i]);
+		vec3 l(x.Row(row)[left], y.Row(row)[left], z.Row(row)[left]);
+		vec3 r(x.Row(row)[right], y.Row(row)[right], z.Row(row)[right]);
+		vec3 d(x.Row(down)[i], y.Row(down)[i], z.Row(down)[i]);
+		vec3 u(x.Row(up)[i], y.Row(up)[i], z.Row(up)[i]);
+
+		vec3 dx = fabsf(r.z - center.z) < fabsf(center.z - l.z) ? r - center : center - l;
+		vec3 dy = fabsf(u.z - center.z) < fabsf(center.z - d.z) ? u - center : center - d;
+		vec3 n = cross(dx, dy);
+		float length = sqrtf(dot(n, n));
+		n = length > 0.0f ? n / length : vec3(0.0f, 0.0f, 1.0f);
+
+		normalX.Row(row)[i] = n.x;
+		normalY.Row(row)[i] = n.y;
+		normalZ.Row(row)[i] = n.z;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// Occlusion
+
+// Bilinear depth at texel coordinates (u, v), clamped to the edges
+static float SampleDepth(const FloatImage& z, float u, float v)
+{
+	float fu = floorf(u), fv = floorf(v);
+	float fx = u - fu, fy = v - fv;
+	int x0 = std::min(std::max(int(fu), 0), z.width - 1), x1 = std::min(std::max(int(fu) + 1, 0), z.width - 1);
+	int y0 = std::min(std::max(int(fv), 0), z.height - 1), y1 = std::min(std::max(int(fv) + 1, 0), z.height - 1);
+
+	float bottom = z.Row(y0)[x0] + (z.Row(y0)[x1] - z.Row(y0)[x0]) * fx;
+	float top = z.Row(y1)[x0] + (z.Row(y1)[x1] - z.Row(y1)[x0]) * fx;
+	return bottom + (top - bottom) * fy;
+}
+
+struct OcclusionConstants {
+	float P[4][4];
+	const float *kx, *ky, *kz;
+	int stride, count;
+	float radius, width, height;
+};
+
+static void OcclusionScalar(const OcclusionConstants& c, const FloatImage& z, float px, float py, float pz,
+	float nx, float ny, float nz, float rx, float ry, float* out)
+{
+	if (pz >= 0.0f) { // background
+		*out = 1.0f;
+		return;
+	}
+
+	// Tangent frame around the normal, spun about it by the noise
+	float d = rx * nx + ry * ny;
+	float tx = rx - nx * d, ty = ry - ny * d, tz = -nz * d;
+	float t2 = tx * tx + ty * ty + tz * tz;
+	if (t2 <= 1e-6f) { // cross(n, (1, 0, 0))
+		tx = 0.0f; ty = nz; tz = -ny;
+		t2 = ty * ty + tz * tz;
+	}
+	float inverse = 1.0f / sqrtf(t2);
+	tx *= inverse; ty *= inverse; tz *= inverse;
+	float bx = ny * tz - nz * ty, by = nz * tx - nx * tz, bz = nx * ty - ny * tx;
+
+	float sum = 0.0f;
+	for (int i = 0; i < c.count; ++i) {
+		int k = i * c.stride;
+		float sx = px + (tx * c.kx[k] + bx * c.ky[k] + nx * c.kz[k]) * c.radius;
+		float sy = py + (ty * c.kx[k] + by * c.ky[k] + ny * c.kz[k]) * c.radius;
+		float sz = pz + (tz * c.kx[k] + bz * c.ky[k] + nz * c.kz[k]) * c.radius;
+
+		float cx = c.P[0][0] * sx + c.P[0][1] * sy + c.P[0][2] * sz + c.P[0][3];
+		float cy = c.P[1][0] * sx + c.P[1][1] * sy + c.P[1][2] * sz + c.P[1][3];
+		float cw = c.P[3][0] * sx + c.P[3][1] * sy + c.P[3][2] * sz + c.P[3][3];
+		float u = (cx / cw * 0.5f + 0.5f) * c.width - 0.5f;
+		float v = (cy / cw * 0.5f + 0.5f) * c.height - 0.5f;
+
+		float sampleDepth = SampleDepth(z, u, v);
+		if (sampleDepth >= 0.0f) // background
+			continue;
+
+		float range = std::min(std::max(c.radius / fabsf(pz - sampleDepth), 0.0f), 1.0f);
+		range = range * range * (3.0f - 2.0f * range);
+		if (sampleDepth >= sz + OcclusionBias)
+			sum += range;
+	}
+
+	float ao = 1.0f - sum / float(c.count);
+	*out = ao * ao;
+}
+
+// Eight pixels of a row at once, lanes in the same order as the scalar loop
+AVX2_FUNCTION static void Occlusion8(const OcclusionConstants& c, const FloatImage& z, const float* px, const float* py, const float* pz,
+	const float* nxp, const float* nyp, const float* nzp, const float* noiseX, const float* noiseY, float* out)
+{
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+	__m256 x = _mm256_loadu_ps(px), y = _mm256_loadu_ps(py), zz = _mm256_loadu_ps(pz);
+	__m256 nx = _mm256_loadu_ps(nxp), ny = _mm256_loadu_ps(nyp), nz = _mm256_loadu_ps(nzp);
+	__m256 rx = _mm256_loadu_ps(noiseX), ry = _mm256_loadu_ps(noiseY);
+	__m256 background = _mm256_cmp_ps(zz, zero, _CMP_GE_OQ);
+
+	__m256 d = _mm256_add_ps(_mm256_mul_ps(rx, nx), _mm256_mul_ps(ry, ny));
+	__m256 tx = _mm256_sub_ps(rx, _mm256_mul_ps(nx, d));
+	__m256 ty = _mm256_sub_ps(ry, _mm256_mul_ps(ny, d));
+	__m256 tz = _mm256_sub_ps(zero, _mm256_mul_ps(nz, d));
+	__m256 t2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, tx), _mm256_mul_ps(ty, ty)), _mm256_mul_ps(tz, tz));
+	__m256 degenerate = _mm256_cmp_ps(t2, _mm256_set1_ps(1e-6f), _CMP_LE_OQ);
+	tx = _mm256_blendv_ps(tx, zero, degenerate);
+	ty = _mm256_blendv_ps(ty, nz, degenerate);
+	tz = _mm256_blendv_ps(tz, _mm256_sub_ps(zero, ny), degenerate);
+	t2 = _mm256_blendv_ps(t2, _mm256_add_ps(_mm256_mul_ps(ty, ty), _mm256_mul_ps(tz, tz)), degenerate);
+	__m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(t2));
+	tx = _mm256_mul_ps(tx, inverse); ty = _mm256_mul_ps(ty, inverse); tz = _mm256_mul_ps(tz, inverse);
+	__m256 bx = _mm256_sub_ps(_mm256_mul_ps(ny, tz), _mm256_mul_ps(nz, ty));
+	__m256 by = _mm256_sub_ps(_mm256_mul_ps(nz, tx), _mm256_mul_ps(nx, tz));
+	__m256 bz = _mm256_sub_ps(_mm256_mul_ps(nx, ty), _mm256_mul_ps(ny, tx));
+
+	__m256 radius = _mm256_set1_ps(c.radius);
+	__m256 width = _mm256_set1_ps(c.width), height = _mm256_set1_ps(c.height);
+	__m256i lastX = _mm256_set1_epi32(z.width - 1), lastY = _mm256_set1_epi32(z.height - 1);
+	__m256i rowStride = _mm256_set1_epi32(z.width);
+	__m256i zeroi = _mm256_setzero_si256(), onei = _mm256_set1_epi32(1);
+	__m256 bias = _mm256_set1_ps(OcclusionBias);
+	__m256 sum = zero;
+
+	for (int i = 0; i < c.count; ++i) {
+		int k = i * c.stride;
+		__m256 kx = _mm256_set1_ps(c.kx[k]), ky = _mm256_set1_ps(c.ky[k]), kz = _mm256_set1_ps(c.kz[k]);
+		__m256 sx = _mm256_add_ps(x, _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, kx), _mm256_mul_ps(bx, ky)), _mm256_mul_ps(nx, kz)), radius));
+		__m256 sy = _mm256_add_ps(y, _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ty, kx), _mm256_mul_ps(by, ky)), _mm256_mul_ps(ny, kz)), radius));
+		__m256 sz = _mm256_add_ps(zz, _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tz, kx), _mm256_mul_ps(bz, ky)), _mm256_mul_ps(nz, kz)), radius));
+
+		__m256 clip[3];
+		const int rows[3] = { 0, 1, 3 };
+		for (int r = 0; r < 3; ++r) {
+			const float* P = c.P[rows[r]];
+			clip[r] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(P[0]), sx),
+				_mm256_mul_ps(_mm256_set1_ps(P[1]), sy)), _mm256_mul_ps(_mm256_set1_ps(P[2]), sz)), _mm256_set1_ps(P[3]));
+		}
+		__m256 u = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(clip[0], clip[2]), half), half), width), half);
+		__m256 v = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(clip[1], clip[2]), half), half), height), half);
+
+		// Bilinear gather
+		__m256 fu = _mm256_floor_ps(u), fv = _mm256_floor_ps(v);
+		__m256 fx = _mm256_sub_ps(u, fu), fy = _mm256_sub_ps(v, fv);
+		__m256i iu = _mm256_cvttps_epi32(fu), iv = _mm256_cvttps_epi32(fv);
+		__m256i x0 = _mm256_min_epi32(_mm256_max_epi32(iu, zeroi), lastX);
+		__m256i x1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(iu, onei), zeroi), lastX);
+		__m256i y0 = _mm256_mullo_epi32(_mm256_min_epi32(_mm256_max_epi32(iv, zeroi), lastY), rowStride);
+		__m256i y1 = _mm256_mullo_epi32(_mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(iv, onei), zeroi), lastY), rowStride);
+		const float* base = &z.data[0];
+		__m256 z00 = _mm256_i32gather_ps(base, _mm256_add_epi32(y0, x0), 4);
+		__m256 z10 = _mm256_i32gather_ps(base, _mm256_add_epi32(y0, x1), 4);
+		__m256 z01 = _mm256_i32gather_ps(base, _mm256_add_epi32(y1, x0), 4);
+		__m256 z11 = _mm256_i32gather_ps(base, _mm256_add_epi32(y1, x1), 4);
+		__m256 bottom = _mm256_add_ps(z00, _mm256_mul_ps(_mm256_sub_ps(z10, z00), fx));
+		__m256 top = _mm256_add_ps(z01, _mm256_mul_ps(_mm256_sub_ps(z11, z01), fx));
+		__m256 sampleDepth = _mm256_add_ps(bottom, _mm256_mul_ps(_mm256_sub_ps(top, bottom), fy));
+
+		__m256 difference = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(zz, sampleDepth));
+		__m256 range = _mm256_min_ps(_mm256_max_ps(_mm256_div_ps(radius, difference), zero), one);
+		range = _mm256_mul_ps(_mm256_mul_ps(range, range), _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), range)));
+
+		__m256 occluded = _mm256_and_ps(_mm256_cmp_ps(sampleDepth, zero, _CMP_LT_OQ),
+			_mm256_cmp_ps(sampleDepth, _mm256_add_ps(sz, bias), _CMP_GE_OQ));
+		sum = _mm256_add_ps(sum, _mm256_and_ps(occluded, range));
+	}
+
+	__m256 ao = _mm256_sub_ps(one, _mm256_div_ps(sum, _mm256_set1_ps(float(c.count))));
+	ao = _mm256_mul_ps(ao, ao);
+	_mm256_storeu_ps(out, _mm256_blendv_ps(ao, one, background));
+}
+
+void SSAOReference::OcclusionRow(const FloatImage& x, const FloatImage& y, const FloatImage& z, int row, bool avx)
+{
+	OcclusionConstants c;
+	memcpy(c.P, projection, sizeof(c.P));
+	c.kx = kernelX; c.ky = kernelY; c.kz = kernelZ;
+	c.count = std::min(std::max(settings.kernelSize, 1), SSAOKernelPoints);
+	c.stride = SSAOKernelPoints / c.count;
+	c.radius = settings.radius;
+	c.width = float(z.width);
+	c.height = float(z.height);
+
+	// The row's noise pattern repeated over eight lanes
+	const float* rowNoiseX = &noiseX[SSAONoiseSize * (row % SSAONoiseSize)];
+	const float* rowNoiseY = &noiseY[SSAONoiseSize * (row % SSAONoiseSize)];
+	float laneNoiseX[8], laneNoiseY[8];
+	for (int lane = 0; lane < 8; ++lane) {
+		laneNoiseX[lane] = rowNoiseX[lane % SSAONoiseSize];
+		laneNoiseY[lane] = rowNoiseY[lane % SSAONoiseSize];
+	}
+
+	const float *px = x.Row(row), *py = y.Row(row), *pz = z.Row(row);
+	const float *nx = normalX.Row(row), *ny = normalY.Row(row), *nz = normalZ.Row(row);
+	float* out = occlusion.Row(row);
+
+	int i = 0;
+	if (avx)
+		for (; i + 8 <= z.width; i += 8)
+			Occlusion8(c, z, px + i, py + i, pz + i, nx + i, ny + i, nz + i, laneNoiseX, laneNoiseY, out + i);
+	for (; i < z.width; ++i)
+		OcclusionScalar(c, z, px[i], py[i], pz[i], nx[i], ny[i], nz[i],
+			rowNoiseX[i % SSAONoiseSize], rowNoiseY[i % SSAONoiseSize], out + i);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Blur
+
+static void BlurScalar(const int radius, const float* weights, const float* const* ao, const float* const* z,
+	const float* const* nx, const float* const* ny, const float* const* nz, int lane, float depthSharpness, float* out)
+{
+	float depth = z[radius][lane];
+	float center = ao[radius][lane];
+	if (depth >= 0.0f) {
+		*out = center;
+		return;
+	}
+
+	float total = 0.0f, weightSum = 0.0f;
+	for (int k = 0; k <= 2 * radius; ++k) {
+		float sampleDepth = z[k][lane];
+		if (sampleDepth >= 0.0f)
+			continue;
+
+		float difference = fabsf(sampleDepth - depth) / -depth;
+		float depthWeight = 1.0f / (1.0f + depthSharpness * difference);
+		float n = std::max(nx[radius][lane] * nx[k][lane] + ny[radius][lane] * ny[k][lane] + nz[radius][lane] * nz[k][lane], 0.0f);
+		n *= n; n *= n; n *= n; // ^8
+		float weight = weights[k] * depthWeight * depthWeight * n;
+
+		total += weight * ao[k][lane];
+		weightSum += weight;
+	}
+	*out = weightSum > 1e-4f ? total / weightSum : center;
+}
+
+AVX2_FUNCTION static void Blur8(const int radius, const float* weights, const float* const* ao, const float* const* z,
+	const float* const* nx, const float* const* ny, const float* const* nz, int lane, float depthSharpness, float* out)
+{
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+	__m256 depth = _mm256_loadu_ps(z[radius] + lane);
+	__m256 center = _mm256_loadu_ps(ao[radius] + lane);
+	__m256 cx = _mm256_loadu_ps(nx[radius] + lane), cy = _mm256_loadu_ps(ny[radius] + lane), cz = _mm256_loadu_ps(nz[radius] + lane);
+	__m256 sharpness = _mm256_set1_ps(depthSharpness);
+	__m256 negativeDepth = _mm256_sub_ps(zero, depth);
+
+	__m256 total = zero, weightSum = zero;
+	for (int k = 0; k <= 2 * radius; ++k) {
+		__m256 sampleDepth = _mm256_loadu_ps(z[k] + lane);
+		__m256 valid = _mm256_cmp_ps(sampleDepth, zero, _CMP_LT_OQ);
+
+		__m256 difference = _mm256_div_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(sampleDepth, depth)), negativeDepth);
+		__m256 depthWeight = _mm256_div_ps(one, _mm256_add_ps(one, _mm256_mul_ps(sharpness, difference)));
+		__m256 n = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_loadu_ps(nx[k] + lane)),
+			_mm256_mul_ps(cy, _mm256_loadu_ps(ny[k] + lane))), _mm256_mul_ps(cz, _mm256_loadu_ps(nz[k] + lane)));
+		n = _mm256_max_ps(n, zero);
+		n = _mm256_mul_ps(n, n); n = _mm256_mul_ps(n, n); n = _mm256_mul_ps(n, n);
+		__m256 weight = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(weights[k]), depthWeight), depthWeight), n);
+		weight = _mm256_and_ps(weight, valid);
+
+		total = _mm256_add_ps(total, _mm256_mul_ps(weight, _mm256_loadu_ps(ao[k] + lane)));
+		weightSum = _mm256_add_ps(weightSum, weight);
+	}
+
+	__m256 result = _mm256_blendv_ps(center, _mm256_div_ps(total, weightSum), _mm256_cmp_ps(weightSum, _mm256_set1_ps(1e-4f), _CMP_GT_OQ));
+	_mm256_storeu_ps(out, _mm256_blendv_ps(result, center, _mm256_cmp_ps(depth, zero, _CMP_GE_OQ)));
+}
+
+void SSAOReference::BlurSpan(const BlurLines& lines, int count, float* out, bool avx)
+{
+	int i = 0;
+	if (avx)
+		for (; i + 8 <= count; i += 8)
+			Blur8(lines.radius, lines.weights, lines.ao, lines.z, lines.nx, lines.ny, lines.nz, i, settings.depthSharpness, out + i);
+	for (; i < count; ++i)
+		BlurScalar(lines.radius, lines.weights, lines.ao, lines.z, lines.nx, lines.ny, lines.nz, i, settings.depthSharpness, out + i);
+}
+
+////////////////////////////////////////////////////////////////////////
+
+bool CpuHasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	return osSavesYmm && (info[1] & (1 << 5));
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////
+
+void PositionsFromDepth(const FloatImage& depth, const MAT4& P, FloatImage& x, FloatImage& y, FloatImage& z)
+{
+	int width = depth.width, height = depth.height;
+	x.Resize(width, height);
+	y.Resize(width, height);
+	z.Resize(width, height);
+
+	// ndc z = (P22 z + P23) / -z, ndc x = (P00 x + P02 z) / -z, and y alike
+	for (int row = 0; row < height; ++row)
+		for (int column = 0; column < width; ++column) {
+			float d = depth.Row(row)[column];
+			if (d >= 1.0f) {
+				z.Row(row)[column] = 1.0f;
+				continue;
+			}
+			float ndcX = (column + 0.5f) / width * 2.0f - 1.0f;
+			float ndcY = (row + 0.5f) / height * 2.0f - 1.0f;
+			float viewZ = -P[2][3] / (d * 2.0f - 1.0f + P[2][2]);
+			x.Row(row)[column] = (-ndcX * viewZ - P[0][2] * viewZ) / P[0][0];
+			y.Row(row)[column] = (-ndcY * viewZ - P[1][2] * viewZ) / P[1][1];
+			z.Row(row)[column] = viewZ;
+		}
+}
+
+////////////////////////////////////////////////////////////////////////
+// PFM files: "PF" (RGB) or "Pf" (grey), size, negative scale for little
+// endian, then rows bottom to top
+
+bool ReadPositionsPFM(const char* fileName, FloatImage& x, FloatImage& y, FloatImage& z)
+{
+	FILE* file = fopen(fileName, "rb");
+	if (!file) {
+		printf("Cannot open %s\n", fileName);
+		return false;
+	}
+
+	char type[3] = { 0 };
+	int width = 0, height = 0;
+	float scale = 0.0f;
+	if (fscanf(file, "%2s %d %d %f", type, &width, &height, &scale) != 4 || strcmp(type, "PF") != 0 || scale >= 0.0f || width <= 0 || height <= 0) {
+		printf("%s is not a little endian RGB PFM file\n", fileName);
+		fclose(file);
+		return false;
+	}
+	fgetc(file); // the single whitespace before the data
+
+	std::vector<float> pixels(size_t(width) * height * 3);
+	bool complete = fread(&pixels[0], sizeof(float), pixels.size(), file) == pixels.size();
+	fclose(file);
+	if (!complete) {
+		printf("%s is truncated\n", fileName);
+		return false;
+	}
+
+	x.Resize(width, height);
+	y.Resize(width, height);
+	z.Resize(width, height);
+	for (size_t i = 0; i < x.data.size(); ++i) {
+		x.data[i] = pixels[3 * i];
+		y.data[i] = pixels[3 * i + 1];
+		z.data[i] = pixels[3 * i + 2];
+	}
+	return true;
+}
+
+static bool WritePFM(const char* fileName, int width, int height, int channels, const float* pixels)
+{
+	FILE* file = fopen(fileName, "wb");
+	if (!file) {
+		printf("Cannot write %s\n", fileName);
+		return false;
+	}
+	fprintf(file, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+	fwrite(pixels, sizeof(float), size_t(width) * height * channels, file);
+	fclose(file);
+	return true;
+}
+
+bool WritePFM(const char* fileName, const FloatImage& image)
+{
+	return WritePFM(fileName, image.width, image.height, 1, &image.data[0]);
+}
+
+bool WritePFM(const char* fileName, const FloatImage& x, const FloatImage& y, const FloatImage& z)
+{
+	std::vector<float> pixels(x.data.size() * 3);
+	for (size_t i = 0; i < x.data.size(); ++i) {
+		pixels[3 * i] = x.data[i];
+		pixels[3 * i + 1] = y.data[i];
+		pixels[3 * i + 2] = z.data[i];
+	}
+	return WritePFM(fileName, x.width, x.height, 3, &pixels[0]);
+}
+
+static bool ReadGreyPFM(const char* fileName, FloatImage& image)
+{
+	FILE* file = fopen(fileName, "rb");
+	if (!file)
+		return false;
+	char type[3] = { 0 };
+	int width = 0, height = 0;
+	float scale = 0.0f;
+	bool ok = fscanf(file, "%2s %d %d %f", type, &width, &height, &scale) == 4 && strcmp(type, "Pf") == 0 && scale < 0.0f && width > 0 && height > 0;
+	if (ok) {
+		fgetc(file);
+		image.Resize(width, height);
+		ok = fread(&image.data[0], sizeof(float), image.data.size(), file) == image.data.size();
+	}
+	fclose(file);
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+int RunSSAOReference(const char* positionsFile, const char* aoFile, const SSAOReferenceSettings& settings, float ry, const char* compareFile)
+{
+	FloatImage x, y, z, ao;
+	if (!ReadPositionsPFM(positionsFile, x, y, z))
+		return 1;
+
+	SSAOReference reference;
+	reference.settings = settings;
+	reference.SetProjection(Perspective(ry * float(z.width) / z.height, ry, 0.1f, 1000.0f));
+
+	ThreadPool pool;
+	using namespace std::chrono;
+	steady_clock::time_point start = steady_clock::now();
+	reference.Run(x, y, z, ao, &pool);
+	double ms = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	printf("SSAO reference: %dx%d, radius %g, %d samples, blur radius %d, %s, %u threads\n", z.width, z.height,
+		settings.radius, settings.kernelSize, settings.blurRadius, settings.useAVX && CpuHasAVX2() ? "AVX2" : "scalar", pool.ThreadCount());
+	printf("  %.2f ms, %.1f MP/s\n", ms, z.width * double(z.height) / (ms * 1000.0));
+	if (!WritePFM(aoFile, ao))
+		return 1;
+
+	if (compareFile) {
+		FloatImage gpu;
+		if (!ReadGreyPFM(compareFile, gpu) || gpu.width != ao.width || gpu.height != ao.height) {
+			printf("Cannot compare with %s (missing, not grey PFM or another size)\n", compareFile);
+			return 1;
+		}
+		double sum = 0.0;
+		float largest = 0.0f;
+		int over = 0;
+		for (size_t i = 0; i < ao.data.size(); ++i) {
+			float difference = fabsf(ao.data[i] - gpu.data[i]);
+			sum += difference;
+			largest = std::max(largest, difference);
+			over += difference > 0.05f;
+		}
+		printf("  against %s: mean difference %.5f, largest %.5f, %.3f%% of pixels off by more than 0.05\n",
+			compareFile, sum / ao.data.size(), largest, 100.0 * over / ao.data.size());
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// A ground plane with a row of spheres on it, ray cast from the origin
+// looking down -z; background is left at z = +1 like the cleared buffer
+static void RayCastTestScene(int width, int height, float rx, float ry, FloatImage& x, FloatImage& y, FloatImage& z)
+{
+	x.Resize(width, height);
+	y.Resize(width, height);
+	z.Resize(width, height);
+
+	const int sphereCount = 12;
+	vec4 spheres[sphereCount];
+	for (int i = 0; i < sphereCount; ++i)
+		spheres[i] = vec4(-6.0f + 1.1f * i, -1.0f + 0.3f * (i % 3), -12.0f - 1.5f * (i % 4), 0.4f + 0.25f * (i % 3));
+	const float groundY = -1.5f;
+
+	for (int row = 0; row < height; ++row)
+		for (int column = 0; column < width; ++column) {
+			vec3 direction(((column + 0.5f) / width * 2.0f - 1.0f) * rx, ((row + 0.5f) / height * 2.0f - 1.0f) * ry, -1.0f);
+			float nearest = 1e30f;
+			if (direction.y < 0.0f)
+				nearest = groundY / direction.y;
+			for (int i = 0; i < sphereCount; ++i) {
+				vec3 center(spheres[i].x, spheres[i].y, spheres[i].z);
+				float b = dot(direction, center), a = dot(direction, direction);
+				float discriminant = b * b - a * (dot(center, center) - spheres[i].w * spheres[i].w);
+				if (discriminant > 0.0f) {
+					float t = (b - sqrtf(discriminant)) / a;
+					if (t > 0.0f && t < nearest)
+						nearest = t;
+				}
+			}
+			bool hit = nearest < 200.0f;
+			x.Row(row)[column] = hit ? direction.x * nearest : 0.0f;
+			y.Row(row)[column] = hit ? direction.y * nearest : 0.0f;
+			z.Row(row)[column] = hit ? -nearest : 1.0f;
+		}
+}
+
+void BenchmarkSSAOReference(int width, int height, int iterations)
+{
+	width = std::max(width, 1);
+	height = std::max(height, 1);
+	float ry = 0.2f, rx = ry * float(width) / height;
+	FloatImage x, y, z;
+	RayCastTestScene(width, height, rx, ry, x, y, z);
+
+	SSAOReference reference;
+	reference.SetProjection(Perspective(rx, ry, 0.1f, 1000.0f));
+	ThreadPool pool;
+	bool avx = CpuHasAVX2();
+
+	printf("SSAO reference benchmark: %dx%d, radius %g, %d samples, blur radius %d, %d iterations\n",
+		width, height, reference.settings.radius, reference.settings.kernelSize, reference.settings.blurRadius, iterations);
+
+	FloatImage results[2];
+	for (int simd = 0; simd < (avx ? 2 : 1); ++simd)
+		for (int threaded = 0; threaded < 2; ++threaded) {
+			reference.settings.useAVX = simd == 1;
+			ThreadPool* runPool = threaded ? &pool : NULL;
+			reference.Run(x, y, z, results[simd], runPool); // warm up
+
+			using namespace std::chrono;
+			steady_clock::time_point start = steady_clock::now();
+			for (int i = 0; i < iterations; ++i)
+				reference.Run(x, y, z, results[simd], runPool);
+			double ms = duration<double, std::milli>(steady_clock::now() - start).count() / iterations;
+
+			printf("  %-6s %2u thread%s  %8.2f ms  %7.2f MP/s\n", simd ? "AVX2" : "scalar", threaded ? pool.ThreadCount() : 1u,
+				threaded && pool.ThreadCount() > 1 ? "s" : " ", ms, width * double(height) / (ms * 1000.0));
+		}
+
+	if (avx) {
+		float largest = 0.0f;
+		for (size_t i = 0; i < results[0].data.size(); ++i)
+			largest = std::max(largest, fabsf(results[0].data[i] - results[1].data[i]));
+		printf("  largest AVX2 / scalar difference %g\n", largest);
+	}
+	else
+		printf("  no AVX2 on this CPU\n");
+}
@@ -0,0 +1,109 @@
+///////////////////////////////////////////////////////////////////////
+// CPU reference of the forward SSAO pipeline: view space positions ->
+// hemisphere kernel occlusion (shaders/ssaoOcclusionCalculationPass.frag)
+// -> separable bilateral blur (shaders/ssaoOcclusionBlurPass.comp).
+// It follows the shaders operation for operation with the full
+// resolution kernel method, its taps read from full resolution depth
+// (the depth pyramid off), so its output is the golden image to diff a
+// shader change against, and it runs without a GL context on position
+// buffers from disk for offline AO baking.
+//
+// Images are planar float arrays, rows bottom to top like GL textures.
+// Rows are spread over the thread pool; within a row eight pixels go
+// through the AVX2 path at once when the CPU has it, otherwise the
+// scalar path runs (and is the reference for the AVX2 one).
+//
+// Normals are rebuilt from the positions with the shaders' neighbour
+// rule, so they differ from the GPU's geometry normals at silhouettes.
+//
+// Files are PFM: 3 channels (view space x, y, z) in, 1 channel AO out.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _SSAOREFERENCE_
+#define _SSAOREFERENCE_
+
+#include <vector>
+
+#include "transform.h"
+
+class ThreadPool;
+
+const int SSAOKernelPoints = 128;
+const int SSAONoiseSize = 4; // the noise tiles in 4x4 pixel blocks
+
+// The kernel and noise the GPU passes use too (Scene::BuildSSAOSampleKernel)
+void BuildSSAOKernel(vec3 kernel[SSAOKernelPoints]);
+void BuildSSAONoise(vec3 noise[SSAONoiseSize * SSAONoiseSize]);
+
+struct FloatImage
+{
+	int width, height;
+	std::vector<float> data;
+
+	FloatImage() : width(0), height(0) {}
+	void Resize(int w, int h) { width = w; height = h; data.assign(size_t(w) * h, 0.0f); }
+	float* Row(int y) { return &data[size_t(y) * width]; }
+	const float* Row(int y) const { return &data[size_t(y) * width]; }
+};
+
+struct SSAOReferenceSettings
+{
+	float radius;
+	int kernelSize;       // 8 to 128, every (128 / kernelSize)th kernel point
+	int blurRadius;       // 0 skips the blur
+	float depthSharpness;
+	bool useAVX;          // ignored without AVX2
+
+	SSAOReferenceSettings();
+};
+
+class SSAOReference
+{
+public:
+	SSAOReference();
+
+	void SetKernel(const vec3* kernel);   // SSAOKernelPoints points
+	void SetNoise(const vec3* noise);     // 16 vectors
+	void SetProjection(const MAT4& projection);
+
+	// AO of view space positions; a NULL pool runs on the calling thread
+	void Run(const FloatImage& x, const FloatImage& y, const FloatImage& z, FloatImage& ao, ThreadPool* pool);
+
+	SSAOReferenceSettings settings;
+
+	// Of the last Run
+	FloatImage normalX, normalY, normalZ;
+	FloatImage occlusion; // before the blur
+
+private:
+	struct BlurLines;
+
+	void Normals(const FloatImage& x, const FloatImage& y, const FloatImage& z, int row);
+	void OcclusionRow(const FloatImage& x, const FloatImage& y, const FloatImage& z, int row, bool avx);
+	void BlurSpan(const BlurLines& lines, int count, float* out, bool avx);
+
+	float kernelX[SSAOKernelPoints], kernelY[SSAOKernelPoints], kernelZ[SSAOKernelPoints];
+	float noiseX[SSAONoiseSize * SSAONoiseSize], noiseY[SSAONoiseSize * SSAONoiseSize];
+	float projection[4][4];
+	FloatImage blurTemp;
+};
+
+bool CpuHasAVX2();
+
+// View space positions from a [0,1] depth buffer seen through a
+// perspective projection, as ssaoDepth.glsl rebuilds them; cleared
+// depth (1) becomes background at z = +1
+void PositionsFromDepth(const FloatImage& depth, const MAT4& projection, FloatImage& x, FloatImage& y, FloatImage& z);
+
+bool ReadPositionsPFM(const char* fileName, FloatImage& x, FloatImage& y, FloatImage& z);
+bool WritePFM(const char* fileName, const FloatImage& image);
+bool WritePFM(const char* fileName, const FloatImage& x, const FloatImage& y, const FloatImage& z);
+
+// Command line jobs: AO of a position file seen through the scene's
+// projection (ry as in Scene, rx from the image's aspect), optionally
+// compared with a GPU AO file; and a throughput benchmark on a ray cast
+// test scene
+int RunSSAOReference(const char* positionsFile, const char* aoFile, const SSAOReferenceSettings& settings, float ry, const char* compareFile);
+void BenchmarkSSAOReference(int width, int height, int iterations);
+
+#endif
@@ -32,6 +32,44 @@ void Texture::GenerateTextureForSSAONoise(glm::vec3* data)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 }
 
+// Nearest filtered, used for the deinterleaved SSAO layers
+void Texture::GenerateTextureArray(int width, int height, int layers, unsigned int internalFormat, unsigned int format)
+{
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureId);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, width, height, layers, 0, format, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Levels are allocated but left empty, for passes that write them
+void Texture::GenerateMipmappedTexture(int width, int height, int levels, unsigned int internalFormat, unsigned int format)
+{
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	for (int level = 0; level < levels; ++level) {
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, GL_FLOAT, NULL);
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Texture::Delete()
+{
+	if (textureId)
+		glDeleteTextures(1, &textureId);
+	textureId = 0;
+}
+
 void Texture::Read(const std::string &filename)
 {
     try {
@@ -19,6 +19,9 @@ class Texture
     Texture() :textureId(0) {};
 	void GenerateTexture(int width, int height, unsigned int internalFormat, unsigned int format);
 	void GenerateTextureForSSAONoise(glm::vec3* data);
+	void GenerateTextureArray(int width, int height, int layers, unsigned int internalFormat, unsigned int format);
+	void GenerateMipmappedTexture(int width, int height, int levels, unsigned int internalFormat, unsigned int format);
+	void Delete();
     void Read(const std::string &filename);
     void Bind(const int unit);
     void Unbind();
@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////
+// A small pool of worker threads used to spread per-frame CPU work
+// across the cores.  See threadpool.h.
+////////////////////////////////////////////////////////////////////////
+
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: currentJob(NULL), jobCount(0), nextJob(0), finishedJobs(0), activeWorkers(0), generation(0), quit(false)
+{
+	if (threadCount == 0) {
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	for (unsigned int i = 0; i < threadCount; ++i)
+		workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeUp.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& job)
+{
+	if (count <= 0)
+		return;
+
+	// Not worth waking anyone up for
+	if (count == 1 || workers.empty()) {
+		for (int i = 0; i < count; ++i)
+			job(i);
+		return;
+	}
+
+	// No worker is inside RunJobs here: the previous ParallelFor waited
+	// for all of them to leave, and one that wakes up late finds no job.
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentJob = &job;
+		jobCount = count;
+		nextJob = 0;
+		finishedJobs = 0;
+		++generation;
+	}
+	wakeUp.notify_all();
+
+	// The calling thread works too
+	RunJobs();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	jobsDone.wait(lock, [this] { return finishedJobs.load() == jobCount && activeWorkers == 0; });
+	currentJob = NULL;
+}
+
+void ThreadPool::RunJobs()
+{
+	int index;
+	while ((index = nextJob.fetch_add(1)) < jobCount) {
+		(*currentJob)(index);
+
+		if (finishedJobs.fetch_add(1) + 1 == jobCount) {
+			std::lock_guard<std::mutex> lock(mutex);
+			jobsDone.notify_one();
+		}
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	unsigned int seenGeneration = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [&] { return quit || generation != seenGeneration; });
+			if (quit)
+				return;
+			seenGeneration = generation;
+			if (!currentJob)
+				continue; // woke after the caller had finished it
+			++activeWorkers;
+		}
+
+		RunJobs();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--activeWorkers == 0)
+			jobsDone.notify_one();
+	}
+}
@@ -0,0 +1,52 @@
+///////////////////////////////////////////////////////////////////////
+// A small pool of worker threads used to spread per-frame CPU work
+// (command recording, light binning, ...) across the cores.  The GLUT
+// thread hands out a job with ParallelFor and takes part in it
+// itself, so a pool with zero workers simply runs the job inline.
+//
+// Only the thread that owns the GL context calls ParallelFor; jobs
+// must not touch OpenGL.
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _THREADPOOL_
+#define _THREADPOOL_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// threadCount == 0 picks one worker per hardware thread minus the caller
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	// Number of threads that run a ParallelFor, including the caller
+	unsigned int ThreadCount() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+	// Calls job(i) once for every i in [0, count) and blocks until all are done
+	void ParallelFor(int count, const std::function<void(int)>& job);
+
+private:
+	void WorkerLoop();
+	void RunJobs();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	std::condition_variable jobsDone;
+
+	const std::function<void(int)>* currentJob;
+	int jobCount;
+	std::atomic<int> nextJob;
+	std::atomic<int> finishedJobs;
+	int activeWorkers; // workers inside RunJobs; guarded by mutex
+	unsigned int generation;
+	bool quit;
+};
+
+#endif